@@ -22,6 +22,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#ifndef ETIMEDOUT
+# define ETIMEDOUT 138  /* As used by assuan-socket.c.  */
+#endif
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
@@ -34,6 +37,17 @@
 #include "assuan-defs.h"
 
 
+/* Return the error code for a failed writen or readline.  An expired
+   I/O timeout gets its own code.  */
+static gpg_err_code_t
+io_errcode (void)
+{
+  if (errno == ETIMEDOUT)
+    return GPG_ERR_TIMEOUT;
+  return gpg_err_code_from_syserror ();
+}
+
+
 /* Extended version of write(2) to guarantee that all bytes are
    written.  Returns 0 on success or -1 and ERRNO on failure.  NOTE:
    This function does not return the number of bytes written, so any
@@ -43,16 +57,32 @@
 static int
 writen (assuan_context_t ctx, const char *buffer, size_t length)
 {
+  gpg_error_t err;
+
   while (length)
     {
-      ssize_t nwritten = ctx->engine.writefnc (ctx, buffer, length);
+      ssize_t nwritten;
 
+      if (_assuan_wait_peer (ctx, 1))
+        return -1;
+      nwritten = ctx->engine.writefnc (ctx, buffer, length);
+      _assuan_stats_add (ctx, write_calls, 1);
       if (nwritten < 0)
         {
           if (errno == EINTR)
             continue;
+          if (errno == EAGAIN)
+            {
+              err = _assuan_wait_fd (ctx, ctx->outbound.fd, 1);
+              if (!err)
+                continue;
+              gpg_err_set_errno (gpg_err_code (err) == GPG_ERR_TIMEOUT
+                                 ? ETIMEDOUT
+                                 : gpg_err_code_to_errno (gpg_err_code (err)));
+            }
           return -1; /* write error */
         }
+      _assuan_stats_add (ctx, bytes_out, nwritten);
       length -= nwritten;
       buffer += nwritten;
     }
@@ -74,8 +104,12 @@ readline (assuan_context_t ctx, char *buf, size_t buflen,
   *r_nread = 0;
   while (nleft > 0)
     {
-      ssize_t n = ctx->engine.readfnc (ctx, buf, nleft);
+      ssize_t n;
 
+      if (_assuan_wait_peer (ctx, 0))
+        return -1;
+      n = ctx->engine.readfnc (ctx, buf, nleft);
+      _assuan_stats_add (ctx, read_calls, 1);
       if (n < 0)
         {
           if (errno == EINTR)
@@ -97,6 +131,7 @@ readline (assuan_context_t ctx, char *buf, size_t buflen,
           break; /* allow incomplete lines */
         }
 
+      _assuan_stats_add (ctx, bytes_in, n);
       p = buf;
       nleft -= n;
       buf += n;
@@ -156,7 +191,7 @@ _assuan_read_line (assuan_context_t ctx)
       snprintf (buf, sizeof buf, "error: %s", strerror (errno));
       _assuan_log_control_channel (ctx, 0, buf, NULL, 0, NULL, 0);
 
-      if (saved_errno == EAGAIN)
+      if (saved_errno == EAGAIN || saved_errno == ETIMEDOUT)
         {
           /* We have to save a partial line.  Due to readline's
 	     behaviour, we know that this is not a complete line yet
@@ -167,7 +202,7 @@ _assuan_read_line (assuan_context_t ctx)
         }
 
       gpg_err_set_errno (saved_errno);
-      return _assuan_error (ctx, gpg_err_code_from_syserror ());
+      return _assuan_error (ctx, io_errcode ());
     }
   if (!nread)
     {
@@ -203,6 +238,7 @@ _assuan_read_line (assuan_context_t ctx)
       *endp = 0;
 
       ctx->inbound.linelen = endp - line;
+      _assuan_stats_add (ctx, lines_in, 1);
 
       monitor_result = 0;
       if (ctx->io_monitor)
@@ -252,7 +288,7 @@ assuan_read_line (assuan_context_t ctx, char **line, size_t *linelen)
     {
       err = _assuan_read_line (ctx);
     }
-  while (_assuan_error_is_eagain (ctx, err));
+  while (_assuan_error_is_eagain (ctx, &err));
 
   *line = ctx->inbound.line;
   *linelen = ctx->inbound.linelen;
@@ -304,19 +340,21 @@ _assuan_write_line (assuan_context_t ctx, const char *prefix,
     {
       rc = writen (ctx, prefix, prefixlen);
       if (rc)
-	rc = _assuan_error (ctx, gpg_err_code_from_syserror ());
+	rc = _assuan_error (ctx, io_errcode ());
     }
   if (!rc && !(monitor_result & ASSUAN_IO_MONITOR_IGNORE))
     {
       rc = writen (ctx, line, len);
       if (rc)
-	rc = _assuan_error (ctx, gpg_err_code_from_syserror ());
+	rc = _assuan_error (ctx, io_errcode ());
       if (!rc)
         {
           rc = writen (ctx, "\n", 1);
           if (rc)
-	    rc = _assuan_error (ctx, gpg_err_code_from_syserror ());
+	    rc = _assuan_error (ctx, io_errcode ());
         }
+      if (!rc)
+        _assuan_stats_add (ctx, lines_out, 1);
     }
   return rc;
 }
@@ -346,79 +384,156 @@ assuan_write_line (assuan_context_t ctx, const char *line)
 
 
 
-/* Write out the data in buffer as datalines with line wrapping and
-   percent escaping.  This function is used for GNU's custom streams. */
-int
-_assuan_cookie_write_data (void *cookie, const char *buffer, size_t orig_size)
+/* Data lines are escaped into a batch buffer, which collects complete
+   lines followed by the line currently being filled, so that many
+   lines are written at once.  The partial line is kept in
+   CTX->OUTBOUND.DATA.LINE between calls.  If that line buffer itself
+   is used for the batch, each line is written on its own.  */
+struct data_batch_s
 {
-  assuan_context_t ctx = cookie;
-  size_t size = orig_size;
-  char *line;
-  size_t linelen;
+  char *buf;
+  size_t size;
+  size_t len;      /* Length of the complete lines.  */
+  size_t linelen;  /* Length of the current line at BUF + LEN.  */
+};
+
+
+static void
+batch_begin (assuan_context_t ctx, struct data_batch_s *b,
+             char *buf, size_t size)
+{
+  b->buf = buf;
+  b->size = size;
+  b->len = 0;
+  b->linelen = ctx->outbound.data.linelen;
+  if (buf != ctx->outbound.data.line)
+    memcpy (buf, ctx->outbound.data.line, b->linelen);
+}
 
-  if (ctx->outbound.data.error)
-    return 0;
 
-  line = ctx->outbound.data.line;
-  linelen = ctx->outbound.data.linelen;
-  line += linelen;
-  while (size)
+/* Write out the complete lines of B.  */
+static void
+batch_write (assuan_context_t ctx, struct data_batch_s *b)
+{
+  if (b->len && !ctx->outbound.data.error
+      && writen (ctx, b->buf, b->len))
+    ctx->outbound.data.error = io_errcode ();
+  b->len = 0;
+}
+
+
+/* Terminate the current line of B.  */
+static void
+batch_end_line (assuan_context_t ctx, struct data_batch_s *b)
+{
+  char *line = b->buf + b->len;
+  unsigned int monitor_result = 0;
+
+  if (ctx->io_monitor)
+    monitor_result = ctx->io_monitor (ctx, ctx->io_monitor_data, 1,
+                                      line, b->linelen);
+  if (!(monitor_result & ASSUAN_IO_MONITOR_NOLOG))
+    _assuan_log_control_channel (ctx, 1, NULL, line, b->linelen, NULL, 0);
+  if (!(monitor_result & ASSUAN_IO_MONITOR_IGNORE))
+    {
+      line[b->linelen] = '\n';
+      b->len += b->linelen + 1;
+      _assuan_stats_add (ctx, lines_out, 1);
+      _assuan_stats_add (ctx, data_out_escaped, b->linelen - 2);
+    }
+  b->linelen = 0;
+}
+
+
+/* Escape SIZE bytes from BUFFER into data lines of B.  Runs of bytes
+   which need no escaping are copied at once.  */
+static void
+batch_add (assuan_context_t ctx, struct data_batch_s *b,
+           const char *buffer, size_t size)
+{
+  static const char hexdigits[] = "0123456789ABCDEF";
+
+  _assuan_stats_add (ctx, data_out, size);
+  while (size && !ctx->outbound.data.error)
     {
-      unsigned int monitor_result;
+      char *line = b->buf + b->len;
+      char *p, *end;
+      size_t n, i;
 
       /* Insert data line header. */
-      if (!linelen)
+      if (!b->linelen)
         {
-          *line++ = 'D';
-          *line++ = ' ';
-          linelen += 2;
+          line[0] = 'D';
+          line[1] = ' ';
+          b->linelen = 2;
         }
 
-      /* Copy data, keep space for the CRLF and to escape one character. */
-      while (size && linelen < LINELENGTH-2-2)
+      /* Copy data, keep space for the LF and to escape one character. */
+      p = line + b->linelen;
+      end = line + LINELENGTH-2-2;
+      while (size && p < end)
         {
-          if (*buffer == '%' || *buffer == '\r' || *buffer == '\n')
+          n = end - p;
+          if (n > size)
+            n = size;
+          for (i = 0; i < n; i++)
+            if (buffer[i] == '%' || buffer[i] == '\r' || buffer[i] == '\n')
+              break;
+          memcpy (p, buffer, i);
+          p += i;
+          buffer += i;
+          size -= i;
+          if (i < n)
             {
-              sprintf (line, "%%%02X", *(unsigned char*)buffer);
-              line += 3;
-              linelen += 3;
+              *p++ = '%';
+              *p++ = hexdigits[(*(unsigned char*)buffer >> 4)];
+              *p++ = hexdigits[(*(unsigned char*)buffer & 15)];
               buffer++;
+              size--;
             }
-          else
-            {
-              *line++ = *buffer++;
-              linelen++;
-            }
-          size--;
         }
+      b->linelen = p - line;
 
-
-      monitor_result = 0;
-      if (ctx->io_monitor)
-	monitor_result = ctx->io_monitor (ctx, ctx->io_monitor_data, 1,
-					  ctx->outbound.data.line, linelen);
-
-      if (linelen >= LINELENGTH-2-2)
+      if (p >= end)
         {
-          if (!(monitor_result & ASSUAN_IO_MONITOR_NOLOG))
-            _assuan_log_control_channel (ctx, 1, NULL,
-                                         ctx->outbound.data.line, linelen,
-                                         NULL, 0);
-
-          *line++ = '\n';
-          linelen++;
-          if ( !(monitor_result & ASSUAN_IO_MONITOR_IGNORE)
-               && writen (ctx, ctx->outbound.data.line, linelen))
-            {
-              ctx->outbound.data.error = gpg_err_code_from_syserror ();
-              return 0;
-            }
-          line = ctx->outbound.data.line;
-          linelen = 0;
+          batch_end_line (ctx, b);
+          if (b->size - b->len < LINELENGTH)
+            batch_write (ctx, b);
         }
     }
+}
+
+
+/* Write out the complete lines of B and keep its partial line for the
+   next call.  */
+static void
+batch_finish (assuan_context_t ctx, struct data_batch_s *b)
+{
+  size_t len = b->len;
+
+  batch_write (ctx, b);
+  if (b->buf + len != ctx->outbound.data.line)
+    memmove (ctx->outbound.data.line, b->buf + len, b->linelen);
+  ctx->outbound.data.linelen = b->linelen;
+}
 
-  ctx->outbound.data.linelen = linelen;
+
+/* Write out the data in buffer as datalines with line wrapping and
+   percent escaping.  This function is used for GNU's custom streams. */
+int
+_assuan_cookie_write_data (void *cookie, const char *buffer, size_t orig_size)
+{
+  assuan_context_t ctx = cookie;
+  struct data_batch_s batch;
+
+  if (ctx->outbound.data.error)
+    return 0;
+
+  batch_begin (ctx, &batch, ctx->outbound.data.line, LINELENGTH);
+  batch_add (ctx, &batch, buffer, orig_size);
+  batch_finish (ctx, &batch);
+  if (ctx->outbound.data.error)
+    return 0;
   return (int) orig_size;
 }
 
@@ -429,38 +544,15 @@ int
 _assuan_cookie_write_flush (void *cookie)
 {
   assuan_context_t ctx = cookie;
-  char *line;
-  size_t linelen;
-  unsigned int monitor_result;
+  struct data_batch_s batch;
 
   if (ctx->outbound.data.error)
     return 0;
 
-  line = ctx->outbound.data.line;
-  linelen = ctx->outbound.data.linelen;
-  line += linelen;
-
-  monitor_result = 0;
-  if (ctx->io_monitor)
-    monitor_result = ctx->io_monitor (ctx, ctx->io_monitor_data, 1,
-				      ctx->outbound.data.line, linelen);
-
-  if (linelen)
-    {
-      if (!(monitor_result & ASSUAN_IO_MONITOR_NOLOG))
-        _assuan_log_control_channel (ctx, 1, NULL,
-                                     ctx->outbound.data.line, linelen,
-                                     NULL, 0);
-      *line++ = '\n';
-      linelen++;
-      if (! (monitor_result & ASSUAN_IO_MONITOR_IGNORE)
-           && writen (ctx, ctx->outbound.data.line, linelen))
-        {
-          ctx->outbound.data.error = gpg_err_code_from_syserror ();
-          return 0;
-        }
-      ctx->outbound.data.linelen = 0;
-    }
+  batch_begin (ctx, &batch, ctx->outbound.data.line, LINELENGTH);
+  if (batch.linelen)
+    batch_end_line (ctx, &batch);
+  batch_finish (ctx, &batch);
   return 0;
 }
 
@@ -502,6 +594,15 @@ assuan_send_data (assuan_context_t ctx, const void *buffer, size_t length)
       if (!ctx->is_server)
         return assuan_write_line (ctx, length == 1? "CAN":"END");
     }
+  else if (ctx->memfd_threshold && length >= ctx->memfd_threshold
+           && !ctx->flags.confidential)
+    {
+      /* Flush the pending data lines to keep the order.  */
+      _assuan_cookie_write_flush (ctx);
+      if (ctx->outbound.data.error)
+        return ctx->outbound.data.error;
+      return _assuan_memfd_send (ctx, buffer, length);
+    }
   else
     {
       _assuan_cookie_write_data (ctx, buffer, length);
@@ -512,9 +613,177 @@ assuan_send_data (assuan_context_t ctx, const void *buffer, size_t length)
   return 0;
 }
 
+/* The size of the blocks read by assuan_send_data_from_fd and the
+   number of data lines written at once.  */
+#define SEND_FD_BLOCKSIZE  65536
+#define SEND_FD_BATCHLINES 32
+
+/**
+ * assuan_send_data_from_fd:
+ * @ctx: An assuan context
+ * @fd: The file descriptor to read the data from
+ * @length: Number of bytes to send or 0 to send everything up to the
+ *          end of file
+ *
+ * This function may be used like assuan_send_data by the server or
+ * the client to send data lines with the data read from @fd.  The data
+ * is read in large blocks and many data lines are written at once.
+ * As with assuan_send_data the last line may get buffered and the
+ * data has to be flushed to send the END.  If @fd ends before @length
+ * bytes have been read, GPG_ERR_EOF is returned.
+ *
+ * Return value: 0 on success or an error code
+ **/
+gpg_error_t
+assuan_send_data_from_fd (assuan_context_t ctx, assuan_fd_t fd,
+                          size_t length)
+{
+  gpg_error_t err = 0;
+  char *block;
+  struct data_batch_s batch;
+  int to_eof = !length;
+
+  if (!ctx || fd == ASSUAN_INVALID_FD)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  if (ctx->outbound.data.error)
+    return ctx->outbound.data.error;
+
+  block = _assuan_malloc (ctx, SEND_FD_BLOCKSIZE
+                          + SEND_FD_BATCHLINES * LINELENGTH);
+  if (!block)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  batch_begin (ctx, &batch, block + SEND_FD_BLOCKSIZE,
+               SEND_FD_BATCHLINES * LINELENGTH);
+
+  while (to_eof || length)
+    {
+      ssize_t n;
+
+      n = _assuan_read (ctx, fd, block,
+                        to_eof || length > SEND_FD_BLOCKSIZE
+                        ? SEND_FD_BLOCKSIZE : length);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+              err = _assuan_wait_fd (ctx, fd, 0);
+              if (!err)
+                continue;
+            }
+          else
+            err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+          break;
+        }
+      if (!n)
+        {
+          if (!to_eof)
+            err = _assuan_error (ctx, GPG_ERR_EOF);
+          break;
+        }
+      if (!to_eof)
+        length -= n;
+
+      if (ctx->memfd_threshold && n >= ctx->memfd_threshold
+          && !ctx->flags.confidential)
+        {
+          /* Flush the pending data lines to keep the order.  */
+          batch_finish (ctx, &batch);
+          err = assuan_send_data (ctx, block, n);
+          batch_begin (ctx, &batch, block + SEND_FD_BLOCKSIZE,
+                       SEND_FD_BATCHLINES * LINELENGTH);
+        }
+      else
+        batch_add (ctx, &batch, block, n);
+      if (!err)
+        err = ctx->outbound.data.error;
+      if (err)
+        break;
+    }
+
+  batch_finish (ctx, &batch);
+  if (!err)
+    err = ctx->outbound.data.error;
+  if (ctx->flags.confidential)
+    wipememory (block, SEND_FD_BLOCKSIZE + SEND_FD_BATCHLINES * LINELENGTH);
+  _assuan_free (ctx, block);
+  return err;
+}
+
+
+/* The number of data lines assuan_send_data_iov writes at once.  */
+#define SEND_IOV_BATCHLINES 8
+
+/**
+ * assuan_send_data_iov:
+ * @ctx: An assuan context
+ * @iov: The pieces of data to send
+ * @iovcnt: The number of pieces
+ *
+ * This function is like assuan_send_data but sends the @iovcnt pieces
+ * of data described by @iov as if they were one buffer.  The data
+ * lines span the pieces and several lines are written at once.
+ *
+ * Return value: 0 on success or an error code
+ **/
+gpg_error_t
+assuan_send_data_iov (assuan_context_t ctx,
+                      const struct assuan_iovec *iov, int iovcnt)
+{
+  gpg_error_t err = 0;
+  char buffer[SEND_IOV_BATCHLINES * LINELENGTH];
+  struct data_batch_s batch;
+  size_t total = 0;
+  int i;
+
+  if (!ctx || (!iov && iovcnt) || iovcnt < 0)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (!iov[i].data && iov[i].length)
+        return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+      total += iov[i].length;
+    }
+  if (ctx->outbound.data.error)
+    return ctx->outbound.data.error;
+
+  /* A single line does not need the batch buffer.  */
+  if (ctx->outbound.data.linelen + total < LINELENGTH-2-2)
+    batch_begin (ctx, &batch, ctx->outbound.data.line, LINELENGTH);
+  else
+    batch_begin (ctx, &batch, buffer, sizeof buffer);
+
+  for (i = 0; i < iovcnt && !err; i++)
+    {
+      if (ctx->memfd_threshold && iov[i].length >= ctx->memfd_threshold
+          && !ctx->flags.confidential)
+        {
+          /* Flush the pending data lines to keep the order.  */
+          batch_finish (ctx, &batch);
+          err = assuan_send_data (ctx, iov[i].data, iov[i].length);
+          batch_begin (ctx, &batch, buffer, sizeof buffer);
+        }
+      else
+        batch_add (ctx, &batch, iov[i].data, iov[i].length);
+      if (!err)
+        err = ctx->outbound.data.error;
+    }
+
+  batch_finish (ctx, &batch);
+  if (!err)
+    err = ctx->outbound.data.error;
+  if (ctx->flags.confidential)
+    wipememory (buffer, sizeof buffer);
+  return err;
+}
+
+
 gpg_error_t
 assuan_sendfd (assuan_context_t ctx, assuan_fd_t fd)
 {
+  gpg_error_t err;
+
   /* It is explicitly allowed to use (NULL, -1) as a runtime test to
      check whether descriptor passing is available. */
   if (!ctx && fd == ASSUAN_INVALID_FD)
@@ -531,12 +800,45 @@ assuan_sendfd (assuan_context_t ctx, assuan_fd_t fd)
     return set_error (ctx, GPG_ERR_NOT_IMPLEMENTED,
 		      "server does not support sending and receiving "
 		      "of file descriptors");
-  return ctx->engine.sendfd (ctx, fd);
+  err = ctx->engine.sendfd (ctx, fd);
+  if (!err)
+    _assuan_stats_add (ctx, fds_sent, 1);
+  return err;
+}
+
+/* Send the N descriptors FDS to the peer.  If the engine supports
+   it, this is done with a single message (or a few for a very large
+   N).  The peer needs to call assuan_receivefd for each of them.  */
+gpg_error_t
+assuan_sendfds (assuan_context_t ctx, const assuan_fd_t *fds, int n)
+{
+  gpg_error_t err = 0;
+  int i;
+
+  if (!ctx || n < 0 || (n && !fds))
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+
+  if (! ctx->engine.sendfd)
+    return set_error (ctx, GPG_ERR_NOT_IMPLEMENTED,
+		      "server does not support sending and receiving "
+		      "of file descriptors");
+  if (!n)
+    return 0;
+  if (ctx->engine.sendfds)
+    err = ctx->engine.sendfds (ctx, fds, n);
+  else
+    for (i = 0; i < n && !err; i++)
+      err = ctx->engine.sendfd (ctx, fds[i]);
+  if (!err)
+    _assuan_stats_add (ctx, fds_sent, n);
+  return err;
 }
 
 gpg_error_t
 assuan_receivefd (assuan_context_t ctx, assuan_fd_t *fd)
 {
+  gpg_error_t err;
+
   if (!ctx)
     return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
 
@@ -544,5 +846,8 @@ assuan_receivefd (assuan_context_t ctx, assuan_fd_t *fd)
     return set_error (ctx, GPG_ERR_NOT_IMPLEMENTED,
 		      "server does not support sending and receiving "
 		      "of file descriptors");
-  return ctx->engine.receivefd (ctx, fd);
+  err = ctx->engine.receivefd (ctx, fd);
+  if (!err)
+    _assuan_stats_add (ctx, fds_received, 1);
+  return err;
 }
@@ -0,0 +1,363 @@
+/* assuan-defer.c - Complete commands from other threads
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "assuan-defs.h"
+#include "debug.h"
+
+
+/* A deferred command is finished by a worker thread, which must not
+   touch the context.  It queues the status lines, the data and the
+   final result in the deferred object instead, and the thread running
+   the event loop of the context writes them out with
+   assuan_run_deferred.  The deferred object is shared by both threads
+   and protected by its lock.  It is released by the side which lets
+   go of it last: the event loop after the result has been sent, or
+   the worker if the context has been released before.  */
+
+#define DEFERRED_STATUS 1
+#define DEFERRED_DATA   2
+
+struct deferred_op_s
+{
+  struct deferred_op_s *next;
+  int type;
+  size_t len;          /* Length of the data.  */
+  char buf[1];         /* The data or the keyword and text of a status
+                          line, each terminated by a Nul.  */
+};
+
+struct assuan_deferred_s
+{
+  gpgrt_lock_t lock;
+  struct assuan_malloc_hooks malloc_hooks;
+  assuan_context_t ctx;       /* NULL once the context is gone.  */
+  assuan_deferred_notify_t notify_fnc;
+  void *notify_value;
+  struct deferred_op_s *ops;  /* Not yet written out.  */
+  struct deferred_op_s **ops_tail;
+  gpg_error_t error;          /* An error while writing out.  */
+  gpg_error_t rc;             /* The result of the command.  */
+  unsigned int done:1;        /* assuan_deferred_done has been called.  */
+};
+
+
+static void
+free_ops (assuan_deferred_t def, struct deferred_op_s *op)
+{
+  struct deferred_op_s *next;
+
+  for (; op; op = next)
+    {
+      next = op->next;
+      wipememory (op->buf, op->len);
+      def->malloc_hooks.free (op);
+    }
+}
+
+
+static void
+release_deferred (assuan_deferred_t def)
+{
+  free_ops (def, def->ops);
+  gpgrt_lock_destroy (&def->lock);
+  def->malloc_hooks.free (def);
+}
+
+
+/* Queue OP for the event loop.  Returns an error and releases OP if
+   the context is gone or could not write out earlier data.  */
+static gpg_error_t
+queue_op (assuan_deferred_t def, struct deferred_op_s *op)
+{
+  gpg_error_t err;
+  int wakeup;
+
+  gpgrt_lock_lock (&def->lock);
+  if (!def->ctx)
+    err = _assuan_error (NULL, GPG_ERR_CANCELED);
+  else
+    err = def->error;
+  if (err)
+    {
+      gpgrt_lock_unlock (&def->lock);
+      free_ops (def, op);
+      return err;
+    }
+  wakeup = !def->ops;
+  *def->ops_tail = op;
+  def->ops_tail = &op->next;
+  /* The lock keeps the context alive while the event loop is
+     woken up.  */
+  if (wakeup && def->notify_fnc)
+    def->notify_fnc (def->notify_value, def->ctx);
+  gpgrt_lock_unlock (&def->lock);
+  return 0;
+}
+
+
+static struct deferred_op_s *
+new_op (assuan_deferred_t def, int type, size_t len)
+{
+  struct deferred_op_s *op;
+
+  op = def->malloc_hooks.malloc (sizeof *op + len);
+  if (op)
+    {
+      op->next = NULL;
+      op->type = type;
+      op->len = len;
+    }
+  return op;
+}
+
+
+/* Register the function FNC to be called with VALUE and CTX whenever
+   a worker has queued output of a deferred command of CTX.  The
+   function is called from the worker thread and must only wake up
+   the event loop running CTX, which then calls assuan_run_deferred.  */
+gpg_error_t
+assuan_register_deferred_notify (assuan_context_t ctx,
+                                 assuan_deferred_notify_t fnc, void *value)
+{
+  if (!ctx)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  ctx->deferred_notify_fnc = fnc;
+  ctx->deferred_notify_value = value;
+  return 0;
+}
+
+
+/* Mark the command currently processed by CTX as deferred and store
+   a handle for finishing it at R_DEF.  This may only be called from a
+   command handler run by assuan_process_next.  The handler then
+   returns 0 and passes the handle to another thread, which finishes
+   the command with assuan_deferred_done.  Until then, no further
+   commands are read.  */
+gpg_error_t
+assuan_defer (assuan_context_t ctx, assuan_deferred_t *r_def)
+{
+  assuan_deferred_t def;
+
+  if (!r_def)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  *r_def = NULL;
+  if (!ctx)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  if (!ctx->in_process_next || !ctx->in_command || ctx->in_inquire
+      || ctx->deferred)
+    return _assuan_error (ctx, GPG_ERR_ASS_GENERAL);
+
+  def = _assuan_malloc (ctx, sizeof *def);
+  if (!def)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  memset (def, 0, sizeof *def);
+  if (gpgrt_lock_init (&def->lock))
+    {
+      _assuan_free (ctx, def);
+      return _assuan_error (ctx, GPG_ERR_INTERNAL);
+    }
+  def->malloc_hooks = ctx->malloc_hooks;
+  def->ctx = ctx;
+  def->notify_fnc = ctx->deferred_notify_fnc;
+  def->notify_value = ctx->deferred_notify_value;
+  def->ops_tail = &def->ops;
+
+  TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_defer", ctx, "def=%p", def);
+
+  ctx->deferred = def;
+  *r_def = def;
+  return 0;
+}
+
+
+/* Queue a status line with KEYWORD and TEXT for the deferred command
+   DEF.  May be called from any thread.  */
+gpg_error_t
+assuan_deferred_status (assuan_deferred_t def,
+                        const char *keyword, const char *text)
+{
+  struct deferred_op_s *op;
+  size_t n;
+
+  if (!def || !keyword)
+    return _assuan_error (NULL, GPG_ERR_ASS_INV_VALUE);
+  if (!text)
+    text = "";
+
+  n = strlen (keyword) + 1;
+  op = new_op (def, DEFERRED_STATUS, n + strlen (text) + 1);
+  if (!op)
+    return _assuan_error (NULL, gpg_err_code_from_syserror ());
+  strcpy (op->buf, keyword);
+  strcpy (op->buf + n, text);
+  return queue_op (def, op);
+}
+
+
+/* Queue LENGTH bytes of data from BUFFER for the deferred command
+   DEF.  May be called from any thread.  */
+gpg_error_t
+assuan_deferred_data (assuan_deferred_t def,
+                      const void *buffer, size_t length)
+{
+  struct deferred_op_s *op;
+
+  if (!def || (!buffer && length))
+    return _assuan_error (NULL, GPG_ERR_ASS_INV_VALUE);
+  if (!length)
+    return 0;
+
+  op = new_op (def, DEFERRED_DATA, length);
+  if (!op)
+    return _assuan_error (NULL, gpg_err_code_from_syserror ());
+  memcpy (op->buf, buffer, length);
+  return queue_op (def, op);
+}
+
+
+/* Finish the deferred command DEF with the result RC.  May be called
+   from any thread.  DEF must not be used after this call.  */
+void
+assuan_deferred_done (assuan_deferred_t def, gpg_error_t rc)
+{
+  if (!def)
+    return;
+
+  gpgrt_lock_lock (&def->lock);
+  if (!def->ctx)
+    {
+      /* The context has been released in the meantime.  */
+      gpgrt_lock_unlock (&def->lock);
+      release_deferred (def);
+      return;
+    }
+  def->done = 1;
+  def->rc = rc;
+  if (!def->ops && def->notify_fnc)
+    def->notify_fnc (def->notify_value, def->ctx);
+  gpgrt_lock_unlock (&def->lock);
+}
+
+
+/* Write out the status lines and data queued for the deferred
+   command of CTX.  If the command has been finished, it is completed
+   with assuan_process_done and the commands already received in the
+   meantime are processed as by assuan_process_next, which also sets
+   DONE.  Must be called by the thread running the event loop of
+   CTX.  */
+gpg_error_t
+assuan_run_deferred (assuan_context_t ctx, int *done)
+{
+  gpg_error_t err = 0;
+  assuan_deferred_t def;
+  struct deferred_op_s *ops, *op;
+  int finished;
+  gpg_error_t rc;
+
+  if (done)
+    *done = 0;
+  if (!ctx)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  def = ctx->deferred;
+  if (!def)
+    return 0;
+
+  gpgrt_lock_lock (&def->lock);
+  ops = def->ops;
+  def->ops = NULL;
+  def->ops_tail = &def->ops;
+  finished = def->done;
+  rc = def->rc;
+  gpgrt_lock_unlock (&def->lock);
+
+  for (op = ops; op && !err; op = op->next)
+    {
+      if (op->type == DEFERRED_STATUS)
+        err = assuan_write_status (ctx, op->buf,
+                                   op->buf + strlen (op->buf) + 1);
+      else
+        err = assuan_send_data (ctx, op->buf, op->len);
+    }
+  free_ops (def, ops);
+
+  if (!finished)
+    {
+      if (err)
+        {
+          /* Let the worker know that its output goes nowhere.  */
+          gpgrt_lock_lock (&def->lock);
+          def->error = err;
+          gpgrt_lock_unlock (&def->lock);
+        }
+      return 0;
+    }
+
+  TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_run_deferred", ctx,
+          "def=%p done", def);
+
+  ctx->deferred = NULL;
+  release_deferred (def);
+  if (!rc)
+    rc = err;
+  err = assuan_process_done (ctx, rc);
+  if (!err && !ctx->process_complete && assuan_pending_line (ctx))
+    err = assuan_process_next (ctx, done);
+  else if (done)
+    *done = !!ctx->process_complete;
+  return err;
+}
+
+
+/* Return true if a command of CTX has been deferred and not yet
+   completed by assuan_run_deferred.  The event loop should not wait
+   for input of CTX during that time because assuan_process_next
+   would not read it.  */
+int
+assuan_is_deferred (assuan_context_t ctx)
+{
+  return ctx && ctx->deferred;
+}
+
+
+/* Let go of the deferred command of CTX because the connection has
+   ended.  */
+void
+_assuan_deferred_release (assuan_context_t ctx)
+{
+  assuan_deferred_t def = ctx->deferred;
+  int finished;
+
+  if (!def)
+    return;
+  ctx->deferred = NULL;
+
+  gpgrt_lock_lock (&def->lock);
+  def->ctx = NULL;
+  finished = def->done;
+  gpgrt_lock_unlock (&def->lock);
+  if (finished)
+    release_deferred (def);
+}
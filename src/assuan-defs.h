@@ -54,12 +54,19 @@
 
 #define LINELENGTH ASSUAN_LINELENGTH
 
+/* The number of spare inquiry buffers kept by a context.  */
+#define INQUIRE_POOL_SIZE 4
+
+
+/* A latency histogram as maintained by assuan-stats.c.  */
+struct _assuan_histogram;
 
 struct cmdtbl_s
 {
   const char *name;
   assuan_handler_t handler;
   const char *helpstr;
+  struct _assuan_histogram *hist;  /* Allocated on first use.  */
 };
 
 
@@ -95,6 +102,7 @@ struct assuan_context_s
     unsigned int convey_comments : 1;
     unsigned int no_logging : 1;
     unsigned int force_close : 1;
+    unsigned int command_timing : 1;
   } flags;
 
   /* If set, this is called right before logging an I/O line.  */
@@ -104,7 +112,25 @@ struct assuan_context_s
   /* Callback handlers replacing system I/O functions.  */
   struct assuan_system_hooks system;
 
+  /* Counters for assuan_get_stats.  Use _assuan_stats_add to update
+     them so that the process wide totals are maintained as well.  */
+  struct assuan_stats stats;
+
+  /* State for ASSUAN_COMMAND_TIMING.  The timestamps are in
+     microseconds and taken when the command line was read, when the
+     handler was called and when it returned.  T_DISPATCH is 0 if no
+     command is being timed.  */
+  struct {
+    unsigned long long t_read;
+    unsigned long long t_dispatch;
+    unsigned long long t_done;
+    int cmdidx;               /* Index into CMDTBL.  */
+    size_t arglen;            /* Length of the command's arguments.  */
+    unsigned long long slow_threshold;  /* In microseconds; 0 = off.  */
+  } timing;
+
   int peercred_valid;   /* Whether this structure has valid information. */
+  int peercred_pending; /* Set if it can be fetched on demand.  */
   struct _assuan_peercred peercred;
 
   /* Now come the members specific to subsystems or engines.  FIXME:
@@ -119,6 +145,8 @@ struct assuan_context_s
     ssize_t (*writefnc) (assuan_context_t, const void *, size_t);
     /* Send a file descriptor.  */
     gpg_error_t (*sendfd) (assuan_context_t, assuan_fd_t);
+    /* Send several file descriptors at once; may be NULL.  */
+    gpg_error_t (*sendfds) (assuan_context_t, const assuan_fd_t *, int);
     /* Receive a file descriptor.  */
     gpg_error_t (*receivefd) (assuan_context_t, assuan_fd_t *);
   } engine;
@@ -145,6 +173,17 @@ struct assuan_context_s
   void *inquire_cb_data;
   void *inquire_membuf;
 
+  /* Buffers for inquired data (assuan-inquire.c).  LENT remembers the
+     size of the buffers recently handed out.  */
+  struct {
+    size_t size_hint;
+    struct {
+      void *buf;
+      size_t size;
+    } pool[INQUIRE_POOL_SIZE], lent[INQUIRE_POOL_SIZE];
+    unsigned int lent_next;
+  } inquire;
+
   char *hello_line;
   char *okay_line;    /* See assuan_set_okay_line() */
 
@@ -167,6 +206,9 @@ struct assuan_context_s
     assuan_fd_t fd;
     struct {
       FILE *fp;
+      struct assuan_data_writer_s {
+        assuan_context_t ctx;
+      } writer;  /* See assuan_get_data_writer.  */
       char line[LINELENGTH];
       int linelen;
       int error;
@@ -187,10 +229,54 @@ struct assuan_context_s
 
   /* Structure used for unix domain sockets.  */
   struct {
-    assuan_fd_t pendingfds[5]; /* Array to save received descriptors.  */
+    assuan_fd_t *pendingfds; /* Queue of received descriptors.  */
+    int pendingfdssize;   /* Allocated size of PENDINGFDS.  */
     int pendingfdscount;  /* Number of received descriptors. */
   } uds;
 
+  /* The connection object shared with the peer context if this is a
+     loopback connection (assuan-loopback.c).  */
+  struct assuan_loopback_s *loopback;
+
+  /* The shared memory rings if the TRANSPORT command has been used
+     (assuan-shm.c).  */
+  struct assuan_shm_s *shm;
+
+  /* The connection state if the context is driven by an io_uring
+     (assuan-uring.c).  */
+  struct uring_conn_s *uring;
+
+  /* The command of a server context which is finished by another
+     thread (assuan-defer.c).  */
+  struct assuan_deferred_s *deferred;
+  assuan_deferred_notify_t deferred_notify_fnc;
+  void *deferred_notify_value;
+
+  /* The pool this client context has been taken from
+     (assuan-pool.c).  */
+  struct assuan_pool_key_s *pool_key;
+
+  /* Data chunks of at least this size are passed as a memfd; 0 if
+     this has not been negotiated (assuan-shm.c).  */
+  size_t memfd_threshold;
+
+  /* The time (see _assuan_timestamp) after which waiting for a peer
+     fails with GPG_ERR_TIMEOUT; 0 for no deadline.  IO_TIMEOUT limits
+     each single wait to that many milliseconds; 0 for no limit.
+     IO_TIMED_OUT is set once a wait has expired; the state of the
+     connection is then unknown.  */
+  unsigned long long io_deadline;
+  unsigned int io_timeout;
+  int io_timed_out;
+
+  /* The state of an asynchronous connect or 0
+     (assuan-socket-connect.c).  */
+  int connect_state;
+
+  /* Set if the greeting of the server has not yet been read
+     (ASSUAN_SOCKET_CONNECT_DEFER_GREETING).  */
+  int greeting_pending;
+
   gpg_error_t (*accept_handler)(assuan_context_t);
   void (*finish_handler)(assuan_context_t);
 
@@ -271,6 +357,8 @@ int _assuan_socketpair (assuan_context_t ctx, int namespace, int style,
 int _assuan_socket (assuan_context_t ctx, int namespace, int style, int protocol);
 int _assuan_connect (assuan_context_t ctx, int sock, struct sockaddr *addr,
 		     socklen_t length);
+int _assuan_poll (assuan_context_t ctx, assuan_fd_t fd, int for_write,
+		  int timeout);
 
 extern struct assuan_system_hooks _assuan_system_hooks;
 
@@ -285,11 +373,29 @@ _assuan_system_hooks_copy (assuan_system_hooks_t dst,
 /*-- assuan-pipe-server.c --*/
 void _assuan_release_context (assuan_context_t ctx);
 
+/*-- assuan-socket-server.c --*/
+void _assuan_fetch_peercred (assuan_context_t ctx);
+gpg_error_t _assuan_new_accepted (assuan_context_t ctx, assuan_fd_t fd,
+                                  unsigned int flags,
+                                  assuan_context_t *r_ctx);
+
 /*-- assuan-uds.c --*/
 void _assuan_uds_close_fds (assuan_context_t ctx);
 void _assuan_uds_deinit (assuan_context_t ctx);
 void _assuan_init_uds_io (assuan_context_t ctx);
 
+/*-- assuan-shm.c --*/
+gpg_error_t _assuan_shm_accept (assuan_context_t ctx, const char *line);
+void _assuan_shm_commit (assuan_context_t ctx);
+void _assuan_shm_deinit (assuan_context_t ctx);
+int _assuan_memfd_line_p (const char *line, int linelen);
+gpg_error_t _assuan_memfd_send (assuan_context_t ctx,
+                                const void *buffer, size_t length);
+gpg_error_t _assuan_memfd_map (assuan_context_t ctx, const char *line,
+                               void **r_addr, size_t *r_length);
+void _assuan_memfd_unmap (void *addr, size_t length);
+gpg_error_t _assuan_memfd_accept (assuan_context_t ctx, const char *line);
+
 
 /*-- assuan-handler.c --*/
 gpg_error_t _assuan_register_std_commands (assuan_context_t ctx);
@@ -305,15 +411,62 @@ gpg_error_t _assuan_write_line (assuan_context_t ctx, const char *prefix,
 gpg_error_t _assuan_read_from_server (assuan_context_t ctx,
 				      assuan_response_t *okay, int *off,
                                       int convey_comments);
+gpg_error_t _assuan_read_greeting (assuan_context_t ctx, int wait);
+
+/*-- assuan-stats.c --*/
+extern struct assuan_stats _assuan_global_stats;
+
+unsigned long long _assuan_timestamp (void);
+void _assuan_timing_done (assuan_context_t ctx);
+void _assuan_timing_release (assuan_context_t ctx);
+
+/* Access to a global counter at P.  The global counters may be
+   updated from several threads; on GCC we use relaxed atomics which
+   are as cheap as plain loads and stores on the common platforms.
+   All accesses to them need to use these macros.  */
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)
+# define _assuan_counter_add(p,n)                                       \
+  ((void)__atomic_fetch_add ((p), (unsigned long long)(n), __ATOMIC_RELAXED))
+# define _assuan_counter_load(p)  __atomic_load_n ((p), __ATOMIC_RELAXED)
+# define _assuan_counter_clear(p)                                       \
+  __atomic_store_n ((p), 0, __ATOMIC_RELAXED)
+#elif __GNUC__ >= 4
+# define _assuan_counter_add(p,n)                                       \
+  ((void)__sync_fetch_and_add ((p), (unsigned long long)(n)))
+# define _assuan_counter_load(p)  __sync_fetch_and_add ((p), 0)
+# define _assuan_counter_clear(p) ((void)__sync_fetch_and_and ((p), 0))
+#else
+# define _assuan_counter_add(p,n) ((void)(*(p) += (n)))
+# define _assuan_counter_load(p)  (*(p))
+# define _assuan_counter_clear(p) ((void)(*(p) = 0))
+#endif
+
+/* Add N to the counter FIELD of CTX and to the process wide total.  */
+#define _assuan_global_stats_add(field,n)                               \
+  _assuan_counter_add (&_assuan_global_stats.field, (n))
+#define _assuan_stats_add(ctx,field,n) do {                             \
+    (ctx)->stats.field += (n);                                          \
+    _assuan_global_stats_add (field, (n));                              \
+  } while (0)
 
 /*-- assuan-error.c --*/
 
 /*-- assuan-inquire.c --*/
 gpg_error_t _assuan_inquire_ext_cb (assuan_context_t ctx);
 void _assuan_inquire_release (assuan_context_t ctx);
+void _assuan_inquire_pool_release (assuan_context_t ctx);
+
+/*-- assuan-pool.c --*/
+void _assuan_pool_forget (assuan_context_t ctx);
+
+/*-- assuan-defer.c --*/
+void _assuan_deferred_release (assuan_context_t ctx);
+
+/*-- assuan-uring.c --*/
+int _assuan_uring_output_full (assuan_context_t ctx);
 
-/* Check if ERR means EAGAIN.  */
-int _assuan_error_is_eagain (assuan_context_t ctx, gpg_error_t err);
+/* Check if *ERR means EAGAIN and wait for more input.  */
+int _assuan_error_is_eagain (assuan_context_t ctx, gpg_error_t *err);
 
 
 
@@ -337,6 +490,10 @@ void _assuan_log_control_channel (assuan_context_t ctx, int outbound,
 ssize_t _assuan_simple_read (assuan_context_t ctx, void *buffer, size_t size);
 ssize_t _assuan_simple_write (assuan_context_t ctx, const void *buffer,
 			      size_t size);
+unsigned long long _assuan_io_deadline (assuan_context_t ctx);
+gpg_error_t _assuan_wait_fd (assuan_context_t ctx, assuan_fd_t fd,
+			     int for_write);
+int _assuan_wait_peer (assuan_context_t ctx, int for_write);
 
 /*-- assuan-socket.c --*/
 
@@ -344,6 +501,9 @@ assuan_fd_t _assuan_sock_new (assuan_context_t ctx, int domain, int type,
 			      int proto);
 int _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
                           struct sockaddr *addr, int addrlen);
+int _assuan_sock_connect_nonblock (assuan_context_t ctx, assuan_fd_t sockfd,
+                                   struct sockaddr *addr, int addrlen);
+int _assuan_sock_connect_result (assuan_context_t ctx, assuan_fd_t sockfd);
 int _assuan_sock_bind (assuan_context_t ctx, assuan_fd_t sockfd,
 		       struct sockaddr *addr, int addrlen);
 int _assuan_sock_set_sockaddr_un (const char *fname, struct sockaddr *addr,
@@ -31,21 +31,21 @@
 
 
 /* A small helper function to treat EAGAIN transparently to the
-   caller.  */
+   caller.  If *ERR is EAGAIN, wait until the inbound descriptor of
+   CTX becomes readable and return true to ask the caller to try
+   again.  If the I/O deadline passes, *ERR is changed to
+   GPG_ERR_TIMEOUT and false is returned.  */
 int
-_assuan_error_is_eagain (assuan_context_t ctx, gpg_error_t err)
+_assuan_error_is_eagain (assuan_context_t ctx, gpg_error_t *err)
 {
-  if (gpg_err_code (err) == GPG_ERR_EAGAIN)
-    {
-      /* Avoid spinning by sleeping for one tenth of a second.  */
-      _assuan_usleep (ctx, 100000);
-      return 1;
-    }
-  else
+  if (gpg_err_code (*err) != GPG_ERR_EAGAIN)
     return 0;
+
+  *err = _assuan_wait_fd (ctx, ctx->inbound.fd, 0);
+  return !*err;
 }
 
-
+
 
 #ifdef HAVE_W32_SYSTEM
 char *
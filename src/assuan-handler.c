@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <errno.h>
 
 #include "assuan-defs.h"
@@ -375,6 +376,27 @@ std_handler_output (assuan_context_t ctx, char *line)
 }
 
 
+static const char std_help_transport[] =
+  "TRANSPORT shm\n"
+  "TRANSPORT memfd [<THRESHOLD>]\n"
+  "\n"
+  "Used by a client to move the connection to a pair of ring buffers\n"
+  "in shared memory.  The memfd with the rings must have been sent\n"
+  "using assuan_sendfd.  After the OK response all lines are exchanged\n"
+  "via the rings.\n"
+  "\n"
+  "The second form tells the server that from now on both sides may\n"
+  "pass data chunks of at least <THRESHOLD> bytes as a sealed memfd\n"
+  "announced by a \"MEMFD <LENGTH>\" line instead of D lines.";
+static gpg_error_t
+std_handler_transport (assuan_context_t ctx, char *line)
+{
+  if (!strncmp (line, "memfd", 5) && (!line[5] || spacep (line + 5)))
+    return PROCESS_DONE (ctx, _assuan_memfd_accept (ctx, line + 5));
+  return PROCESS_DONE (ctx, _assuan_shm_accept (ctx, line));
+}
+
+
 /* This is a table with the standard commands and handler for them.
    The table is used to initialize a new context and associate strings
    with default handlers */
@@ -395,6 +417,7 @@ static struct {
 
   { "INPUT",  std_handler_input, std_help_input, 0 },
   { "OUTPUT", std_handler_output, std_help_output, 0 },
+  { "TRANSPORT", std_handler_transport, std_help_transport, 0 },
   { } };
 
 
@@ -453,9 +476,10 @@ assuan_register_command (assuan_context_t ctx, const char *cmd_name,
     {
       struct cmdtbl_s *x;
 
-      x = _assuan_realloc (ctx, ctx->cmdtbl, (ctx->cmdtbl_size+10) * sizeof *x);
+      x = _assuan_realloc (ctx, ctx->cmdtbl, (ctx->cmdtbl_size+50) * sizeof *x);
       if (!x)
 	return _assuan_error (ctx, gpg_err_code_from_syserror ());
+      memset (x + ctx->cmdtbl_size, 0, 50 * sizeof *x);
       ctx->cmdtbl = x;
       ctx->cmdtbl_size += 50;
     }
@@ -671,6 +695,15 @@ dispatch_command (assuan_context_t ctx, char *line, int linelen)
   }
 
 /*    fprintf (stderr, "DBG-assuan: processing %s `%s'\n", s, line); */
+  _assuan_stats_add (ctx, commands, 1);
+  if (ctx->flags.command_timing)
+    {
+      ctx->timing.cmdidx = i;
+      ctx->timing.arglen = linelen - shift;
+      ctx->timing.t_dispatch = _assuan_timestamp ();
+      if (!ctx->timing.t_read)
+        ctx->timing.t_read = ctx->timing.t_dispatch;
+    }
   ctx->current_cmd_name = ctx->cmdtbl[i].name;
   err = ctx->cmdtbl[i].handler (ctx, line);
   ctx->current_cmd_name = NULL;
@@ -685,6 +718,9 @@ assuan_process_done (assuan_context_t ctx, gpg_error_t rc)
   if (!ctx->in_command)
     return _assuan_error (ctx, GPG_ERR_ASS_GENERAL);
 
+  if (ctx->timing.t_dispatch)
+    ctx->timing.t_done = _assuan_timestamp ();
+
   if (ctx->flags.force_close)
     ctx->process_complete = 1;
 
@@ -718,7 +754,11 @@ assuan_process_done (assuan_context_t ctx, gpg_error_t rc)
 	  ctx->finish_handler (ctx);
 	}
       else
-	rc = assuan_write_line (ctx, ctx->okay_line ? ctx->okay_line : "OK");
+	{
+	  rc = assuan_write_line (ctx, ctx->okay_line ? ctx->okay_line : "OK");
+	  if (!rc)
+	    _assuan_shm_commit (ctx);
+	}
     }
   else
     {
@@ -729,6 +769,7 @@ assuan_process_done (assuan_context_t ctx, gpg_error_t rc)
       if (ctx->flags.force_close)
         text = "[closing connection]";
 
+      _assuan_stats_add (ctx, errors, 1);
       gpg_strerror_r (rc, ebuf, sizeof (ebuf));
       snprintf (errline, sizeof errline, "ERR %d %.50s <%.30s>%s%.100s",
                 rc, ebuf, gpg_strsource (rc),
@@ -740,6 +781,9 @@ assuan_process_done (assuan_context_t ctx, gpg_error_t rc)
         ctx->finish_handler (ctx);
     }
 
+  if (ctx->timing.t_dispatch)
+    _assuan_timing_done (ctx);
+
   if (ctx->post_cmd_notify_fnc)
     ctx->post_cmd_notify_fnc (ctx, rc);
 
@@ -759,12 +803,19 @@ process_next (assuan_context_t ctx)
 {
   gpg_error_t rc;
 
+  /* While a deferred command runs, further commands are left in the
+     input buffers.  */
+  if (ctx->deferred)
+    return 0;
+
   /* What the next thing to do is depends on the current state.
      However, we will always first read the next line.  The client is
      required to write full lines without blocking long after starting
      a partial line.  */
   rc = _assuan_read_line (ctx);
-  if (_assuan_error_is_eagain (ctx, rc))
+  if (gpg_err_code (rc) == GPG_ERR_EAGAIN)
+    /* The caller waits for more input in its event loop; there is no
+       need to sleep here.  */
     return 0;
   if (gpg_err_code (rc) == GPG_ERR_EOF)
     {
@@ -785,6 +836,8 @@ process_next (assuan_context_t ctx)
 
   if (!ctx->in_command)
     {
+      if (ctx->flags.command_timing)
+        ctx->timing.t_read = _assuan_timestamp ();
       ctx->in_command = 1;
 
       ctx->outbound.data.error = 0;
@@ -831,7 +884,9 @@ assuan_process_next (assuan_context_t ctx, int *done)
     {
       rc = process_next (ctx);
     }
-  while (!rc && !ctx->process_complete && assuan_pending_line (ctx));
+  while (!rc && !ctx->process_complete && !ctx->deferred
+         && assuan_pending_line (ctx)
+         && !(ctx->uring && _assuan_uring_output_full (ctx)));
 
   if (done)
     *done = !!ctx->process_complete;
@@ -853,7 +908,7 @@ process_request (assuan_context_t ctx)
     {
       rc = _assuan_read_line (ctx);
     }
-  while (_assuan_error_is_eagain (ctx, rc));
+  while (_assuan_error_is_eagain (ctx, &rc));
   if (gpg_err_code (rc) == GPG_ERR_EOF)
     {
       ctx->process_complete = 1;
@@ -864,6 +919,8 @@ process_request (assuan_context_t ctx)
   if (*ctx->inbound.line == '#' || !ctx->inbound.linelen)
     return 0; /* comment line - ignore */
 
+  if (ctx->flags.command_timing)
+    ctx->timing.t_read = _assuan_timestamp ();
   ctx->in_command = 1;
   ctx->outbound.data.error = 0;
   ctx->outbound.data.linelen = 0;
@@ -947,43 +1004,141 @@ assuan_get_active_fds (assuan_context_t ctx, int what,
 }
 
 
-/* Two simple wrappers to make the expected function types match. */
+/* Return the data writer of CTX.  The writer puts the data straight
+   into the buffer for the current data line.  The data is flushed at
+   the end of a command handler, so a flush is only needed to send the
+   data out earlier.  Don't mix the writer with the FILE returned by
+   assuan_get_data_fp, which does its own buffering.  */
+assuan_data_writer_t
+assuan_get_data_writer (assuan_context_t ctx)
+{
+  if (!ctx)
+    {
+      gpg_err_set_errno (EINVAL);
+      return NULL;
+    }
+  ctx->outbound.data.writer.ctx = ctx;
+  return &ctx->outbound.data.writer;
+}
+
+
+/* Send LENGTH bytes from BUFFER as data lines using WRITER.  */
+gpg_error_t
+assuan_data_write (assuan_data_writer_t writer,
+                   const void *buffer, size_t length)
+{
+  if (!writer || (!buffer && length))
+    return _assuan_error (NULL, GPG_ERR_ASS_INV_VALUE);
+  if (!length)
+    return writer->ctx->outbound.data.error;
+  return assuan_send_data (writer->ctx, buffer, length);
+}
+
+
+/* Send the string described by FORMAT as data lines using WRITER.  */
+gpg_error_t
+assuan_data_printf (assuan_data_writer_t writer, const char *format, ...)
+{
+  gpg_error_t err;
+  va_list arg_ptr;
+  char buf[256];
+  char *p = buf;
+  int n;
+
+  if (!writer || !format)
+    return _assuan_error (NULL, GPG_ERR_ASS_INV_VALUE);
+
+  /* Most strings fit into BUF; only longer ones are allocated.  */
+  va_start (arg_ptr, format);
+  n = vsnprintf (buf, sizeof buf, format, arg_ptr);
+  va_end (arg_ptr);
+  if (n < 0 || (size_t)n >= sizeof buf)
+    {
+      va_start (arg_ptr, format);
+      n = gpgrt_vasprintf (&p, format, arg_ptr);
+      va_end (arg_ptr);
+      if (n < 0)
+        return _assuan_error (writer->ctx, gpg_err_code_from_syserror ());
+    }
+
+  err = assuan_data_write (writer, p, n);
+  if (p != buf)
+    {
+      if (writer->ctx->flags.confidential)
+        wipememory (p, n);
+      free (p);
+    }
+  else if (writer->ctx->flags.confidential)
+    wipememory (buf, n);
+  return err;
+}
+
+
+/* Send the data line being filled by WRITER.  This does not send an
+   END.  */
+gpg_error_t
+assuan_data_flush (assuan_data_writer_t writer)
+{
+  if (!writer)
+    return _assuan_error (NULL, GPG_ERR_ASS_INV_VALUE);
+  _assuan_cookie_write_flush (writer->ctx);
+  return writer->ctx->outbound.data.error;
+}
+
+
+/* Wrappers to use the data writer of a context with GNU's custom
+   streams.  */
 #ifdef HAVE_FUNOPEN
 static int
 fun1_cookie_write (void *cookie, const char *buffer, int orig_size)
 {
-  return _assuan_cookie_write_data (cookie, buffer, orig_size);
+  if (assuan_data_write (cookie, buffer, orig_size))
+    return 0;
+  return orig_size;
 }
 #endif /*HAVE_FUNOPEN*/
 #ifdef HAVE_FOPENCOOKIE
 static ssize_t
 fun2_cookie_write (void *cookie, const char *buffer, size_t orig_size)
 {
-  return _assuan_cookie_write_data (cookie, buffer, orig_size);
+  if (assuan_data_write (cookie, buffer, orig_size))
+    return 0;
+  return orig_size;
 }
 #endif /*HAVE_FOPENCOOKIE*/
+#if defined (HAVE_FOPENCOOKIE) || defined (HAVE_FUNOPEN)
+static int
+cookie_flush (void *cookie)
+{
+  assuan_data_flush (cookie);
+  return 0;
+}
+#endif
 
 /* Return a FP to be used for data output.  The FILE pointer is valid
    until the end of a handler.  So a close is not needed.  Assuan does
    all the buffering needed to insert the status line as well as the
    required line wappping and quoting for data lines.
 
-   We use GNU's custom streams here.  There should be an alternative
-   implementaion for systems w/o a glibc, a simple implementation
-   could use a child process */
+   This is a wrapper around the data writer of CTX using GNU's custom
+   streams.  Use assuan_get_data_writer instead to avoid the overhead
+   of a FILE.  */
 FILE *
 assuan_get_data_fp (assuan_context_t ctx)
 {
 #if defined (HAVE_FOPENCOOKIE) || defined (HAVE_FUNOPEN)
+  assuan_data_writer_t writer;
+
   if (ctx->outbound.data.fp)
     return ctx->outbound.data.fp;
 
+  writer = assuan_get_data_writer (ctx);
 #ifdef HAVE_FUNOPEN
-  ctx->outbound.data.fp = funopen (ctx, 0, fun1_cookie_write,
-				   0, _assuan_cookie_write_flush);
+  ctx->outbound.data.fp = funopen (writer, 0, fun1_cookie_write,
+				   0, cookie_flush);
 #else
-  ctx->outbound.data.fp = funopen (ctx, 0, fun2_cookie_write,
-				   0, _assuan_cookie_write_flush);
+  ctx->outbound.data.fp = funopen (writer, 0, fun2_cookie_write,
+				   0, cookie_flush);
 #endif
 
   ctx->outbound.data.error = 0;
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 #include "assuan-defs.h"
 
@@ -43,27 +44,94 @@ struct membuf
   size_t maxlen;
 };
 
-
 
+/* Buffers given back with assuan_inquire_free are kept in a small
+   pool of the context for the next inquiries.  Larger buffers are
+   freed.  */
+#define INQUIRE_POOL_MAXBUF (1024 * 1024)
+
+
+/* Take the smallest buffer of at least MINSIZE bytes from the pool
+   of CTX, or the largest one if all are smaller.  Stores the size of
+   the buffer at R_SIZE.  Returns NULL if the pool is empty.  */
+static char *
+pool_get (assuan_context_t ctx, size_t minsize, size_t *r_size)
+{
+  int i, best = -1;
+  char *buf;
+
+  for (i = 0; i < INQUIRE_POOL_SIZE; i++)
+    {
+      if (!ctx->inquire.pool[i].buf)
+        continue;
+      if (best == -1)
+        best = i;
+      else if (ctx->inquire.pool[best].size < minsize
+               ? ctx->inquire.pool[i].size > ctx->inquire.pool[best].size
+               : (ctx->inquire.pool[i].size >= minsize
+                  && ctx->inquire.pool[i].size < ctx->inquire.pool[best].size))
+        best = i;
+    }
+  if (best == -1)
+    return NULL;
+  buf = ctx->inquire.pool[best].buf;
+  *r_size = ctx->inquire.pool[best].size;
+  ctx->inquire.pool[best].buf = NULL;
+  return buf;
+}
+
+
+/* Wipe the buffer BUF of SIZE bytes and put it into the pool of CTX
+   or free it.  */
+static void
+pool_put (assuan_context_t ctx, char *buf, size_t size)
+{
+  int i;
+
+  wipememory (buf, size);
+  if (size <= INQUIRE_POOL_MAXBUF)
+    for (i = 0; i < INQUIRE_POOL_SIZE; i++)
+      if (!ctx->inquire.pool[i].buf)
+        {
+          ctx->inquire.pool[i].buf = buf;
+          ctx->inquire.pool[i].size = size;
+          return;
+        }
+  _assuan_free (ctx, buf);
+}
+
+
 /* A simple implementation of a dynamic buffer.  Use init_membuf() to
    create a buffer, put_membuf to append bytes and get_membuf to
    release and return the buffer.  Allocation errors are detected but
    only returned at the final get_membuf(), this helps not to clutter
-   the code with out of core checks.  */
+   the code with out of core checks.  The buffer starts with the size
+   hint of CTX and grows geometrically up to MAXLEN.  */
 
 static void
-init_membuf (assuan_context_t ctx,
-	     struct membuf *mb, int initiallen, size_t maxlen)
+init_membuf (assuan_context_t ctx, struct membuf *mb, size_t maxlen)
 {
+  size_t initiallen;
+
+  initiallen = ctx->inquire.size_hint? ctx->inquire.size_hint : 1024;
+  if (maxlen && initiallen > maxlen)
+    initiallen = maxlen;
+
   mb->len = 0;
-  mb->size = initiallen;
   mb->out_of_core = 0;
   mb->too_large = 0;
   mb->maxlen = maxlen;
   /* we need to allocate one byte more for get_membuf */
-  mb->buf = _assuan_malloc (ctx, initiallen + 1);
-  if (!mb->buf)
-      mb->out_of_core = 1;
+  mb->buf = pool_get (ctx, initiallen + 1, &mb->size);
+  if (mb->buf)
+    mb->size--;
+  else
+    {
+      mb->size = initiallen;
+      mb->buf = _assuan_malloc (ctx, initiallen + 1);
+      if (!mb->buf)
+        mb->out_of_core = 1;
+    }
 }
 
 static void
@@ -82,16 +150,21 @@ put_membuf (assuan_context_t ctx,
   if (mb->len + len >= mb->size)
     {
       char *p;
+      size_t newsize = mb->size * 2;
 
-      mb->size += len + 1024;
+      if (newsize < mb->len + len + 1024)
+        newsize = mb->len + len + 1024;
+      if (mb->maxlen && newsize > mb->maxlen)
+        newsize = mb->maxlen;
       /* we need to allocate one byte more for get_membuf */
-      p = _assuan_realloc (ctx, mb->buf, mb->size + 1);
+      p = _assuan_realloc (ctx, mb->buf, newsize + 1);
       if (!p)
         {
           mb->out_of_core = 1;
           return;
         }
       mb->buf = p;
+      mb->size = newsize;
     }
   memcpy (mb->buf + mb->len, buf, len);
   mb->len += len;
@@ -101,10 +174,12 @@ static void *
 get_membuf (assuan_context_t ctx, struct membuf *mb, size_t *len)
 {
   char *p;
+  int i;
 
   if (mb->out_of_core || mb->too_large)
     {
-      _assuan_free (ctx, mb->buf);
+      if (mb->buf)
+        pool_put (ctx, mb->buf, mb->size + 1);
       mb->buf = NULL;
       return NULL;
     }
@@ -112,6 +187,17 @@ get_membuf (assuan_context_t ctx, struct membuf *mb, size_t *len)
   mb->buf[mb->len] = 0; /* there is enough space for the hidden eos */
   p = mb->buf;
   *len = mb->len;
+
+  /* Remember the size in case the buffer is given back.  A buffer
+     freed by the caller with assuan_free may have been returned by
+     malloc again, so an older entry for it is stale.  */
+  for (i = 0; i < INQUIRE_POOL_SIZE; i++)
+    if (ctx->inquire.lent[i].buf == p)
+      ctx->inquire.lent[i].buf = NULL;
+  i = ctx->inquire.lent_next++ % INQUIRE_POOL_SIZE;
+  ctx->inquire.lent[i].buf = p;
+  ctx->inquire.lent[i].size = mb->size + 1;
+
   mb->buf = NULL;
   mb->out_of_core = 1; /* don't allow a reuse */
   return p;
@@ -120,11 +206,79 @@ get_membuf (assuan_context_t ctx, struct membuf *mb, size_t *len)
 static void
 free_membuf (assuan_context_t ctx, struct membuf *mb)
 {
-  _assuan_free (ctx, mb->buf);
+  if (mb->buf)
+    pool_put (ctx, mb->buf, mb->size + 1);
   mb->buf = NULL;
 }
 
 
+/* Give the buffer BUFFER returned by assuan_inquire or passed to the
+   callback of assuan_inquire_ext back to CTX.  The buffer is wiped
+   and kept for reuse.  */
+void
+assuan_inquire_free (assuan_context_t ctx, void *buffer)
+{
+  int i;
+
+  if (!ctx || !buffer)
+    return;
+
+  for (i = 0; i < INQUIRE_POOL_SIZE; i++)
+    if (ctx->inquire.lent[i].buf == buffer)
+      {
+        ctx->inquire.lent[i].buf = NULL;
+        pool_put (ctx, buffer, ctx->inquire.lent[i].size);
+        return;
+      }
+  /* Not one of our recent buffers; we don't know its size.  */
+  _assuan_free (ctx, buffer);
+}
+
+
+/* Let the inquiries of CTX start with a buffer of SIZE bytes; 0
+   selects the default.  */
+void
+assuan_set_inquire_size_hint (assuan_context_t ctx, size_t size)
+{
+  if (ctx)
+    ctx->inquire.size_hint = size;
+}
+
+
+/* Release the pooled buffers of CTX.  */
+void
+_assuan_inquire_pool_release (assuan_context_t ctx)
+{
+  int i;
+
+  for (i = 0; i < INQUIRE_POOL_SIZE; i++)
+    {
+      _assuan_free (ctx, ctx->inquire.pool[i].buf);
+      ctx->inquire.pool[i].buf = NULL;
+      ctx->inquire.lent[i].buf = NULL;
+    }
+}
+
+
+/* Append the data passed with the MEMFD line LINE to MB.  This is
+   the only copy of the data as the caller expects a malloced
+   buffer.  */
+static gpg_error_t
+put_memfd_data (assuan_context_t ctx, struct membuf *mb, const char *line)
+{
+  gpg_error_t rc;
+  void *addr;
+  size_t length;
+
+  rc = _assuan_memfd_map (ctx, line, &addr, &length);
+  if (rc)
+    return rc;
+  put_membuf (ctx, mb, addr, length);
+  _assuan_memfd_unmap (addr, length);
+  return 0;
+}
+
+
 /**
  * assuan_inquire:
  * @ctx: An assuan context
@@ -149,7 +303,7 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
   struct membuf mb;
   char cmdbuf[LINELENGTH-10]; /* (10 = strlen ("INQUIRE ")+CR,LF) */
   unsigned char *line, *p;
-  int linelen;
+  int linelen, datalen;
   int nodataexpected;
 
   if (r_buffer)
@@ -171,12 +325,13 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
   if (nodataexpected)
     memset (&mb, 0, sizeof mb); /* avoid compiler warnings */
   else
-    init_membuf (ctx, &mb, maxlen? maxlen:1024, maxlen);
+    init_membuf (ctx, &mb, maxlen);
 
   strcpy (stpcpy (cmdbuf, "INQUIRE "), keyword);
   rc = assuan_write_line (ctx, cmdbuf);
   if (rc)
     goto out;
+  _assuan_stats_add (ctx, inquiries, 1);
 
   for (;;)
     {
@@ -184,7 +339,7 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
         {
 	  do
 	    rc = _assuan_read_line (ctx);
-	  while (_assuan_error_is_eagain (ctx, rc));
+	  while (_assuan_error_is_eagain (ctx, &rc));
           if (rc)
             goto out;
           line = (unsigned char *) ctx->inbound.line;
@@ -206,6 +361,14 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
           rc = _assuan_error (ctx, GPG_ERR_ASS_CANCELED);
           goto out;
         }
+      if (ctx->memfd_threshold && !nodataexpected
+          && _assuan_memfd_line_p ((char *)line, linelen))
+        {
+          rc = put_memfd_data (ctx, &mb, (char *)line);
+          if (rc)
+            goto out;
+          continue;
+        }
       if ((line[0] != 'D' && line[0] != 'd')
           || line[1] != ' ' || nodataexpected)
         {
@@ -219,7 +382,9 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
 
       if (mb.too_large)
         continue; /* Need to read up the remaining data.  */
+      _assuan_stats_add (ctx, data_in_escaped, linelen);
 
+      datalen = linelen;
       p = line;
       while (linelen)
         {
@@ -233,10 +398,12 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
               *tmp = xtoi_2 (p);
               p += 2;
               linelen -= 3;
+              datalen -= 2;
               put_membuf (ctx, &mb, tmp, 1);
             }
           line = p;
         }
+      _assuan_stats_add (ctx, data_in, datalen);
     }
 
   if (!nodataexpected)
@@ -259,6 +426,256 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
 }
 
 
+/* Decode the escaped data of the D line LINE of length LINELEN in
+   place and return the length of the data.  */
+static size_t
+unescape_data_line (unsigned char *line, size_t linelen)
+{
+  unsigned char *s, *d;
+
+  for (s = d = line; linelen; linelen--)
+    {
+      if (*s == '%' && linelen > 2)
+        {
+          s++;
+          *d++ = xtoi_2 (s);
+          s += 2;
+          linelen -= 2;
+        }
+      else
+        *d++ = *s++;
+    }
+  return d - line;
+}
+
+
+/**
+ * assuan_inquire_stream:
+ * @ctx: An assuan context
+ * @keyword: The keyword used for the inquire
+ * @maxlen: If not 0, the size limit of the inquired data.
+ * @cb: A callback handler which is invoked for each chunk of data.
+ * @cb_value: A user-provided value passed to the callback handler.
+ *
+ * A server may use this to send an inquire and process the inquired
+ * data as it arrives instead of receiving it in one buffer.  @cb is
+ * called with the decoded data of each data line.  If it returns an
+ * error, the rest of the inquired data is read but not passed to @cb
+ * anymore, and the error is returned once the client has finished.
+ * The protocol does not allow the server to stop the client earlier.
+ *
+ * Return value: 0 on success or an ASSUAN error code
+ **/
+gpg_error_t
+assuan_inquire_stream (assuan_context_t ctx, const char *keyword,
+                       size_t maxlen, assuan_inquire_data_cb_t cb,
+                       void *cb_value)
+{
+  gpg_error_t rc;
+  gpg_error_t cbrc = 0;
+  char cmdbuf[LINELENGTH-10]; /* (10 = strlen ("INQUIRE ")+CR,LF) */
+  unsigned char *line;
+  int linelen;
+  size_t datalen;
+  size_t total = 0;
+  void *addr;
+
+  if (!ctx || !keyword || !cb || (10 + strlen (keyword) >= sizeof (cmdbuf)))
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  if (!ctx->is_server)
+    return _assuan_error (ctx, GPG_ERR_ASS_NOT_A_SERVER);
+  if (ctx->in_inquire)
+    return _assuan_error (ctx, GPG_ERR_ASS_NESTED_COMMANDS);
+
+  ctx->in_inquire = 1;
+
+  strcpy (stpcpy (cmdbuf, "INQUIRE "), keyword);
+  rc = assuan_write_line (ctx, cmdbuf);
+  if (rc)
+    goto out;
+  _assuan_stats_add (ctx, inquiries, 1);
+
+  for (;;)
+    {
+      do
+        {
+	  do
+	    rc = _assuan_read_line (ctx);
+	  while (_assuan_error_is_eagain (ctx, &rc));
+          if (rc)
+            goto out;
+          line = (unsigned char *) ctx->inbound.line;
+          linelen = ctx->inbound.linelen;
+        }
+      while (*line == '#' || !linelen);
+
+      if ((line[0] == 'E'||line[0] == 'e')
+          && (line[1] == 'N' || line[1] == 'n')
+          && (line[2] == 'D' || line[2] == 'd')
+          && (!line[3] || line[3] == ' '))
+        break; /* END command received*/
+      if ((line[0] == 'C' || line[0] == 'c')
+          && (line[1] == 'A' || line[1] == 'a')
+          && (line[2] == 'N' || line[2] == 'n'))
+        {
+          rc = _assuan_error (ctx, GPG_ERR_ASS_CANCELED);
+          goto out;
+        }
+      if (ctx->memfd_threshold
+          && _assuan_memfd_line_p ((char *)line, linelen))
+        {
+          rc = _assuan_memfd_map (ctx, (char *)line, &addr, &datalen);
+          if (rc)
+            goto out;
+          if (!cbrc && maxlen && total + datalen > maxlen)
+            cbrc = _assuan_error (ctx, GPG_ERR_ASS_TOO_MUCH_DATA);
+          if (!cbrc)
+            {
+              total += datalen;
+              cbrc = cb (cb_value, addr, datalen);
+            }
+          _assuan_memfd_unmap (addr, datalen);
+          continue;
+        }
+      if ((line[0] != 'D' && line[0] != 'd') || line[1] != ' ')
+        {
+          rc = _assuan_error (ctx, GPG_ERR_ASS_UNEXPECTED_CMD);
+          goto out;
+        }
+      if (linelen < 3)
+        continue;
+      line += 2;
+      linelen -= 2;
+
+      if (cbrc)
+        continue; /* Need to read up the remaining data.  */
+      _assuan_stats_add (ctx, data_in_escaped, linelen);
+
+      datalen = unescape_data_line (line, linelen);
+      _assuan_stats_add (ctx, data_in, datalen);
+      if (maxlen && total + datalen > maxlen)
+        {
+          cbrc = _assuan_error (ctx, GPG_ERR_ASS_TOO_MUCH_DATA);
+          continue;
+        }
+      total += datalen;
+      cbrc = cb (cb_value, line, datalen);
+    }
+  rc = cbrc;
+
+ out:
+  ctx->in_inquire = 0;
+  return rc;
+}
+
+
+/* The size of the buffer used by assuan_inquire_to_fd to collect the
+   decoded data for one write.  */
+#define INQUIRE_TO_FD_BUFSIZE 65536
+
+struct to_fd_parm_s
+{
+  assuan_context_t ctx;
+  assuan_fd_t fd;
+  unsigned char *buf;
+  size_t len;
+};
+
+
+/* Write all LENGTH bytes of BUFFER to FD.  */
+static gpg_error_t
+write_all (assuan_context_t ctx, assuan_fd_t fd,
+           const void *buffer, size_t length)
+{
+  const char *p = buffer;
+  gpg_error_t err;
+  ssize_t n;
+
+  while (length)
+    {
+      n = _assuan_write (ctx, fd, p, length);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+              err = _assuan_wait_fd (ctx, fd, 1);
+              if (err)
+                return err;
+              continue;
+            }
+          return _assuan_error (ctx, gpg_err_code_from_syserror ());
+        }
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+static gpg_error_t
+to_fd_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct to_fd_parm_s *parm = opaque;
+  gpg_error_t err;
+
+  if (parm->len + length > INQUIRE_TO_FD_BUFSIZE)
+    {
+      err = write_all (parm->ctx, parm->fd, parm->buf, parm->len);
+      parm->len = 0;
+      if (err)
+        return err;
+    }
+  if (length >= INQUIRE_TO_FD_BUFSIZE)
+    return write_all (parm->ctx, parm->fd, buffer, length);
+  memcpy (parm->buf + parm->len, buffer, length);
+  parm->len += length;
+  return 0;
+}
+
+
+/**
+ * assuan_inquire_to_fd:
+ * @ctx: An assuan context
+ * @keyword: The keyword used for the inquire
+ * @fd: The file descriptor to write the data to.
+ * @maxlen: If not 0, the size limit of the inquired data.
+ *
+ * A server may use this to send an inquire and write the inquired
+ * data to @fd.  The decoded data of many data lines is collected and
+ * written at once.  If writing fails, the rest of the inquired data is
+ * read and the error is returned.
+ *
+ * Return value: 0 on success or an ASSUAN error code
+ **/
+gpg_error_t
+assuan_inquire_to_fd (assuan_context_t ctx, const char *keyword,
+                      assuan_fd_t fd, size_t maxlen)
+{
+  gpg_error_t err;
+  struct to_fd_parm_s parm;
+
+  if (!ctx || fd == ASSUAN_INVALID_FD)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+
+  parm.ctx = ctx;
+  parm.fd = fd;
+  parm.len = 0;
+  parm.buf = _assuan_malloc (ctx, INQUIRE_TO_FD_BUFSIZE);
+  if (!parm.buf)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+
+  err = assuan_inquire_stream (ctx, keyword, maxlen, to_fd_cb, &parm);
+  if (!err && parm.len)
+    err = write_all (ctx, fd, parm.buf, parm.len);
+
+  wipememory (parm.buf, INQUIRE_TO_FD_BUFSIZE);
+  _assuan_free (ctx, parm.buf);
+  return err;
+}
+
+
 void
 _assuan_inquire_release (assuan_context_t ctx)
 {
@@ -279,7 +696,7 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
 {
   gpg_error_t rc;
   unsigned char *line;
-  int linelen;
+  int linelen, datalen;
   struct membuf *mb;
   unsigned char *p;
 
@@ -303,6 +720,20 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
       goto out;
     }
 
+  if (ctx->memfd_threshold && mb
+      && _assuan_memfd_line_p ((char *)line, linelen))
+    {
+      rc = put_memfd_data (ctx, mb, (char *)line);
+      if (rc)
+        goto out;
+      if (mb->too_large)
+        {
+          rc = _assuan_error (ctx, GPG_ERR_ASS_TOO_MUCH_DATA);
+          goto out;
+        }
+      return 0;
+    }
+
   if ((line[0] != 'D' && line[0] != 'd') || line[1] != ' ' || mb == NULL)
     {
       rc = _assuan_error (ctx, GPG_ERR_ASS_UNEXPECTED_CMD);
@@ -313,7 +744,9 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
     return 0;
   line += 2;
   linelen -= 2;
+  _assuan_stats_add (ctx, data_in_escaped, linelen);
 
+  datalen = linelen;
   p = line;
   while (linelen)
     {
@@ -327,10 +760,12 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
 	  *tmp = xtoi_2 (p);
 	  p += 2;
 	  linelen -= 3;
+	  datalen -= 2;
 	  put_membuf (ctx, mb, tmp, 1);
 	}
       line = p;
     }
+  _assuan_stats_add (ctx, data_in, datalen);
   if (mb->too_large)
     {
       rc = _assuan_error (ctx, GPG_ERR_ASS_TOO_MUCH_DATA);
@@ -392,7 +827,7 @@ assuan_inquire_ext (assuan_context_t ctx, const char *keyword, size_t maxlen,
   mb = malloc (sizeof (struct membuf));
   if (!mb)
     return _assuan_error (ctx, gpg_err_code_from_syserror ());
-  init_membuf (ctx, mb, maxlen ? maxlen : 1024, maxlen);
+  init_membuf (ctx, mb, maxlen);
 
   strcpy (stpcpy (cmdbuf, "INQUIRE "), keyword);
   rc = assuan_write_line (ctx, cmdbuf);
@@ -402,6 +837,7 @@ assuan_inquire_ext (assuan_context_t ctx, const char *keyword, size_t maxlen,
       free (mb);
       return rc;
     }
+  _assuan_stats_add (ctx, inquiries, 1);
 
   ctx->in_inquire = 1;
 
@@ -35,6 +35,10 @@
 # include <unistd.h>
 #endif
 #include <errno.h>
+#include <limits.h>
+#ifndef ETIMEDOUT
+# define ETIMEDOUT 138  /* As used by assuan-socket.c.  */
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -59,3 +63,123 @@ _assuan_simple_write (assuan_context_t ctx, const void *buffer, size_t size)
 {
   return _assuan_write (ctx, ctx->outbound.fd, buffer, size);
 }
+
+
+/* Return the time (see _assuan_timestamp) after which a wait for the
+   peer of CTX starting now expires, or 0 if there is no limit.  */
+unsigned long long
+_assuan_io_deadline (assuan_context_t ctx)
+{
+  unsigned long long deadline = ctx->io_deadline;
+  unsigned long long t;
+
+  if (ctx->io_timeout)
+    {
+      t = _assuan_timestamp () + (unsigned long long)ctx->io_timeout * 1000;
+      if (!deadline || t < deadline)
+        deadline = t;
+    }
+  return deadline;
+}
+
+
+/* Store the milliseconds left for a wait at R_TIMEOUT; -1 if there is
+   no limit.  Returns GPG_ERR_TIMEOUT if the limit has already been
+   reached.  */
+static gpg_error_t
+wait_timeout (assuan_context_t ctx, int *r_timeout)
+{
+  unsigned long long deadline, now, left;
+
+  *r_timeout = -1;
+  deadline = _assuan_io_deadline (ctx);
+  if (!deadline)
+    return 0;
+
+  now = _assuan_timestamp ();
+  if (now >= deadline)
+    {
+      ctx->io_timed_out = 1;
+      return _assuan_error (ctx, GPG_ERR_TIMEOUT);
+    }
+  left = (deadline - now + 999) / 1000;
+  *r_timeout = left > INT_MAX? INT_MAX : (int)left;
+  return 0;
+}
+
+
+/* Wait until FD is ready for reading or, if FOR_WRITE is set, for
+   writing after an operation on it returned EAGAIN.  Returns 0 if
+   the operation should be retried, GPG_ERR_TIMEOUT if the I/O
+   timeout or deadline of CTX has passed, or another error code.  */
+gpg_error_t
+_assuan_wait_fd (assuan_context_t ctx, assuan_fd_t fd, int for_write)
+{
+  gpg_error_t err;
+  int timeout;
+  int res;
+
+  err = wait_timeout (ctx, &timeout);
+  if (err)
+    return err;
+
+  if (fd != ASSUAN_INVALID_FD)
+    {
+      res = _assuan_poll (ctx, fd, for_write, timeout);
+      if (res > 0 || (res < 0 && errno == EINTR))
+        return 0;
+      if (!res)
+        {
+          ctx->io_timed_out = 1;
+          return _assuan_error (ctx, GPG_ERR_TIMEOUT);
+        }
+      if (errno != ENOSYS)
+        return _assuan_error (ctx, gpg_err_code_from_syserror ());
+    }
+
+  /* We can't wait for FD; avoid spinning by sleeping for one tenth
+     of a second but not beyond the deadline.  */
+  _assuan_usleep (ctx, timeout >= 0 && timeout < 100? timeout * 1000
+                  : 100000);
+  return 0;
+}
+
+
+/* Before a possibly blocking read from or write to the peer of CTX,
+   wait until this won't block if an I/O timeout or deadline is set.
+   Returns 0 or -1 with ERRNO set to ETIMEDOUT on expiry.  Nothing is
+   done for transports without a descriptor or if the system hooks
+   don't support waiting.  */
+int
+_assuan_wait_peer (assuan_context_t ctx, int for_write)
+{
+  assuan_fd_t fd = for_write? ctx->outbound.fd : ctx->inbound.fd;
+  gpg_error_t err;
+  int timeout;
+  int res;
+
+  if ((!ctx->io_timeout && !ctx->io_deadline)
+      || fd == ASSUAN_INVALID_FD || ctx->shm || ctx->uring)
+    return 0;
+
+  do
+    {
+      err = wait_timeout (ctx, &timeout);
+      if (err)
+        {
+          gpg_err_set_errno (ETIMEDOUT);
+          return -1;
+        }
+      res = _assuan_poll (ctx, fd, for_write, timeout);
+    }
+  while (res < 0 && errno == EINTR);
+
+  if (!res)
+    {
+      ctx->io_timed_out = 1;
+      gpg_err_set_errno (ETIMEDOUT);
+      return -1;
+    }
+  /* On error, let the actual I/O function report it.  */
+  return 0;
+}
@@ -95,7 +95,9 @@ assuan_accept (assuan_context_t ctx)
 	return rc;
     }
 
-  /* Send the hello. */
+  /* Send the hello.  A client may already have sent its first
+     command (ASSUAN_SOCKET_CONNECT_DEFER_GREETING); it is read after
+     the hello like any other command.  */
   p = ctx->hello_line;
   if (p && (pend = strchr (p, '\n')))
     { /* This is a multi line hello.  Send all but the last line as
@@ -0,0 +1,390 @@
+/* assuan-loopback.c - In-process connection of a client and a server
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "assuan-defs.h"
+#include "debug.h"
+
+
+/* A loopback connection consists of two byte queues, one for each
+   direction, which are shared by the client and the server context.
+   There are no threads involved: If the client needs to read and its
+   queue is empty, the server is run right away (or the user supplied
+   callback is called to do this) until it has written a response.  */
+
+struct loopback_queue_s
+{
+  char *buf;
+  size_t size;   /* Allocated size of BUF.  */
+  size_t start;  /* Offset of the first unread byte.  */
+  size_t end;    /* Offset after the last written byte.  */
+};
+
+struct assuan_loopback_s
+{
+  int refcount;
+
+  /* The contexts or NULL if they have been released.  */
+  assuan_context_t client;
+  assuan_context_t server;
+
+  /* Set if the server has finished the connection.  */
+  int server_finished;
+
+  struct loopback_queue_s to_server;
+  struct loopback_queue_s to_client;
+
+  /* The function to run the server, or NULL to use
+     assuan_process_next.  */
+  assuan_loopback_cb_t cb;
+  void *cb_value;
+
+  /* A copy of the allocation hooks so that the object can be released
+     by either context.  */
+  struct assuan_malloc_hooks malloc_hooks;
+};
+typedef struct assuan_loopback_s *loopback_t;
+
+
+static int
+queue_put (loopback_t lb, struct loopback_queue_s *q,
+           const void *buffer, size_t size)
+{
+  if (q->start == q->end)
+    q->start = q->end = 0;
+  if (q->end + size > q->size)
+    {
+      size_t n = q->end - q->start;
+      size_t newsize = q->size? q->size : 4096;
+      char *p;
+
+      while (n + size > newsize)
+        newsize *= 2;
+      if (newsize > q->size)
+        {
+          p = lb->malloc_hooks.realloc (q->buf, newsize);
+          if (!p)
+            return -1;
+          q->buf = p;
+          q->size = newsize;
+        }
+      if (q->start)
+        {
+          memmove (q->buf, q->buf + q->start, n);
+          q->start = 0;
+          q->end = n;
+        }
+    }
+  memcpy (q->buf + q->end, buffer, size);
+  q->end += size;
+  return 0;
+}
+
+
+static size_t
+queue_get (struct loopback_queue_s *q, void *buffer, size_t size)
+{
+  if (size > q->end - q->start)
+    size = q->end - q->start;
+  memcpy (buffer, q->buf + q->start, size);
+  q->start += size;
+  return size;
+}
+
+
+/* Drop the reference of CTX to its loopback object.  */
+static void
+loopback_detach (assuan_context_t ctx)
+{
+  loopback_t lb = ctx->loopback;
+
+  if (!lb)
+    return;
+  ctx->loopback = NULL;
+  if (lb->client == ctx)
+    lb->client = NULL;
+  if (lb->server == ctx)
+    lb->server = NULL;
+  if (--lb->refcount)
+    return;
+
+  /* The queues may contain sensitive data.  */
+  if (lb->to_server.buf)
+    wipememory (lb->to_server.buf, lb->to_server.size);
+  if (lb->to_client.buf)
+    wipememory (lb->to_client.buf, lb->to_client.size);
+  lb->malloc_hooks.free (lb->to_server.buf);
+  lb->malloc_hooks.free (lb->to_client.buf);
+  lb->malloc_hooks.free (lb);
+}
+
+
+/* Let the server process the pending input.  Returns 0 on success or
+   -1 with ERRNO set.  */
+static int
+run_server (loopback_t lb)
+{
+  gpg_error_t err;
+  size_t out_before, in_before;
+
+  if (lb->cb)
+    {
+      out_before = lb->to_client.end - lb->to_client.start;
+      in_before = lb->to_server.end - lb->to_server.start;
+      err = lb->cb (lb->cb_value, lb->server);
+      if (!err && lb->to_client.end - lb->to_client.start == out_before
+          && lb->to_server.end - lb->to_server.start == in_before
+          && lb->client && !lb->server_finished)
+        {
+          /* Neither input consumed nor output written.  Nobody else
+             can run the server, so waiting would not help; the
+             callback itself has to wait for whatever the server
+             waits for.  */
+          gpg_err_set_errno (EDEADLK);
+          return -1;
+        }
+    }
+  else if (lb->to_server.start == lb->to_server.end
+           && !assuan_pending_line (lb->server))
+    {
+      /* The server waits for something which won't happen because
+         we are the only ones who could run it.  */
+      gpg_err_set_errno (EDEADLK);
+      return -1;
+    }
+  else
+    err = assuan_process_next (lb->server, NULL);
+
+  if (err)
+    {
+      gpg_err_set_errno (gpg_err_code_to_errno (gpg_err_code (err)));
+      return -1;
+    }
+  return 0;
+}
+
+
+static ssize_t
+loopback_client_read (assuan_context_t ctx, void *buffer, size_t size)
+{
+  loopback_t lb = ctx->loopback;
+
+  while (lb->to_client.start == lb->to_client.end)
+    {
+      if (!lb->server || lb->server_finished)
+        return 0;  /* EOF */
+      if (run_server (lb))
+        return -1;
+    }
+  return queue_get (&lb->to_client, buffer, size);
+}
+
+
+static ssize_t
+loopback_client_write (assuan_context_t ctx, const void *buffer, size_t size)
+{
+  loopback_t lb = ctx->loopback;
+
+  if (!lb->server || lb->server_finished)
+    {
+      gpg_err_set_errno (EPIPE);
+      return -1;
+    }
+  if (queue_put (lb, &lb->to_server, buffer, size))
+    return -1;
+  return size;
+}
+
+
+static ssize_t
+loopback_server_read (assuan_context_t ctx, void *buffer, size_t size)
+{
+  loopback_t lb = ctx->loopback;
+
+  if (lb->to_server.start == lb->to_server.end)
+    {
+      if (!lb->client)
+        return 0;  /* EOF */
+
+      /* The client can only send more data after we return to it.
+         This happens for example with a blocking assuan_inquire.  */
+      gpg_err_set_errno (EDEADLK);
+      return -1;
+    }
+  return queue_get (&lb->to_server, buffer, size);
+}
+
+
+static ssize_t
+loopback_server_write (assuan_context_t ctx, const void *buffer, size_t size)
+{
+  loopback_t lb = ctx->loopback;
+
+  if (!lb->client)
+    {
+      gpg_err_set_errno (EPIPE);
+      return -1;
+    }
+  if (queue_put (lb, &lb->to_client, buffer, size))
+    return -1;
+  return size;
+}
+
+
+static void
+loopback_client_release (assuan_context_t ctx)
+{
+  _assuan_client_finish (ctx);
+  loopback_detach (ctx);
+}
+
+
+static void
+loopback_server_finish (assuan_context_t ctx)
+{
+  if (ctx->loopback)
+    ctx->loopback->server_finished = 1;
+  _assuan_server_finish (ctx);
+}
+
+
+static void
+loopback_server_release (assuan_context_t ctx)
+{
+  _assuan_server_release (ctx);
+  loopback_detach (ctx);
+}
+
+
+/* Connect the new context CLIENT directly to the new context SERVER.
+   This works like a socketpair but without any system calls.  The
+   server's commands need to be registered with SERVER before calling
+   this function; SERVER is then ready to process commands.  It must
+   not be used with assuan_accept or assuan_process.
+
+   Whenever CLIENT waits for a response, CB is called with CB_VALUE
+   and SERVER to run the server, usually by calling
+   assuan_process_next.  It is called again as long as the server
+   consumes input or writes output; if it does neither, the client
+   fails with EDEADLK.  If CB is NULL, assuan_process_next is called
+   directly; thus the command handlers need to finish with
+   assuan_process_done.  Because this all happens in the thread of
+   the client, a command handler may not wait for the client by
+   calling the blocking assuan_inquire; it fails with an error.  Use
+   assuan_inquire_ext instead.  */
+gpg_error_t
+assuan_loopback_connect (assuan_context_t client, assuan_context_t server,
+                         assuan_loopback_cb_t cb, void *cb_value)
+{
+  gpg_error_t err;
+  loopback_t lb;
+  assuan_response_t response;
+  int off;
+
+  TRACE2 (client, ASSUAN_LOG_CTX, "assuan_loopback_connect", client,
+	  "server=%p, cb=%p", server, cb);
+
+  if (!client || !server || client == server
+      || client->loopback || server->loopback)
+    return _assuan_error (client, GPG_ERR_ASS_INV_VALUE);
+
+  lb = _assuan_calloc (client, 1, sizeof *lb);
+  if (!lb)
+    return _assuan_error (client, gpg_err_code_from_syserror ());
+  lb->malloc_hooks = client->malloc_hooks;
+  lb->cb = cb;
+  lb->cb_value = cb_value;
+
+  /* Set up the server much like an accepted socket server.  */
+  err = _assuan_register_std_commands (server);
+  if (err)
+    {
+      _assuan_free (client, lb);
+      return err;
+    }
+  server->engine.release = loopback_server_release;
+  server->engine.readfnc = loopback_server_read;
+  server->engine.writefnc = loopback_server_write;
+  server->engine.sendfd = NULL;
+  server->engine.sendfds = NULL;
+  server->engine.receivefd = NULL;
+  server->is_server = 1;
+  server->max_accepts = 1;
+  server->input_fd = ASSUAN_INVALID_FD;
+  server->output_fd = ASSUAN_INVALID_FD;
+  server->inbound.fd = ASSUAN_INVALID_FD;
+  server->outbound.fd = ASSUAN_INVALID_FD;
+  server->listen_fd = ASSUAN_INVALID_FD;
+  server->connected_fd = ASSUAN_INVALID_FD;
+  server->accept_handler = NULL;
+  server->finish_handler = loopback_server_finish;
+  server->loopback = lb;
+  lb->server = server;
+  lb->refcount++;
+
+  /* The peer is our own process.  */
+#ifndef HAVE_W32_SYSTEM
+  server->pid = getpid ();
+  server->peercred.pid = server->pid;
+  server->peercred.uid = getuid ();
+  server->peercred.gid = getgid ();
+  server->peercred_valid = 1;
+#else
+  server->pid = ASSUAN_INVALID_PID;
+#endif
+
+  client->engine.release = loopback_client_release;
+  client->engine.readfnc = loopback_client_read;
+  client->engine.writefnc = loopback_client_write;
+  client->engine.sendfd = NULL;
+  client->engine.sendfds = NULL;
+  client->engine.receivefd = NULL;
+  client->finish_handler = _assuan_client_finish;
+  client->inbound.fd = ASSUAN_INVALID_FD;
+  client->outbound.fd = ASSUAN_INVALID_FD;
+  client->max_accepts = -1;
+  client->pid = ASSUAN_INVALID_PID;
+  client->loopback = lb;
+  lb->client = client;
+  lb->refcount++;
+
+  /* Let the server send its greeting and read it.  */
+  err = assuan_accept (server);
+  if (!err)
+    err = _assuan_read_from_server (client, &response, &off, 0);
+  if (!err && response != ASSUAN_RESPONSE_OK)
+    err = _assuan_error (client, GPG_ERR_ASS_CONNECT_FAILED);
+  if (err)
+    {
+      _assuan_reset (client);
+      _assuan_reset (server);
+    }
+
+  return err;
+}
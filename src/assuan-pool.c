@@ -0,0 +1,434 @@
+/* assuan-pool.c - A pool of client connections
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "assuan-defs.h"
+#include "debug.h"
+
+
+/* The pool keeps a list of keys, one for each socket name.  Each key
+   has a list of idle connections, the most recently used first so
+   that the connections at the end of the list are the ones to expire,
+   and a list of the connections handed out, so that they can be
+   detached when the pool is released before they are returned.  All
+   lists are protected by the lock of the pool.  Nothing which may
+   block is done while holding the lock.  */
+
+struct pool_conn_s
+{
+  struct pool_conn_s *next;
+  assuan_context_t ctx;
+  unsigned long long idle_since;  /* See _assuan_timestamp.  */
+};
+
+struct assuan_pool_key_s
+{
+  struct assuan_pool_key_s *next;
+  assuan_pool_t pool;
+  struct pool_conn_s *idle;
+  struct pool_conn_s *busy;
+  unsigned int nidle;
+  unsigned int nlive;  /* Idle and handed out connections.  */
+  char name[1];
+};
+typedef struct assuan_pool_key_s *pool_key_t;
+
+struct assuan_pool_s
+{
+  gpgrt_lock_t lock;
+  struct assuan_malloc_hooks malloc_hooks;
+  unsigned int flags;
+  unsigned int min_idle;
+  unsigned int max;
+  unsigned long long idle_timeout;  /* In microseconds.  */
+  pool_key_t keys;
+};
+
+
+/* Unlink the idle connections of KEY which are beyond MIN_IDLE and
+   have expired, and return them as a list.  Must be called with the
+   lock held.  */
+static struct pool_conn_s *
+expire_idle (pool_key_t key)
+{
+  assuan_pool_t pool = key->pool;
+  struct pool_conn_s **connp = &key->idle;
+  struct pool_conn_s *expired = NULL;
+  struct pool_conn_s *conn;
+  unsigned long long now;
+  unsigned int n = 0;
+
+  if (!pool->idle_timeout)
+    return NULL;
+  now = _assuan_timestamp ();
+  while ((conn = *connp))
+    {
+      if (++n > pool->min_idle
+          && now - conn->idle_since > pool->idle_timeout)
+        {
+          *connp = conn->next;
+          conn->next = expired;
+          expired = conn;
+          key->nidle--;
+          key->nlive--;
+        }
+      else
+        connp = &conn->next;
+    }
+  return expired;
+}
+
+
+/* Release the connections in the list CONN.  Must be called without
+   the lock held.  */
+static void
+release_conns (assuan_pool_t pool, struct pool_conn_s *conn)
+{
+  struct pool_conn_s *next;
+
+  for (; conn; conn = next)
+    {
+      next = conn->next;
+      conn->ctx->pool_key = NULL;
+      assuan_release (conn->ctx);
+      pool->malloc_hooks.free (conn);
+    }
+}
+
+
+/* Unlink the entry for the handed out context CTX from KEY and
+   return it.  Must be called with the lock held.  */
+static struct pool_conn_s *
+unlink_busy (pool_key_t key, assuan_context_t ctx)
+{
+  struct pool_conn_s **connp;
+  struct pool_conn_s *conn;
+
+  for (connp = &key->busy; (conn = *connp); connp = &conn->next)
+    if (conn->ctx == ctx)
+      {
+        *connp = conn->next;
+        return conn;
+      }
+  return NULL;
+}
+
+
+/* Put the settings of CTX which a user may have changed back to the
+   defaults of a new context, so that the next user of the pooled
+   connection does not inherit them.  */
+static void
+reset_settings (assuan_context_t ctx)
+{
+  ctx->user_pointer = NULL;
+  memset (&ctx->flags, 0, sizeof ctx->flags);
+  ctx->io_monitor = NULL;
+  ctx->io_monitor_data = NULL;
+  ctx->io_timeout = 0;
+  ctx->io_deadline = 0;
+  ctx->inquire.size_hint = 0;
+}
+
+
+/* Return true if the idle connection CTX has been closed by the
+   server.  An idle server does not send anything, so anything
+   readable is a problem.  */
+static int
+conn_is_broken (assuan_context_t ctx)
+{
+  if (ctx->inbound.fd == ASSUAN_INVALID_FD)
+    return 1;
+  return _assuan_poll (ctx, ctx->inbound.fd, 0, 0) > 0;
+}
+
+
+/* Create a new connection pool.  Contexts are connected with
+   assuan_socket_connect using FLAGS.  */
+gpg_error_t
+assuan_pool_new (assuan_pool_t *r_pool, unsigned int flags)
+{
+  assuan_pool_t pool;
+  assuan_malloc_hooks_t malloc_hooks = assuan_get_malloc_hooks ();
+
+  if (!r_pool)
+    return _assuan_error (NULL, GPG_ERR_INV_VALUE);
+  *r_pool = NULL;
+
+  pool = malloc_hooks->malloc (sizeof *pool);
+  if (!pool)
+    return _assuan_error (NULL, gpg_err_code_from_syserror ());
+  memset (pool, 0, sizeof *pool);
+  pool->malloc_hooks = *malloc_hooks;
+  pool->flags = flags;
+  if (gpgrt_lock_init (&pool->lock))
+    {
+      malloc_hooks->free (pool);
+      return _assuan_error (NULL, GPG_ERR_INTERNAL);
+    }
+
+  *r_pool = pool;
+  return 0;
+}
+
+
+/* Release POOL and its idle connections.  Contexts taken from POOL
+   and not yet returned are detached from it; they are closed when
+   they are returned or released.  */
+void
+assuan_pool_release (assuan_pool_t pool)
+{
+  pool_key_t key, next;
+  struct pool_conn_s *conn, *cnext;
+
+  if (!pool)
+    return;
+
+  for (key = pool->keys; key; key = next)
+    {
+      next = key->next;
+      for (conn = key->busy; conn; conn = cnext)
+        {
+          cnext = conn->next;
+          conn->ctx->pool_key = NULL;
+          pool->malloc_hooks.free (conn);
+        }
+      release_conns (pool, key->idle);
+      pool->malloc_hooks.free (key);
+    }
+  gpgrt_lock_destroy (&pool->lock);
+  pool->malloc_hooks.free (pool);
+}
+
+
+/* Set the limits of POOL.  At least MIN_IDLE idle connections are kept
+   for each socket name even if they are older than IDLE_TIMEOUT
+   seconds.  At most MAX connections to a socket name are open at any
+   time; 0 means no limit.  An IDLE_TIMEOUT of 0 keeps idle
+   connections until the pool is released.  */
+void
+assuan_pool_set_limits (assuan_pool_t pool, unsigned int min_idle,
+                        unsigned int max, unsigned int idle_timeout)
+{
+  if (!pool)
+    return;
+
+  gpgrt_lock_lock (&pool->lock);
+  pool->min_idle = min_idle;
+  pool->max = max;
+  pool->idle_timeout = (unsigned long long)idle_timeout * 1000000;
+  gpgrt_lock_unlock (&pool->lock);
+}
+
+
+/* Store a context connected to the socket server NAME at R_CTX.  An
+   idle connection is reused if available; otherwise a new one is
+   made.  If MAX connections to NAME are already in use,
+   GPG_ERR_LIMIT_REACHED is returned.  The context must be returned
+   with assuan_pool_put.  */
+gpg_error_t
+assuan_pool_get (assuan_pool_t pool, const char *name,
+                 assuan_context_t *r_ctx)
+{
+  gpg_error_t err;
+  pool_key_t key;
+  struct pool_conn_s *conn;
+  struct pool_conn_s *dead;
+  assuan_context_t ctx;
+
+  if (!r_ctx)
+    return _assuan_error (NULL, GPG_ERR_INV_VALUE);
+  *r_ctx = NULL;
+  if (!pool || !name)
+    return _assuan_error (NULL, GPG_ERR_INV_VALUE);
+
+  gpgrt_lock_lock (&pool->lock);
+  for (key = pool->keys; key; key = key->next)
+    if (!strcmp (key->name, name))
+      break;
+  if (!key)
+    {
+      key = pool->malloc_hooks.malloc (sizeof *key + strlen (name));
+      if (!key)
+        {
+          err = _assuan_error (NULL, gpg_err_code_from_syserror ());
+          gpgrt_lock_unlock (&pool->lock);
+          return err;
+        }
+      memset (key, 0, sizeof *key);
+      key->pool = pool;
+      strcpy (key->name, name);
+      key->next = pool->keys;
+      pool->keys = key;
+    }
+
+  /* Take the most recently used idle connection which still works
+     and has not expired.  */
+  dead = expire_idle (key);
+  ctx = NULL;
+  while (!ctx && (conn = key->idle))
+    {
+      key->idle = conn->next;
+      key->nidle--;
+      if (conn_is_broken (conn->ctx))
+        {
+          /* Like after a timeout, don't try to send a BYE.  */
+          conn->ctx->io_timed_out = 1;
+          key->nlive--;
+          conn->next = dead;
+          dead = conn;
+        }
+      else
+        {
+          ctx = conn->ctx;
+          conn->next = key->busy;
+          key->busy = conn;
+        }
+    }
+  if (!ctx)
+    {
+      if (pool->max && key->nlive >= pool->max)
+        {
+          gpgrt_lock_unlock (&pool->lock);
+          release_conns (pool, dead);
+          return _assuan_error (NULL, GPG_ERR_LIMIT_REACHED);
+        }
+      /* Reserve the slot for the new connection.  */
+      key->nlive++;
+    }
+  gpgrt_lock_unlock (&pool->lock);
+  release_conns (pool, dead);
+
+  if (!ctx)
+    {
+      conn = pool->malloc_hooks.malloc (sizeof *conn);
+      if (!conn)
+        err = _assuan_error (NULL, gpg_err_code_from_syserror ());
+      else
+        err = assuan_new (&ctx);
+      if (!err)
+        err = assuan_socket_connect (ctx, name, ASSUAN_INVALID_PID,
+                                     pool->flags);
+      if (err)
+        {
+          assuan_release (ctx);
+          if (conn)
+            pool->malloc_hooks.free (conn);
+          gpgrt_lock_lock (&pool->lock);
+          key->nlive--;
+          gpgrt_lock_unlock (&pool->lock);
+          return err;
+        }
+      ctx->pool_key = key;
+      conn->ctx = ctx;
+      gpgrt_lock_lock (&pool->lock);
+      conn->next = key->busy;
+      key->busy = conn;
+      gpgrt_lock_unlock (&pool->lock);
+    }
+
+  TRACE2 (ctx, ASSUAN_LOG_CTX, "assuan_pool_get", ctx,
+	  "pool=%p, name=%s", pool, name);
+  *r_ctx = ctx;
+  return 0;
+}
+
+
+/* Return CTX, which has been taken from a pool with assuan_pool_get,
+   to its pool.  The connection is reset with a RESET command.  If
+   DISCARD is true the connection is closed instead; use this if the
+   last transaction did not complete, for example because a callback
+   returned an error.  */
+void
+assuan_pool_put (assuan_context_t ctx, int discard)
+{
+  pool_key_t key;
+  assuan_pool_t pool;
+  struct pool_conn_s *conn;
+  struct pool_conn_s *expired;
+  int keep = 0;
+
+  if (!ctx)
+    return;
+  key = ctx->pool_key;
+  if (!key)
+    {
+      assuan_release (ctx);
+      return;
+    }
+  pool = key->pool;
+
+  TRACE2 (ctx, ASSUAN_LOG_CTX, "assuan_pool_put", ctx,
+	  "pool=%p, discard=%i", pool, discard);
+
+  if (!discard && !ctx->io_timed_out
+      && !assuan_transact (ctx, "RESET", NULL, NULL, NULL, NULL, NULL, NULL))
+    {
+      reset_settings (ctx);
+      keep = 1;
+    }
+
+  gpgrt_lock_lock (&pool->lock);
+  conn = unlink_busy (key, ctx);
+  if (keep && conn)
+    {
+      conn->idle_since = _assuan_timestamp ();
+      conn->next = key->idle;
+      key->idle = conn;
+      key->nidle++;
+    }
+  else
+    key->nlive--;
+  expired = expire_idle (key);
+  gpgrt_lock_unlock (&pool->lock);
+
+  if (!keep || !conn)
+    {
+      if (conn)
+        pool->malloc_hooks.free (conn);
+      ctx->pool_key = NULL;
+      assuan_release (ctx);
+    }
+  release_conns (pool, expired);
+}
+
+
+/* Called by assuan_release for a context CTX which has been taken
+   from a pool and not returned: give its slot back.  */
+void
+_assuan_pool_forget (assuan_context_t ctx)
+{
+  pool_key_t key = ctx->pool_key;
+  assuan_pool_t pool = key->pool;
+  struct pool_conn_s *conn;
+
+  ctx->pool_key = NULL;
+  gpgrt_lock_lock (&pool->lock);
+  conn = unlink_busy (key, ctx);
+  key->nlive--;
+  gpgrt_lock_unlock (&pool->lock);
+  if (conn)
+    pool->malloc_hooks.free (conn);
+}
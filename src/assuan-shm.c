@@ -0,0 +1,728 @@
+/* assuan-shm.c - Shared memory transport and data hand-off
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "assuan-defs.h"
+#include "debug.h"
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_MMAN_H) \
+    && defined(USE_DESCRIPTOR_PASSING)
+# define USE_MEMFD 1
+# if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_STDINT_H) \
+     && defined(__ATOMIC_SEQ_CST)
+#  define USE_SHM_TRANSPORT 1
+# endif
+#endif
+
+#ifdef USE_MEMFD
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef USE_SHM_TRANSPORT
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+/* The shared mapping starts with a header page followed by the data
+   areas of the two rings.  Each ring has exactly one producer and one
+   consumer; the positions are free running counters which are only
+   masked when accessing the data area.  The socket used to set up the
+   transport is kept open: descriptors are still passed over it and a
+   hangup tells us that the peer is gone for good.  */
+
+#define SHM_MAGIC        "AssuanR1"
+#define SHM_HDRSIZE      4096
+#define SHM_DEFAULT_SIZE 65536
+#define SHM_MIN_SIZE     4096
+#define SHM_MAX_SIZE     (16 * 1024 * 1024)
+
+/* Index of the rings.  */
+#define SHM_TO_SERVER 0
+#define SHM_TO_CLIENT 1
+
+/* How long to sleep in the futex before checking that the peer is
+   still alive.  */
+#define SHM_WAIT_MSEC    250
+
+struct shm_ring_s
+{
+  uint32_t head;           /* Advanced by the producer.  */
+  uint32_t tail;           /* Advanced by the consumer.  */
+  uint32_t seq;            /* Futex word, bumped after each change.  */
+  uint32_t waiters;        /* Number of sleepers on SEQ.  */
+  uint32_t producer_gone;
+  uint32_t consumer_gone;
+  char pad[64 - 6 * 4];    /* Keep the rings in separate cache lines.  */
+};
+
+struct shm_header_s
+{
+  char magic[8];
+  uint32_t ringsize;
+  char pad[64 - 12];
+  struct shm_ring_s ring[2];
+};
+
+
+struct assuan_shm_s
+{
+  struct shm_header_s *hdr;
+  size_t maplen;
+  uint32_t mask;
+
+  struct shm_ring_s *rx;
+  unsigned char *rxbuf;
+  struct shm_ring_s *tx;
+  unsigned char *txbuf;
+
+  /* Set after the switch to the rings has been done.  */
+  int active;
+
+  /* The engine functions we replace.  */
+  ssize_t (*prev_readfnc) (assuan_context_t, void *, size_t);
+  ssize_t (*prev_writefnc) (assuan_context_t, const void *, size_t);
+  gpg_error_t (*prev_receivefd) (assuan_context_t, assuan_fd_t *);
+};
+
+
+static void
+shm_wake (struct shm_ring_s *ring)
+{
+  __atomic_add_fetch (&ring->seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&ring->waiters, __ATOMIC_SEQ_CST))
+    syscall (SYS_futex, &ring->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+/* Sleep until the SEQ of RING differs from SEQ or a timeout expired.
+   Returns -1 with ERRNO set if the peer is gone or, with ETIMEDOUT,
+   if DEADLINE (see _assuan_io_deadline) has passed.  */
+static int
+shm_wait (assuan_context_t ctx, struct shm_ring_s *ring, uint32_t seq,
+          unsigned long long deadline)
+{
+  struct timespec ts;
+  struct pollfd pfd;
+  unsigned long long now;
+  long msec = SHM_WAIT_MSEC;
+  int rc;
+
+  if (deadline)
+    {
+      now = _assuan_timestamp ();
+      if (now >= deadline)
+        {
+          ctx->io_timed_out = 1;
+          gpg_err_set_errno (ETIMEDOUT);
+          return -1;
+        }
+      if ((deadline - now) / 1000 < SHM_WAIT_MSEC)
+        msec = (deadline - now + 999) / 1000;
+    }
+  ts.tv_sec = 0;
+  ts.tv_nsec = msec * 1000000L;
+
+  __atomic_add_fetch (&ring->waiters, 1, __ATOMIC_SEQ_CST);
+  rc = syscall (SYS_futex, &ring->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+  __atomic_sub_fetch (&ring->waiters, 1, __ATOMIC_SEQ_CST);
+  if (!rc || errno == EAGAIN || errno == EINTR)
+    return 0;
+  if (errno != ETIMEDOUT)
+    return -1;
+
+  /* A crashed peer can't tell us that it is gone; its socket can.  */
+  pfd.fd = ctx->inbound.fd;
+  pfd.events = 0;
+  pfd.revents = 0;
+  if (poll (&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR)))
+    {
+      gpg_err_set_errno (EPIPE);
+      return -1;
+    }
+  return 0;
+}
+
+
+static ssize_t
+shm_reader (assuan_context_t ctx, void *buffer, size_t size)
+{
+  struct assuan_shm_s *shm = ctx->shm;
+  struct shm_ring_s *ring = shm->rx;
+  uint32_t head, tail, seq, avail, off, n;
+  unsigned long long deadline = _assuan_io_deadline (ctx);
+
+  tail = ring->tail;
+  for (;;)
+    {
+      seq = __atomic_load_n (&ring->seq, __ATOMIC_SEQ_CST);
+      head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      avail = head - tail;
+      if (avail)
+        break;
+      if (__atomic_load_n (&ring->producer_gone, __ATOMIC_ACQUIRE))
+        return 0;  /* EOF */
+      if (shm_wait (ctx, ring, seq, deadline))
+        return -1;
+    }
+  if (avail > shm->mask + 1)
+    {
+      /* The peer messed with the ring.  */
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+
+  if (size > avail)
+    size = avail;
+  off = tail & shm->mask;
+  n = shm->mask + 1 - off;
+  if (n > size)
+    n = size;
+  memcpy (buffer, shm->rxbuf + off, n);
+  if (n < size)
+    memcpy ((char *)buffer + n, shm->rxbuf, size - n);
+
+  __atomic_store_n (&ring->tail, tail + (uint32_t)size, __ATOMIC_RELEASE);
+  shm_wake (ring);
+  return size;
+}
+
+
+static ssize_t
+shm_writer (assuan_context_t ctx, const void *buffer, size_t size)
+{
+  struct assuan_shm_s *shm = ctx->shm;
+  struct shm_ring_s *ring = shm->tx;
+  uint32_t head, tail, seq, space, off, n;
+  unsigned long long deadline = _assuan_io_deadline (ctx);
+
+  head = ring->head;
+  for (;;)
+    {
+      if (__atomic_load_n (&ring->consumer_gone, __ATOMIC_ACQUIRE))
+        {
+          gpg_err_set_errno (EPIPE);
+          return -1;
+        }
+      seq = __atomic_load_n (&ring->seq, __ATOMIC_SEQ_CST);
+      tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+      if (head - tail > shm->mask + 1)
+        {
+          gpg_err_set_errno (EIO);
+          return -1;
+        }
+      space = shm->mask + 1 - (head - tail);
+      if (space)
+        break;
+      if (shm_wait (ctx, ring, seq, deadline))
+        return -1;
+    }
+
+  if (size > space)
+    size = space;
+  off = head & shm->mask;
+  n = shm->mask + 1 - off;
+  if (n > size)
+    n = size;
+  memcpy (shm->txbuf + off, buffer, n);
+  if (n < size)
+    memcpy (shm->txbuf, (const char *)buffer + n, size - n);
+
+  __atomic_store_n (&ring->head, head + (uint32_t)size, __ATOMIC_RELEASE);
+  shm_wake (ring);
+  return size;
+}
+
+
+/* Descriptors are still passed over the socket.  As nobody reads from
+   it anymore, we need to do this here to pick up the descriptor.  The
+   data sent along with it is only a comment and can be dropped.  */
+static gpg_error_t
+shm_receivefd (assuan_context_t ctx, assuan_fd_t *fd)
+{
+  struct assuan_shm_s *shm = ctx->shm;
+  char buffer[256];
+  ssize_t n;
+
+  while (!ctx->uds.pendingfdscount)
+    {
+      n = shm->prev_readfnc (ctx, buffer, sizeof buffer);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        return _assuan_error (ctx, gpg_err_code_from_syserror ());
+      if (!n)
+        return _assuan_error (ctx, GPG_ERR_EOF);
+    }
+  return shm->prev_receivefd (ctx, fd);
+}
+
+
+/* Map the memfd FD of size SIZE.  */
+static gpg_error_t
+shm_map (assuan_context_t ctx, int fd, size_t size)
+{
+  struct assuan_shm_s *shm;
+  void *addr;
+
+  shm = _assuan_calloc (ctx, 1, sizeof *shm);
+  if (!shm)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  addr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    {
+      gpg_error_t err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+      _assuan_free (ctx, shm);
+      return err;
+    }
+  shm->hdr = addr;
+  shm->maplen = size;
+  ctx->shm = shm;
+  return 0;
+}
+
+
+static void
+shm_setup_rings (assuan_context_t ctx, uint32_t ringsize)
+{
+  struct assuan_shm_s *shm = ctx->shm;
+  unsigned char *base = (unsigned char *)shm->hdr + SHM_HDRSIZE;
+  int rx, tx;
+
+  shm->mask = ringsize - 1;
+  rx = ctx->is_server? SHM_TO_SERVER : SHM_TO_CLIENT;
+  tx = ctx->is_server? SHM_TO_CLIENT : SHM_TO_SERVER;
+  shm->rx = &shm->hdr->ring[rx];
+  shm->rxbuf = base + rx * ringsize;
+  shm->tx = &shm->hdr->ring[tx];
+  shm->txbuf = base + tx * ringsize;
+}
+
+
+/* Switch CTX over to the rings.  */
+static void
+shm_activate (assuan_context_t ctx)
+{
+  struct assuan_shm_s *shm = ctx->shm;
+
+  shm->prev_readfnc = ctx->engine.readfnc;
+  shm->prev_writefnc = ctx->engine.writefnc;
+  shm->prev_receivefd = ctx->engine.receivefd;
+  ctx->engine.readfnc = shm_reader;
+  ctx->engine.writefnc = shm_writer;
+  ctx->engine.receivefd = shm_receivefd;
+  shm->active = 1;
+}
+#endif /*USE_SHM_TRANSPORT*/
+
+
+/* Handler for the TRANSPORT command: Take the memfd sent by the
+   client and map it.  The switch to the rings is done by
+   _assuan_shm_commit after the OK has been written.  */
+gpg_error_t
+_assuan_shm_accept (assuan_context_t ctx, const char *line)
+{
+#ifdef USE_SHM_TRANSPORT
+  gpg_error_t err;
+  assuan_fd_t fd;
+  struct stat st;
+  int seals;
+  struct shm_header_s *hdr;
+  uint32_t ringsize;
+
+  if (strcmp (line, "shm"))
+    return set_error (ctx, GPG_ERR_ASS_PARAMETER, "unknown transport");
+  if (ctx->shm || !ctx->engine.receivefd)
+    return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+
+  err = assuan_receivefd (ctx, &fd);
+  if (err)
+    return err;
+
+  /* The client must not be able to shrink the file under our feet;
+     that would crash us with a SIGBUS.  */
+  seals = fcntl (fd, F_GET_SEALS);
+  if (seals == -1 || !(seals & F_SEAL_SHRINK) || !(seals & F_SEAL_SEAL)
+      || fstat (fd, &st) || st.st_size < SHM_HDRSIZE + 2 * SHM_MIN_SIZE
+      || st.st_size > SHM_HDRSIZE + 2 * SHM_MAX_SIZE)
+    {
+      _assuan_close (ctx, fd);
+      return set_error (ctx, GPG_ERR_ASS_PARAMETER, "bad shared memory");
+    }
+
+  err = shm_map (ctx, fd, st.st_size);
+  _assuan_close (ctx, fd);
+  if (err)
+    return err;
+
+  hdr = ctx->shm->hdr;
+  ringsize = hdr->ringsize;
+  if (memcmp (hdr->magic, SHM_MAGIC, 8) || (ringsize & (ringsize - 1))
+      || (size_t)st.st_size != SHM_HDRSIZE + 2 * (size_t)ringsize)
+    {
+      _assuan_shm_deinit (ctx);
+      return set_error (ctx, GPG_ERR_ASS_PARAMETER, "bad shared memory");
+    }
+  shm_setup_rings (ctx, ringsize);
+  return 0;
+#else
+  (void)line;
+  return set_error (ctx, GPG_ERR_NOT_SUPPORTED, "no shared memory support");
+#endif
+}
+
+
+/* Called by the server after the response to a command has been
+   written.  If the command was a successful TRANSPORT all further
+   lines are exchanged over the rings.  */
+void
+_assuan_shm_commit (assuan_context_t ctx)
+{
+#ifdef USE_SHM_TRANSPORT
+  if (ctx->shm && !ctx->shm->active)
+    shm_activate (ctx);
+#else
+  (void)ctx;
+#endif
+}
+
+
+/* Unmap the rings of CTX and tell the peer that we are gone.  */
+void
+_assuan_shm_deinit (assuan_context_t ctx)
+{
+#ifdef USE_SHM_TRANSPORT
+  struct assuan_shm_s *shm = ctx->shm;
+
+  if (!shm)
+    return;
+  if (shm->active)
+    {
+      __atomic_store_n (&shm->tx->producer_gone, 1, __ATOMIC_RELEASE);
+      shm_wake (shm->tx);
+      __atomic_store_n (&shm->rx->consumer_gone, 1, __ATOMIC_RELEASE);
+      shm_wake (shm->rx);
+      ctx->engine.readfnc = shm->prev_readfnc;
+      ctx->engine.writefnc = shm->prev_writefnc;
+      ctx->engine.receivefd = shm->prev_receivefd;
+    }
+  munmap (shm->hdr, shm->maplen);
+  _assuan_free (ctx, shm);
+  ctx->shm = NULL;
+#else
+  (void)ctx;
+#endif
+}
+
+
+/* Switch the connection of the client CTX to a pair of ring buffers
+   of RINGSIZE bytes each in a shared memory mapping.  Requires that
+   the server is on the same host, that descriptor passing works for
+   the connection and that the server has registered the TRANSPORT
+   command.  A RINGSIZE of 0 selects a default size.  It is allowed
+   to use (NULL, 0) as a runtime test to check whether this transport
+   is available.  */
+gpg_error_t
+assuan_use_shm_transport (assuan_context_t ctx, size_t ringsize)
+{
+#ifdef USE_SHM_TRANSPORT
+  gpg_error_t err;
+  int fd;
+  size_t size;
+  struct shm_header_s *hdr;
+
+  if (!ctx && !ringsize)
+    return 0;
+
+  TRACE_BEG1 (ctx, ASSUAN_LOG_CTX, "assuan_use_shm_transport", ctx,
+	      "ringsize=%zu", ringsize);
+
+  if (!ctx || ctx->is_server)
+    return TRACE_ERR (_assuan_error (ctx, GPG_ERR_ASS_INV_VALUE));
+  if (ctx->shm || !ctx->engine.sendfd || ctx->inbound.fd != ctx->outbound.fd)
+    return TRACE_ERR (_assuan_error (ctx, GPG_ERR_NOT_SUPPORTED));
+
+  if (!ringsize)
+    ringsize = SHM_DEFAULT_SIZE;
+  if (ringsize > SHM_MAX_SIZE)
+    return TRACE_ERR (_assuan_error (ctx, GPG_ERR_INV_LENGTH));
+  for (size = SHM_MIN_SIZE; size < ringsize; size <<= 1)
+    ;
+  ringsize = size;
+  size = SHM_HDRSIZE + 2 * ringsize;
+
+  fd = memfd_create ("assuan-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return TRACE_ERR (_assuan_error (ctx, gpg_err_code_from_syserror ()));
+  if (ftruncate (fd, size)
+      || fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+    {
+      err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+      _assuan_close (ctx, fd);
+      return TRACE_ERR (err);
+    }
+
+  err = shm_map (ctx, fd, size);
+  if (err)
+    {
+      _assuan_close (ctx, fd);
+      return TRACE_ERR (err);
+    }
+  hdr = ctx->shm->hdr;
+  memcpy (hdr->magic, SHM_MAGIC, 8);
+  hdr->ringsize = ringsize;
+  shm_setup_rings (ctx, ringsize);
+
+  err = assuan_sendfd (ctx, fd);
+  _assuan_close (ctx, fd);
+  if (!err)
+    err = assuan_transact (ctx, "TRANSPORT shm", NULL, NULL, NULL, NULL,
+                           NULL, NULL);
+  if (err)
+    _assuan_shm_deinit (ctx);
+  else
+    shm_activate (ctx);
+
+  return TRACE_ERR (err);
+#else
+  (void)ringsize;
+  return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
+
+/* Data hand-off.  After "TRANSPORT memfd" has been accepted, a data
+   chunk of at least the negotiated threshold is not sent as escaped D
+   lines but written to a sealed memfd.  The descriptor is passed with
+   assuan_sendfd and announced by the line "MEMFD <length>".  */
+
+#define MEMFD_DEFAULT_THRESHOLD 65536
+#define MEMFD_MIN_THRESHOLD     4096
+
+/* Check whether LINE is a MEMFD line.  */
+int
+_assuan_memfd_line_p (const char *line, int linelen)
+{
+  return (linelen > 6 && !strncmp (line, "MEMFD ", 6));
+}
+
+
+/* Send the LENGTH bytes at BUFFER using a memfd.  */
+gpg_error_t
+_assuan_memfd_send (assuan_context_t ctx, const void *buffer, size_t length)
+{
+#ifdef USE_MEMFD
+  gpg_error_t err;
+  const char *p = buffer;
+  size_t left = length;
+  ssize_t n;
+  int fd;
+  char numbuf[30];
+
+  fd = memfd_create ("assuan-data", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  while (left)
+    {
+      n = _assuan_write (ctx, fd, p, left);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        goto syserr;
+      p += n;
+      left -= n;
+    }
+  /* Without the seals the receiver would not accept it.  */
+  if (fcntl (fd, F_ADD_SEALS,
+             F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL))
+    goto syserr;
+
+  err = assuan_sendfd (ctx, fd);
+  _assuan_close (ctx, fd);
+  if (err)
+    return err;
+  snprintf (numbuf, sizeof numbuf, "%lu", (unsigned long)length);
+  err = _assuan_write_line (ctx, "MEMFD ", numbuf, strlen (numbuf));
+  if (!err)
+    _assuan_stats_add (ctx, data_out, length);
+  return err;
+
+ syserr:
+  err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+  _assuan_close (ctx, fd);
+  return err;
+#else
+  (void)buffer;
+  (void)length;
+  return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
+/* Take the descriptor announced by the MEMFD line LINE and map it
+   read-only.  On success the address and the length of the data are
+   stored at R_ADDR and R_LENGTH; the mapping must be released with
+   _assuan_memfd_unmap.  The pending descriptor is consumed in any
+   case.  */
+gpg_error_t
+_assuan_memfd_map (assuan_context_t ctx, const char *line,
+                   void **r_addr, size_t *r_length)
+{
+#ifdef USE_MEMFD
+  gpg_error_t err;
+  assuan_fd_t fd;
+  unsigned long length;
+  struct stat st;
+  int seals;
+  char *endp;
+  void *addr;
+
+  *r_addr = NULL;
+  *r_length = 0;
+
+  err = assuan_receivefd (ctx, &fd);
+  if (err)
+    return err;
+
+  line += 6;
+  errno = 0;
+  length = strtoul (line, &endp, 10);
+  if (errno || endp == line || *endp)
+    err = set_error (ctx, GPG_ERR_ASS_PARAMETER, "invalid MEMFD line");
+  /* The sender must not be able to modify or shrink the data while
+     we are looking at it.  */
+  else if ((seals = fcntl (fd, F_GET_SEALS)) == -1
+           || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE))
+               != (F_SEAL_SHRINK | F_SEAL_WRITE)
+           || fstat (fd, &st) || !length
+           || (unsigned long)st.st_size != length)
+    err = set_error (ctx, GPG_ERR_ASS_PARAMETER, "bad memfd");
+  else
+    {
+      addr = mmap (NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED)
+        err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+      else
+        {
+          *r_addr = addr;
+          *r_length = length;
+          _assuan_stats_add (ctx, data_in, length);
+        }
+    }
+  _assuan_close (ctx, fd);
+  return err;
+#else
+  (void)line;
+  *r_addr = NULL;
+  *r_length = 0;
+  return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
+void
+_assuan_memfd_unmap (void *addr, size_t length)
+{
+#ifdef USE_MEMFD
+  if (addr)
+    munmap (addr, length);
+#else
+  (void)addr;
+  (void)length;
+#endif
+}
+
+
+/* Handler for "TRANSPORT memfd [<threshold>]".  */
+gpg_error_t
+_assuan_memfd_accept (assuan_context_t ctx, const char *line)
+{
+#ifdef USE_MEMFD
+  unsigned long threshold = MEMFD_DEFAULT_THRESHOLD;
+  char *endp;
+
+  if (!ctx->engine.receivefd || !ctx->engine.sendfd)
+    return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+  while (*line == ' ' || *line == '\t')
+    line++;
+  if (*line)
+    {
+      threshold = strtoul (line, &endp, 10);
+      if (*endp)
+        return set_error (ctx, GPG_ERR_ASS_PARAMETER, "invalid threshold");
+    }
+  if (threshold < MEMFD_MIN_THRESHOLD)
+    threshold = MEMFD_MIN_THRESHOLD;
+  ctx->memfd_threshold = threshold;
+  return 0;
+#else
+  (void)line;
+  return set_error (ctx, GPG_ERR_NOT_SUPPORTED, "no memfd support");
+#endif
+}
+
+
+/* Ask the server connected to CTX to exchange data chunks of at
+   least THRESHOLD bytes using memfds.  This is used for both
+   directions: data lines sent by the server as well as the client's
+   responses to inquiries.  A THRESHOLD of 0 selects a default.  It is
+   allowed to use (NULL, 0) as a runtime test to check whether this
+   feature is available.  */
+gpg_error_t
+assuan_use_memfd_data (assuan_context_t ctx, size_t threshold)
+{
+#ifdef USE_MEMFD
+  gpg_error_t err;
+  char cmd[50];
+
+  if (!ctx && !threshold)
+    return 0;
+  if (!ctx || ctx->is_server)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  if (!ctx->engine.sendfd || !ctx->engine.receivefd)
+    return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+
+  if (!threshold)
+    threshold = MEMFD_DEFAULT_THRESHOLD;
+  if (threshold < MEMFD_MIN_THRESHOLD)
+    threshold = MEMFD_MIN_THRESHOLD;
+  snprintf (cmd, sizeof cmd, "TRANSPORT memfd %lu", (unsigned long)threshold);
+  err = assuan_transact (ctx, cmd, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (!err)
+    ctx->memfd_threshold = threshold;
+  return err;
+#else
+  (void)threshold;
+  return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+#endif
+}
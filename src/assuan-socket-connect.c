@@ -97,16 +97,164 @@ parse_portno (const char *str, uint16_t *r_port)
 }
 
 
+/* The address of a socket server.  */
+typedef union
+{
+  struct sockaddr sa;
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+#ifdef WITH_IPV6
+  struct sockaddr_in6 in6;
+#endif
+} srvr_addr_t;
+
+
+/* States of an asynchronous connect (CTX->CONNECT_STATE).  */
+#define CONNECT_STATE_CONNECTING 1  /* Waiting for connect to finish.  */
+#define CONNECT_STATE_GREETING   2  /* Waiting for the greeting.  */
+
+
+/* Parse the socket name NAME as described for assuan_socket_connect
+   and store the address at ADDR, its length at R_LEN and the protocol
+   family at R_PF.  */
 static gpg_error_t
-_assuan_connect_finalize (assuan_context_t ctx, assuan_fd_t fd,
-                          unsigned int flags)
+parse_socket_name (assuan_context_t ctx, const char *name,
+                   srvr_addr_t *addr, size_t *r_len, int *r_pf)
 {
-  gpg_error_t err;
+  gpg_error_t err = 0;
+  uint16_t port = 0;
+  const char *s;
+  int af = AF_LOCAL;
+  char *addrstr, *p;
+#ifdef HAVE_INET_PTON
+  void *addrbuf = NULL;
+#endif
+
+  if (!strncmp (name, "file://", 7) && name[7])
+    name += 7;
+#ifdef HAVE_ABSTRACT_SOCKETS
+  else if (*name == '@' && name[1])
+    {
+      /* A socket in the abstract namespace.  */
+      if (_assuan_sock_set_sockaddr_un (name, &addr->sa, NULL))
+        return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+      *r_len = sizeof addr->un;
+      *r_pf = PF_LOCAL;
+      return 0;
+    }
+#endif
+  else if (!strncmp (name, "assuan://", 9) && name[9])
+    {
+      name += 9;
+      af = AF_INET;
+    }
+  else /* Default.  */
+    {
+      /* We require that the name starts with a slash if no URL
+         schemata is used.  To make things easier we allow an optional
+         drive prefix.  */
+      s = name;
+      if (*s && s[1] == ':')
+        s += 2;
+      if (*s != DIRSEP_C && *s != '/')
+        return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+    }
+
+  memset (addr, 0, sizeof *addr);
+
+  if (af == AF_LOCAL)
+    {
+      if (strlen (name)+1 >= sizeof addr->un.sun_path)
+        return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
 
+      addr->un.sun_family = AF_LOCAL;
+      strncpy (addr->un.sun_path, name, sizeof (addr->un.sun_path) - 1);
+      addr->un.sun_path[sizeof (addr->un.sun_path) - 1] = 0;
+      *r_len = SUN_LEN (&addr->un);
+      *r_pf = PF_LOCAL;
+      return 0;
+    }
+
+  addrstr = _assuan_malloc (ctx, strlen (name) + 1);
+  if (!addrstr)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+
+  if (*name == '[')
+    {
+      strcpy (addrstr, name+1);
+      p = strchr (addrstr, ']');
+      if (!p || p[1] != ':' || !parse_portno (p+2, &port))
+        err = _assuan_error (ctx, GPG_ERR_BAD_URI);
+      else
+        {
+          *p = 0;
+#ifdef WITH_IPV6
+          af = AF_INET6;
+          addr->in6.sin6_family = af;
+          addr->in6.sin6_port = htons (port);
+#ifdef HAVE_INET_PTON
+          addrbuf = &addr->in6.sin6_addr;
+#endif
+          *r_len = sizeof addr->in6;
+          *r_pf = PF_INET6;
+#else
+          err =  _assuan_error (ctx, GPG_ERR_EAFNOSUPPORT);
+#endif
+        }
+    }
+  else
+    {
+      strcpy (addrstr, name);
+      p = strchr (addrstr, ':');
+      if (!p || !parse_portno (p+1, &port))
+        err = _assuan_error (ctx, GPG_ERR_BAD_URI);
+      else
+        {
+          *p = 0;
+          addr->in.sin_family = af;
+          addr->in.sin_port = htons (port);
+#ifdef HAVE_INET_PTON
+          addrbuf = &addr->in.sin_addr;
+#endif
+          *r_len = sizeof addr->in;
+          *r_pf = PF_INET;
+        }
+    }
+
+  if (!err)
+    {
+#ifdef HAVE_INET_PTON
+      switch (inet_pton (af, addrstr, addrbuf))
+        {
+        case 1:  break;
+        case 0:  err = _assuan_error (ctx, GPG_ERR_BAD_URI); break;
+        default: err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+        }
+#else /*!HAVE_INET_PTON*/
+      /* We need to use the old function.  If we are here v6
+         support isn't enabled anyway and thus we can do fine
+         without.  Note that Windows as a compatible inet_pton
+         function named inetPton, but only since Vista.  */
+      addr->in.sin_addr.s_addr = inet_addr (addrstr);
+      if (addr->in.sin_addr.s_addr == INADDR_NONE)
+        err = _assuan_error (ctx, GPG_ERR_BAD_URI);
+#endif /*!HAVE_INET_PTON*/
+    }
+
+  _assuan_free (ctx, addrstr);
+  return err;
+}
+
+
+/* Set up CTX as a client talking to the server at FD.  */
+static void
+init_client (assuan_context_t ctx, assuan_fd_t fd, unsigned int flags)
+{
   ctx->engine.release = _assuan_client_release;
   ctx->engine.readfnc = _assuan_simple_read;
   ctx->engine.writefnc = _assuan_simple_write;
   ctx->engine.sendfd = NULL;
+  ctx->engine.sendfds = NULL;
   ctx->engine.receivefd = NULL;
   ctx->finish_handler = _assuan_client_finish;
   ctx->inbound.fd = fd;
@@ -116,29 +264,22 @@ _assuan_connect_finalize (assuan_context_t ctx, assuan_fd_t fd,
   if (flags & ASSUAN_SOCKET_CONNECT_FDPASSING)
     _assuan_init_uds_io (ctx);
 
-  /* initial handshake */
-  {
-    assuan_response_t response;
-    int off;
+  /* The greeting is read along with the first response.  */
+  if (flags & ASSUAN_SOCKET_CONNECT_DEFER_GREETING)
+    ctx->greeting_pending = 1;
+}
 
-    err = _assuan_read_from_server (ctx, &response, &off, 0);
-    if (err)
-      TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
-	      "can't connect to server: %s\n", gpg_strerror (err));
-    else if (response != ASSUAN_RESPONSE_OK)
-      {
-	char *sname = _assuan_encode_c_string (ctx, ctx->inbound.line);
-	if (sname)
-	  {
-	    TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
-		    "can't connect to server: %s", sname);
-	    _assuan_free (ctx, sname);
-	  }
-	err = _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
-      }
-  }
 
-  return err;
+static gpg_error_t
+_assuan_connect_finalize (assuan_context_t ctx, assuan_fd_t fd,
+                          unsigned int flags)
+{
+  init_client (ctx, fd, flags);
+
+  /* initial handshake */
+  if (ctx->greeting_pending)
+    return 0;
+  return _assuan_read_greeting (ctx, 1);
 }
 
 
@@ -173,8 +314,13 @@ assuan_socket_connect_fd (assuan_context_t ctx, int fd, unsigned int flags)
      ASSUAN_SOCKET_CONNECT_FDPASSING
         sendmsg and recvmsg are used.
 
+     ASSUAN_SOCKET_CONNECT_DEFER_GREETING
+        Don't wait for the greeting of the server; it is read and
+        checked along with the response to the first command.
+
    NAME must either start with a slash and optional with a drive
-   prefix ("c:") or use one of these URL schemata:
+   prefix ("c:"), start with '@' for a socket in the abstract
+   namespace (Linux only), or use one of these URL schemata:
 
       file://<fname>
 
@@ -191,19 +337,11 @@ gpg_error_t
 assuan_socket_connect (assuan_context_t ctx, const char *name,
 		       pid_t server_pid, unsigned int flags)
 {
-  gpg_error_t err = 0;
+  gpg_error_t err;
   assuan_fd_t fd;
-#ifdef WITH_IPV6
-  struct sockaddr_in6 srvr_addr_in6;
-#endif
-  struct sockaddr_un srvr_addr_un;
-  struct sockaddr_in srvr_addr_in;
-  struct sockaddr *srvr_addr = NULL;
-  uint16_t port = 0;
-  size_t len = 0;
-  const char *s;
-  int af = AF_LOCAL;
-  int pf = PF_LOCAL;
+  srvr_addr_t srvr_addr;
+  size_t len;
+  int pf;
 
   TRACE2 (ctx, ASSUAN_LOG_CTX, "assuan_socket_connect", ctx,
 	  "name=%s, flags=0x%x", name ? name : "(null)", flags);
@@ -211,141 +349,177 @@ assuan_socket_connect (assuan_context_t ctx, const char *name,
   if (!ctx || !name)
     return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
 
-  if (!strncmp (name, "file://", 7) && name[7])
-    name += 7;
-  else if (!strncmp (name, "assuan://", 9) && name[9])
+  err = parse_socket_name (ctx, name, &srvr_addr, &len, &pf);
+  if (err)
+    return err;
+
+  fd = _assuan_sock_new (ctx, pf, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
     {
-      name += 9;
-      af = AF_INET;
-      pf = PF_INET;
+      err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+      TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
+              "can't create socket: %s", strerror (errno));
+      return err;
     }
-  else /* Default.  */
+
+  if (_assuan_sock_connect (ctx, fd, &srvr_addr.sa, len) == -1)
     {
-      /* We require that the name starts with a slash if no URL
-         schemata is used.  To make things easier we allow an optional
-         drive prefix.  */
-      s = name;
-      if (*s && s[1] == ':')
-        s += 2;
-      if (*s != DIRSEP_C && *s != '/')
-        return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+      TRACE2 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
+	      "can't connect to `%s': %s\n", name, strerror (errno));
+      _assuan_close (ctx, fd);
+      return _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
     }
 
-  if (af == AF_LOCAL)
-    {
-      if (strlen (name)+1 >= sizeof srvr_addr_un.sun_path)
-        return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  err = _assuan_connect_finalize (ctx, fd, flags);
 
-      memset (&srvr_addr_un, 0, sizeof srvr_addr_un);
-      srvr_addr_un.sun_family = AF_LOCAL;
-      strncpy (srvr_addr_un.sun_path, name, sizeof (srvr_addr_un.sun_path) - 1);
-      srvr_addr_un.sun_path[sizeof (srvr_addr_un.sun_path) - 1] = 0;
-      len = SUN_LEN (&srvr_addr_un);
+  if (err)
+    _assuan_reset (ctx);
 
-      srvr_addr = (struct sockaddr *)&srvr_addr_un;
-    }
-  else
-    {
-      char *addrstr, *p;
-#ifdef HAVE_INET_PTON
-      void *addrbuf = NULL;
-#endif
+  return err;
+}
 
-      addrstr = _assuan_malloc (ctx, strlen (name) + 1);
-      if (!addrstr)
-        return _assuan_error (ctx, gpg_err_code_from_syserror ());
 
-      if (*name == '[')
-        {
-          strcpy (addrstr, name+1);
-          p = strchr (addrstr, ']');
-          if (!p || p[1] != ':' || !parse_portno (p+2, &port))
-            err = _assuan_error (ctx, GPG_ERR_BAD_URI);
-          else
-            {
-              *p = 0;
-#ifdef WITH_IPV6
-              af = AF_INET6;
-              pf = PF_INET6;
-              memset (&srvr_addr_in6, 0, sizeof srvr_addr_in6);
-              srvr_addr_in6.sin6_family = af;
-              srvr_addr_in6.sin6_port = htons (port);
-#ifdef HAVE_INET_PTON
-              addrbuf = &srvr_addr_in6.sin6_addr;
-#endif
-              srvr_addr = (struct sockaddr *)&srvr_addr_in6;
-              len = sizeof srvr_addr_in6;
-#else
-              err =  _assuan_error (ctx, GPG_ERR_EAFNOSUPPORT);
-#endif
-            }
-        }
-      else
-        {
-          strcpy (addrstr, name);
-          p = strchr (addrstr, ':');
-          if (!p || !parse_portno (p+1, &port))
-            err = _assuan_error (ctx, GPG_ERR_BAD_URI);
-          else
-            {
-              *p = 0;
-              memset (&srvr_addr_in, 0, sizeof srvr_addr_in);
-              srvr_addr_in.sin_family = af;
-              srvr_addr_in.sin_port = htons (port);
-#ifdef HAVE_INET_PTON
-              addrbuf = &srvr_addr_in.sin_addr;
-#endif
-              srvr_addr = (struct sockaddr *)&srvr_addr_in;
-              len = sizeof srvr_addr_in;
-            }
-        }
+/* Start connecting CTX to the socket server NAME without blocking.
+   NAME and FLAGS are the same as for assuan_socket_connect.  On
+   success 0 is returned and CTX is ready for use.  If the caller
+   needs to wait, GPG_ERR_EAGAIN is returned, the descriptor to wait
+   for is stored at R_FD and the events to wait for, a combination of
+   ASSUAN_IO_WANT_READ and ASSUAN_IO_WANT_WRITE, at R_EVENTS; once one
+   of them is ready, assuan_socket_connect_step needs to be called.
+   On any other error CTX is reset.  With
+   ASSUAN_SOCKET_CONNECT_DEFER_GREETING, 0 is returned as soon as the
+   socket is connected.  The socket stays in non-blocking mode.  */
+gpg_error_t
+assuan_socket_connect_start (assuan_context_t ctx, const char *name,
+                             unsigned int flags,
+                             assuan_fd_t *r_fd, unsigned int *r_events)
+{
+  gpg_error_t err;
+  assuan_fd_t fd;
+  srvr_addr_t srvr_addr;
+  size_t len;
+  int pf;
 
-      if (!err)
-        {
-#ifdef HAVE_INET_PTON
-          switch (inet_pton (af, addrstr, addrbuf))
-            {
-            case 1:  break;
-            case 0:  err = _assuan_error (ctx, GPG_ERR_BAD_URI); break;
-            default: err = _assuan_error (ctx, gpg_err_code_from_syserror ());
-            }
-#else /*!HAVE_INET_PTON*/
-          /* We need to use the old function.  If we are here v6
-             support isn't enabled anyway and thus we can do fine
-             without.  Note that Windows as a compatible inet_pton
-             function named inetPton, but only since Vista.  */
-          srvr_addr_in.sin_addr.s_addr = inet_addr (addrstr);
-          if (srvr_addr_in.sin_addr.s_addr == INADDR_NONE)
-            err = _assuan_error (ctx, GPG_ERR_BAD_URI);
-#endif /*!HAVE_INET_PTON*/
-        }
+  TRACE2 (ctx, ASSUAN_LOG_CTX, "assuan_socket_connect_start", ctx,
+	  "name=%s, flags=0x%x", name ? name : "(null)", flags);
 
-      _assuan_free (ctx, addrstr);
-      if (err)
-        return err;
-    }
+  if (!ctx || !name || !r_fd || !r_events)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  *r_fd = ASSUAN_INVALID_FD;
+  *r_events = 0;
+
+  err = parse_socket_name (ctx, name, &srvr_addr, &len, &pf);
+  if (err)
+    return err;
 
   fd = _assuan_sock_new (ctx, pf, SOCK_STREAM, 0);
   if (fd == ASSUAN_INVALID_FD)
     {
       err = _assuan_error (ctx, gpg_err_code_from_syserror ());
-      TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
+      TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect_start", ctx,
               "can't create socket: %s", strerror (errno));
       return err;
     }
 
-  if (_assuan_sock_connect (ctx, fd, srvr_addr, len) == -1)
+  /* Until the greeting has been received there is nobody to say BYE
+     to.  */
+  init_client (ctx, fd, flags);
+  ctx->engine.release = _assuan_client_finish;
+
+  if (_assuan_sock_connect_nonblock (ctx, fd, &srvr_addr.sa, len) == -1)
     {
-      TRACE2 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
-	      "can't connect to `%s': %s\n", name, strerror (errno));
-      _assuan_close (ctx, fd);
-      return _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
+      if (errno != EINPROGRESS)
+        {
+          TRACE2 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect_start", ctx,
+                  "can't connect to `%s': %s\n", name, strerror (errno));
+          _assuan_reset (ctx);
+          return _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
+        }
+      ctx->connect_state = CONNECT_STATE_CONNECTING;
+      *r_fd = fd;
+      *r_events = ASSUAN_IO_WANT_WRITE;
+      return _assuan_error (ctx, GPG_ERR_EAGAIN);
     }
 
-  err = _assuan_connect_finalize (ctx, fd, flags);
+  ctx->connect_state = CONNECT_STATE_GREETING;
+  return assuan_socket_connect_step (ctx, r_fd, r_events);
+}
 
+
+/* Continue the connect started with assuan_socket_connect_start after
+   the descriptor has become ready.  The return values are the same as
+   for assuan_socket_connect_start.  */
+gpg_error_t
+assuan_socket_connect_step (assuan_context_t ctx,
+                            assuan_fd_t *r_fd, unsigned int *r_events)
+{
+  gpg_error_t err = 0;
+  assuan_fd_t fd;
+  unsigned long long io_deadline;
+  unsigned int io_timeout;
+  int res;
+
+  if (!ctx || !r_fd || !r_events)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  *r_fd = ASSUAN_INVALID_FD;
+  *r_events = 0;
+  if (!ctx->connect_state)
+    return _assuan_error (ctx, GPG_ERR_INV_STATE);
+  fd = ctx->inbound.fd;
+
+  if (ctx->connect_state == CONNECT_STATE_CONNECTING)
+    {
+      res = _assuan_poll (ctx, fd, 1, 0);
+      if (!res || (res < 0 && errno == EINTR))
+        {
+          *r_fd = fd;
+          *r_events = ASSUAN_IO_WANT_WRITE;
+          return _assuan_error (ctx, GPG_ERR_EAGAIN);
+        }
+      /* Without a poll hook there is no way to check; the caller
+         says the descriptor is ready, and the connect result tells
+         whether it failed.  */
+      if (res < 0 && errno != ENOSYS)
+        {
+          TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect_step", ctx,
+                  "can't poll: %s\n", strerror (errno));
+          err = _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
+          goto leave;
+        }
+      if (_assuan_sock_connect_result (ctx, fd))
+        {
+          TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect_step", ctx,
+                  "can't connect: %s\n", strerror (errno));
+          err = _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
+          goto leave;
+        }
+      ctx->connect_state = CONNECT_STATE_GREETING;
+    }
+
+  if (!ctx->greeting_pending)
+    {
+      /* The caller waits for the descriptor; waiting in the I/O
+         functions would block it.  */
+      io_deadline = ctx->io_deadline;
+      io_timeout = ctx->io_timeout;
+      ctx->io_deadline = 0;
+      ctx->io_timeout = 0;
+      err = _assuan_read_greeting (ctx, 0);
+      ctx->io_deadline = io_deadline;
+      ctx->io_timeout = io_timeout;
+      if (gpg_err_code (err) == GPG_ERR_EAGAIN)
+        {
+          *r_fd = fd;
+          *r_events = ASSUAN_IO_WANT_READ;
+          return err;
+        }
+    }
+
+ leave:
+  ctx->connect_state = 0;
   if (err)
     _assuan_reset (ctx);
-
+  else
+    ctx->engine.release = _assuan_client_release;
   return err;
 }
@@ -33,6 +33,9 @@
 #ifdef HAVE_UCRED_H
 #include <ucred.h>
 #endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -51,14 +54,23 @@
 #include "debug.h"
 #include "assuan-defs.h"
 
-static gpg_error_t
-accept_connection_bottom (assuan_context_t ctx)
+/* Get the credentials of the peer connected to CTX if this has not
+   yet been done.  This is delayed until they are asked for because
+   many servers never do that.  */
+void
+_assuan_fetch_peercred (assuan_context_t ctx)
 {
   assuan_fd_t fd = ctx->connected_fd;
 
-  TRACE (ctx, ASSUAN_LOG_SYSIO, "accept_connection_bottom", ctx);
+  if (!ctx->peercred_pending)
+    return;
+  ctx->peercred_pending = 0;
+  if (fd == ASSUAN_INVALID_FD)
+    return;
+
+  TRACE1 (ctx, ASSUAN_LOG_SYSIO, "_assuan_fetch_peercred", ctx,
+          "fd=0x%x", fd);
 
-  ctx->peercred_valid = 0;
 #ifdef HAVE_SO_PEERCRED
   {
     struct ucred cr;
@@ -112,6 +124,19 @@ accept_connection_bottom (assuan_context_t ctx)
       }
   }
 #endif
+}
+
+
+static gpg_error_t
+accept_connection_bottom (assuan_context_t ctx)
+{
+  assuan_fd_t fd = ctx->connected_fd;
+
+  TRACE (ctx, ASSUAN_LOG_SYSIO, "accept_connection_bottom", ctx);
+
+  /* See _assuan_fetch_peercred.  */
+  ctx->peercred_valid = 0;
+  ctx->peercred_pending = 1;
 
   ctx->inbound.fd = fd;
   ctx->inbound.eof = 0;
@@ -129,18 +154,45 @@ accept_connection_bottom (assuan_context_t ctx)
 }
 
 
-static gpg_error_t
-accept_connection (assuan_context_t ctx)
+/* Accept a connection on the listening socket of CTX and return the
+   new socket.  If NONBLOCK is set it is put into non-blocking mode.
+   If CLOEXEC is set it is not inherited by child processes.  Returns
+   ASSUAN_INVALID_FD with ERRNO set on error.  */
+static assuan_fd_t
+accept_fd (assuan_context_t ctx, int nonblock, int cloexec)
 {
   assuan_fd_t fd;
   struct sockaddr_un clnt_addr;
   socklen_t len = sizeof clnt_addr;
 
+#ifdef HAVE_ACCEPT4
+  fd = SOCKET2HANDLE(accept4 (HANDLE2SOCKET(ctx->listen_fd),
+                              (struct sockaddr*)&clnt_addr, &len,
+                              (nonblock? SOCK_NONBLOCK : 0)
+                              | (cloexec? SOCK_CLOEXEC : 0)));
+#else
+  fd = SOCKET2HANDLE(accept (HANDLE2SOCKET(ctx->listen_fd),
+                             (struct sockaddr*)&clnt_addr, &len ));
+# ifndef HAVE_W32_SYSTEM
+  if (fd != ASSUAN_INVALID_FD && nonblock)
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+  if (fd != ASSUAN_INVALID_FD && cloexec)
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+# endif
+#endif
+  return fd;
+}
+
+
+static gpg_error_t
+accept_connection (assuan_context_t ctx)
+{
+  assuan_fd_t fd;
+
   TRACE1 (ctx, ASSUAN_LOG_SYSIO, "accept_connection", ctx, 
          "listen_fd=0x%x", ctx->listen_fd);
 
-  fd = SOCKET2HANDLE(accept (HANDLE2SOCKET(ctx->listen_fd), 
-                             (struct sockaddr*)&clnt_addr, &len ));
+  fd = accept_fd (ctx, 0, 0);
   if (fd == ASSUAN_INVALID_FD)
     {
       return _assuan_error (ctx, gpg_err_code_from_syserror ());
@@ -178,6 +230,7 @@ assuan_init_socket_server (assuan_context_t ctx, assuan_fd_t fd,
   ctx->engine.readfnc = _assuan_simple_read;
   ctx->engine.writefnc = _assuan_simple_write;
   ctx->engine.sendfd = NULL;
+  ctx->engine.sendfds = NULL;
   ctx->engine.receivefd = NULL;
   ctx->is_server = 1;
   if (flags & ASSUAN_SOCKET_SERVER_ACCEPTED)
@@ -225,3 +278,125 @@ assuan_set_sock_nonce (assuan_context_t ctx, assuan_sock_nonce_t *nonce)
   if (ctx && nonce)
     ctx->listen_nonce = *nonce;
 }
+
+
+/* Create a new context at R_CTX for the connection FD accepted on
+   the listening socket of CTX.  The new context uses the same hooks as
+   CTX and is initialized with assuan_init_socket_server using FLAGS
+   and ASSUAN_SOCKET_SERVER_ACCEPTED.  FD is not closed on error.  */
+gpg_error_t
+_assuan_new_accepted (assuan_context_t ctx, assuan_fd_t fd,
+                      unsigned int flags, assuan_context_t *r_ctx)
+{
+  gpg_error_t err;
+  assuan_context_t conn_ctx;
+
+  *r_ctx = NULL;
+  err = assuan_new_ext (&conn_ctx, ctx->err_source, &ctx->malloc_hooks,
+                        ctx->log_cb, ctx->log_cb_data);
+  if (err)
+    return err;
+  assuan_ctx_set_system_hooks (conn_ctx, &ctx->system);
+  err = assuan_init_socket_server (conn_ctx, fd,
+                                   ((flags & ~ASSUAN_SOCKET_SERVER_NONBLOCK)
+                                    | ASSUAN_SOCKET_SERVER_ACCEPTED));
+  if (err)
+    {
+      assuan_release (conn_ctx);
+      return err;
+    }
+  *r_ctx = conn_ctx;
+  return 0;
+}
+
+
+/* Accept all connections pending on the listening socket of the
+   socket server CTX.  For each connection a new context is created
+   with the same hooks as CTX and initialized with
+   assuan_init_socket_server using FLAGS and
+   ASSUAN_SOCKET_SERVER_ACCEPTED.  It is then passed to CB along with
+   CB_VALUE; CB takes ownership of the context and usually registers
+   the commands and calls assuan_accept.  If CB returns an error, the
+   context is released and the error is returned; connections still
+   pending are left for the next call.  If FLAGS has
+   ASSUAN_SOCKET_SERVER_NONBLOCK set, the new connections are
+   non-blocking.  This function should be called when the listening
+   socket is readable; it blocks only if that is not the case and the
+   socket is blocking.  The number of accepted connections is stored
+   at R_COUNT if it is not NULL.  */
+gpg_error_t
+assuan_accept_all (assuan_context_t ctx, assuan_accept_cb_t cb,
+                   void *cb_value, unsigned int flags,
+                   unsigned int *r_count)
+{
+  gpg_error_t err = 0;
+  assuan_context_t conn_ctx;
+  assuan_fd_t fd;
+  unsigned int count = 0;
+  int listen_nonblock = 0;
+
+  TRACE_BEG2 (ctx, ASSUAN_LOG_CTX, "assuan_accept_all", ctx,
+	      "cb=%p, flags=0x%x", cb, flags);
+
+  if (r_count)
+    *r_count = 0;
+  if (!ctx || !cb || !ctx->is_server || ctx->listen_fd == ASSUAN_INVALID_FD
+      || (flags & ASSUAN_SOCKET_SERVER_ACCEPTED))
+    return TRACE_ERR (GPG_ERR_ASS_INV_VALUE);
+
+#ifndef HAVE_W32_SYSTEM
+  listen_nonblock = !!(fcntl (HANDLE2SOCKET (ctx->listen_fd), F_GETFL)
+                       & O_NONBLOCK);
+#endif
+
+  for (;;)
+    {
+      /* Don't block on a blocking socket once the pending connections
+         are used up.  */
+      if (count && !listen_nonblock
+          && _assuan_poll (ctx, ctx->listen_fd, 0, 0) <= 0)
+        break;
+
+      fd = accept_fd (ctx, !!(flags & ASSUAN_SOCKET_SERVER_NONBLOCK), 1);
+      if (fd == ASSUAN_INVALID_FD)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+          /* The connection has been aborted by the peer while
+             pending; try the next one.  */
+          if (errno == ECONNABORTED)
+            continue;
+          err = _assuan_error (ctx, gpg_err_code_from_syserror ());
+          break;
+        }
+      if (_assuan_sock_check_nonce (ctx, fd, &ctx->listen_nonce))
+        {
+          _assuan_close (ctx, fd);
+          continue;
+        }
+
+      err = _assuan_new_accepted (ctx, fd, flags, &conn_ctx);
+      if (err)
+        {
+          _assuan_close (ctx, fd);
+          break;
+        }
+      count++;
+      err = cb (cb_value, conn_ctx);
+      if (err)
+        {
+          /* Without an assuan_accept the socket is not yet owned by
+             the context.  */
+          if (conn_ctx->inbound.fd == ASSUAN_INVALID_FD)
+            _assuan_close (ctx, fd);
+          assuan_release (conn_ctx);
+          break;
+        }
+    }
+
+  if (r_count)
+    *r_count = count;
+  return TRACE_ERR (err);
+}
@@ -24,6 +24,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #ifdef HAVE_W32_SYSTEM
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
@@ -36,6 +38,9 @@
 # include <sys/socket.h>
 # include <netinet/in.h>
 # include <arpa/inet.h>
+# ifdef HAVE_GETADDRINFO
+#  include <netdb.h>
+# endif
 #endif
 #include <errno.h>
 #ifdef HAVE_SYS_STAT_H
@@ -124,6 +129,10 @@ static assuan_context_t sock_ctx;
    is the port to be used. */
 static unsigned short tor_mode;
 
+/* Set to send the SOCKS5 CONNECT request without waiting for the
+   method negotiation.  */
+static int socks_optimistic;
+
 
 
 #ifdef HAVE_W32_SYSTEM
@@ -407,9 +416,111 @@ read_port_and_nonce (const char *fname, unsigned short *port, char *nonce,
 #endif /*HAVE_W32_SYSTEM*/
 
 
-#ifndef HAVE_W32_SYSTEM
-/* Find a redirected socket name for fname and return a malloced setup
-   filled sockaddr.  If this does not work out NULL is returned and
+#if !defined(HAVE_W32_SYSTEM) && defined(HAVE_STAT)
+/* A process-wide cache of the socket names read from redirection
+   files.  An entry is valid as long as the file has the same inode,
+   size and times.  Environment variables in the names are expanded
+   on each use.  */
+#define REDIR_CACHE_SIZE 8
+static struct
+{
+  char *fname;     /* Malloced name of the redirection file or NULL.  */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+  long mtime_ns;   /* Nanoseconds if available, else 0.  */
+  long ctime_ns;
+  char name[512];  /* The unexpanded socket name.  */
+} redir_cache[REDIR_CACHE_SIZE];
+static unsigned int redir_cache_next;
+GPGRT_LOCK_DEFINE (redir_cache_lock);
+
+/* A file rewritten within the same second keeps its times in
+   seconds; use the nanoseconds if the system has them.  */
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+# define STAT_MTIME_NS(s) ((s)->st_mtim.tv_nsec)
+#else
+# define STAT_MTIME_NS(s) 0L
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC
+# define STAT_CTIME_NS(s) ((s)->st_ctim.tv_nsec)
+#else
+# define STAT_CTIME_NS(s) 0L
+#endif
+
+
+/* Copy the cached socket name for FNAME with STATBUF to NAME, which
+   has a size of 512 bytes.  Returns true on success.  */
+static int
+redir_cache_get (const char *fname, const struct stat *statbuf, char *name)
+{
+  int i;
+  int found = 0;
+
+  gpgrt_lock_lock (&redir_cache_lock);
+  for (i=0; i < REDIR_CACHE_SIZE; i++)
+    if (redir_cache[i].fname
+        && redir_cache[i].dev == statbuf->st_dev
+        && redir_cache[i].ino == statbuf->st_ino
+        && redir_cache[i].size == statbuf->st_size
+        && redir_cache[i].mtime == statbuf->st_mtime
+        && redir_cache[i].ctime == statbuf->st_ctime
+        && redir_cache[i].mtime_ns == STAT_MTIME_NS (statbuf)
+        && redir_cache[i].ctime_ns == STAT_CTIME_NS (statbuf)
+        && !strcmp (redir_cache[i].fname, fname))
+      {
+        strcpy (name, redir_cache[i].name);
+        found = 1;
+        break;
+      }
+  gpgrt_lock_unlock (&redir_cache_lock);
+  return found;
+}
+
+
+/* Store the socket NAME read from the redirection file FNAME with
+   STATBUF in the cache.  An older entry for FNAME is replaced, else
+   the oldest entry.  Failures are ignored.  */
+static void
+redir_cache_put (const char *fname, const struct stat *statbuf,
+                 const char *name)
+{
+  int i;
+  char *fnamecopy;
+
+  if (strlen (name) >= sizeof redir_cache[0].name)
+    return;
+  fnamecopy = strdup (fname);
+  if (!fnamecopy)
+    return;
+
+  gpgrt_lock_lock (&redir_cache_lock);
+  for (i=0; i < REDIR_CACHE_SIZE; i++)
+    if (redir_cache[i].fname && !strcmp (redir_cache[i].fname, fname))
+      break;
+  if (i == REDIR_CACHE_SIZE)
+    {
+      i = redir_cache_next;
+      redir_cache_next = (redir_cache_next + 1) % REDIR_CACHE_SIZE;
+    }
+  free (redir_cache[i].fname);
+  redir_cache[i].fname = fnamecopy;
+  redir_cache[i].dev = statbuf->st_dev;
+  redir_cache[i].ino = statbuf->st_ino;
+  redir_cache[i].size = statbuf->st_size;
+  redir_cache[i].mtime = statbuf->st_mtime;
+  redir_cache[i].ctime = statbuf->st_ctime;
+  redir_cache[i].mtime_ns = STAT_MTIME_NS (statbuf);
+  redir_cache[i].ctime_ns = STAT_CTIME_NS (statbuf);
+  strcpy (redir_cache[i].name, name);
+  gpgrt_lock_unlock (&redir_cache_lock);
+}
+
+
+/* Find a redirected socket name for FNAME, which has been stat-ed
+   into STATBUF, and return a malloced setup filled sockaddr.  If this does not work out NULL is returned and
    ERRNO is set.  If the file seems to be a redirect True is stored at
    R_REDIRECT.  Note that this function uses the standard malloc and
    not the assuan wrapped one.  The format of the file is:
@@ -426,9 +537,11 @@ read_port_and_nonce (const char *fname, unsigned short *port, char *nonce,
 
    The use of an absolute NAME is strongly suggested.  The length of
    the file is limited to 511 bytes which is more than sufficient for
-   that common value of 107 for sun_path.  */
+   that common value of 107 for sun_path.  The name is taken from the
+   cache if the file has not changed.  */
 static struct sockaddr_un *
-eval_redirection (const char *fname, int *r_redirect)
+eval_redirection (const char *fname, const struct stat *statbuf,
+                  int *r_redirect)
 {
   FILE *fp;
   char buffer[512], *name;
@@ -439,30 +552,36 @@ eval_redirection (const char *fname, int *r_redirect)
 
   *r_redirect = 0;
 
-  fp = fopen (fname, "rb");
-  if (!fp)
-    return NULL;
-  n = fread (buffer, 1, sizeof buffer - 1, fp);
-  fclose (fp);
-  if (!n)
-    {
-      gpg_err_set_errno (ENOENT);
-      return NULL;
-    }
-  buffer[n] = 0;
-
-  /* Check that it is a redirection file.  We also check that the
-     first byte of the name is not a LF because that would lead to an
-     zero length name. */
-  if (n < 17 || buffer[n-1] != '\n'
-      || memcmp (buffer, "%Assuan%\nsocket=", 16)
-      || buffer[16] == '\n')
+  if (redir_cache_get (fname, statbuf, buffer))
+    name = buffer;
+  else
     {
-      gpg_err_set_errno (EINVAL);
-      return NULL;
+      fp = fopen (fname, "rb");
+      if (!fp)
+        return NULL;
+      n = fread (buffer, 1, sizeof buffer - 1, fp);
+      fclose (fp);
+      if (!n)
+        {
+          gpg_err_set_errno (ENOENT);
+          return NULL;
+        }
+      buffer[n] = 0;
+
+      /* Check that it is a redirection file.  We also check that the
+         first byte of the name is not a LF because that would lead to
+         an zero length name. */
+      if (n < 17 || buffer[n-1] != '\n'
+          || memcmp (buffer, "%Assuan%\nsocket=", 16)
+          || buffer[16] == '\n')
+        {
+          gpg_err_set_errno (EINVAL);
+          return NULL;
+        }
+      buffer[n-1] = 0;
+      name = buffer + 16;
+      redir_cache_put (fname, statbuf, name);
     }
-  buffer[n-1] = 0;
-  name = buffer + 16;
 
   *r_redirect = 1;
 
@@ -515,7 +634,7 @@ eval_redirection (const char *fname, int *r_redirect)
 
   return addr;
 }
-#endif /*!HAVE_W32_SYSTEM*/
+#endif /*!HAVE_W32_SYSTEM && HAVE_STAT*/
 
 
 
@@ -587,6 +706,16 @@ _assuan_sock_set_flag (assuan_context_t ctx, assuan_fd_t sockfd,
           return -1;
         }
     }
+  else if (!strcmp (name, "socks-optimistic"))
+    {
+      /* This is a global flag.  */
+      if (sockfd != ASSUAN_INVALID_FD)
+        {
+          gpg_err_set_errno (EINVAL);
+          return -1;
+        }
+      socks_optimistic = !!value;
+    }
   else
     {
       gpg_err_set_errno (EINVAL);
@@ -620,6 +749,10 @@ _assuan_sock_get_flag (assuan_context_t ctx, assuan_fd_t sockfd,
     {
       *r_value = tor_mode == SOCKS_PORT;
     }
+  else if (!strcmp (name, "socks-optimistic"))
+    {
+      *r_value = socks_optimistic;
+    }
   else
     {
       gpg_err_set_errno (EINVAL);
@@ -645,7 +778,17 @@ do_readn (assuan_context_t ctx, assuan_fd_t sockfd,
       if (n < 0 && errno == EINTR)
         ;
       else if (n < 0 && errno == EAGAIN)
-        _assuan_usleep (ctx, 100000); /* 100ms */
+        {
+          gpg_error_t err = _assuan_wait_fd (ctx, sockfd, 0);
+
+          if (err)
+            {
+              gpg_err_set_errno (gpg_err_code (err) == GPG_ERR_TIMEOUT
+                                 ? ETIMEDOUT
+                                 : gpg_err_code_to_errno (gpg_err_code (err)));
+              return -1;
+            }
+        }
       else if (n < 0)
         return -1;
       else if (!n)
@@ -684,21 +827,70 @@ do_writen (assuan_context_t ctx, assuan_fd_t sockfd,
 }
 
 
-/* Connect using the SOCKS5 protocol. */
+/* Store the SOCKS5 CONNECT request (rfc-1928, 4) for HOSTNAME of
+   length HOSTNAMELEN and HOSTPORT, or if HOSTNAME is NULL for ADDR, at
+   BUFFER and return its length.  BUFFER must have space for at least
+   262 bytes.  */
+static size_t
+socks5_connect_request (unsigned char *buffer,
+                        const char *hostname, size_t hostnamelen,
+                        unsigned short hostport, struct sockaddr *addr)
+{
+  struct sockaddr_in6 *addr_in6;
+  struct sockaddr_in  *addr_in;
+  size_t buflen;
+
+  buffer[0] = 5; /* VER  */
+  buffer[1] = 1; /* CMD = CONNECT  */
+  buffer[2] = 0; /* RSV  */
+  if (hostname)
+    {
+      buffer[3] = 3; /* ATYP = DOMAINNAME */
+      buflen = 4;
+      buffer[buflen++] = hostnamelen;
+      memcpy (buffer+buflen, hostname, hostnamelen);
+      buflen += hostnamelen;
+      buffer[buflen++] = (hostport >> 8); /* DST.PORT */
+      buffer[buflen++] = hostport;
+    }
+  else if (addr->sa_family == AF_INET6)
+    {
+      addr_in6 = (struct sockaddr_in6 *)addr;
+
+      buffer[3] = 4; /* ATYP = IPv6 */
+      memcpy (buffer+ 4, &addr_in6->sin6_addr.s6_addr, 16); /* DST.ADDR */
+      memcpy (buffer+20, &addr_in6->sin6_port, 2);          /* DST.PORT */
+      buflen = 22;
+    }
+  else
+    {
+      addr_in = (struct sockaddr_in *)addr;
+
+      buffer[3] = 1; /* ATYP = IPv4 */
+      memcpy (buffer+4, &addr_in->sin_addr.s_addr, 4); /* DST.ADDR */
+      memcpy (buffer+8, &addr_in->sin_port, 2);        /* DST.PORT */
+      buflen = 10;
+    }
+  return buflen;
+}
+
+
+/* Connect using the SOCKS5 protocol.  If OPTIMISTIC is set and no
+   CREDENTIALS are given, the CONNECT request is sent right away with
+   the method negotiation instead of waiting for the answer of the
+   proxy; this saves one round trip.  */
 static int
 socks5_connect (assuan_context_t ctx, assuan_fd_t sock,
                 unsigned short socksport,
                 const char *credentials,
                 const char *hostname, unsigned short hostport,
-                struct sockaddr *addr, socklen_t length)
+                struct sockaddr *addr, socklen_t length, int optimistic)
 {
   int ret;
   /* struct sockaddr_in6 proxyaddr_in6; */
   struct sockaddr_in  proxyaddr_in;
   struct sockaddr *proxyaddr;
   size_t proxyaddrlen;
-  struct sockaddr_in6 *addr_in6;
-  struct sockaddr_in  *addr_in;
   unsigned char buffer[22+512]; /* The extra 512 gives enough space
                                    for username/password or the
                                    hostname. */
@@ -750,8 +942,17 @@ socks5_connect (assuan_context_t ctx, assuan_fd_t sock,
     method = 0; /* Method: No authentication required. */
   buffer[2] = method;
 
+  /* The request can't be sent early if we need to authenticate or if
+     we only check for the proxy.  */
+  if (credentials || (hostname && !*hostname && !hostport))
+    optimistic = 0;
+
   /* Negotiate method.  */
-  ret = do_writen (ctx, sock, buffer, 3);
+  buflen = 3;
+  if (optimistic)
+    buflen += socks5_connect_request (buffer+3, hostname, hostnamelen,
+                                      hostport, addr);
+  ret = do_writen (ctx, sock, buffer, buflen);
   if (ret)
     return ret;
   ret = do_readn (ctx, sock, buffer, 2);
@@ -822,40 +1023,14 @@ socks5_connect (assuan_context_t ctx, assuan_fd_t sock,
     }
 
   /* Send request details (rfc-1928, 4).  */
-  buffer[0] = 5; /* VER  */
-  buffer[1] = 1; /* CMD = CONNECT  */
-  buffer[2] = 0; /* RSV  */
-  if (hostname)
-    {
-      buffer[3] = 3; /* ATYP = DOMAINNAME */
-      buflen = 4;
-      buffer[buflen++] = hostnamelen;
-      memcpy (buffer+buflen, hostname, hostnamelen);
-      buflen += hostnamelen;
-      buffer[buflen++] = (hostport >> 8); /* DST.PORT */
-      buffer[buflen++] = hostport;
-    }
-  else if (addr->sa_family == AF_INET6)
+  if (!optimistic)
     {
-      addr_in6 = (struct sockaddr_in6 *)addr;
-
-      buffer[3] = 4; /* ATYP = IPv6 */
-      memcpy (buffer+ 4, &addr_in6->sin6_addr.s6_addr, 16); /* DST.ADDR */
-      memcpy (buffer+20, &addr_in6->sin6_port, 2);          /* DST.PORT */
-      buflen = 22;
-    }
-  else
-    {
-      addr_in = (struct sockaddr_in *)addr;
-
-      buffer[3] = 1; /* ATYP = IPv4 */
-      memcpy (buffer+4, &addr_in->sin_addr.s_addr, 4); /* DST.ADDR */
-      memcpy (buffer+8, &addr_in->sin_port, 2);        /* DST.PORT */
-      buflen = 10;
+      buflen = socks5_connect_request (buffer, hostname, hostnamelen,
+                                       hostport, addr);
+      ret = do_writen (ctx, sock, buffer, buflen);
+      if (ret)
+        return ret;
     }
-  ret = do_writen (ctx, sock, buffer, buflen);
-  if (ret)
-    return ret;
   ret = do_readn (ctx, sock, buffer, 10 /* Length for IPv4 */);
   if (ret)
     return ret;
@@ -951,6 +1126,28 @@ use_socks (struct sockaddr *addr)
 }
 
 
+#ifdef HAVE_ABSTRACT_SOCKETS
+/* Return the length of the address ADDR of size ADDRLEN.  A socket
+   in the abstract namespace, which is indicated by a leading Nul in
+   its name, is only identified by the bytes covered by its length;
+   thus the trailing Nuls are not counted.  */
+static int
+abstract_addrlen (struct sockaddr *addr, int addrlen)
+{
+  struct sockaddr_un *unaddr = (struct sockaddr_un *)addr;
+  size_t n;
+
+  if (addr->sa_family != AF_LOCAL
+      || addrlen < (int)offsetof (struct sockaddr_un, sun_path) + 2
+      || unaddr->sun_path[0] || !unaddr->sun_path[1])
+    return addrlen;
+  n = addrlen - offsetof (struct sockaddr_un, sun_path) - 1;
+  return offsetof (struct sockaddr_un, sun_path) + 1
+    + strnlen (unaddr->sun_path + 1, n);
+}
+#endif /*HAVE_ABSTRACT_SOCKETS*/
+
+
 int
 _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
 		      struct sockaddr *addr, int addrlen)
@@ -1011,13 +1208,16 @@ _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
   else if (use_socks (addr))
     {
       return socks5_connect (ctx, sockfd, tor_mode,
-                             NULL, NULL, 0, addr, addrlen);
+                             NULL, NULL, 0, addr, addrlen, socks_optimistic);
     }
   else
     {
       return _assuan_connect (ctx, HANDLE2SOCKET (sockfd), addr, addrlen);
     }
 #else
+# ifdef HAVE_ABSTRACT_SOCKETS
+  addrlen = abstract_addrlen (addr, addrlen);
+# endif
 # if HAVE_STAT
   if (addr->sa_family == AF_LOCAL || addr->sa_family == AF_UNIX)
     {
@@ -1026,7 +1226,8 @@ _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
       int redirect, res;
 
       unaddr = (struct sockaddr_un *)addr;
-      if (!stat (unaddr->sun_path, &statbuf)
+      if (unaddr->sun_path[0]
+          && !stat (unaddr->sun_path, &statbuf)
           && !S_ISSOCK (statbuf.st_mode)
           && S_ISREG (statbuf.st_mode))
         {
@@ -1035,7 +1236,7 @@ _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
              socket file.  This can be used to use sockets on file
              systems which do not support sockets or if for example a
              home directory is shared by several machines.  */
-          unaddr = eval_redirection (unaddr->sun_path, &redirect);
+          unaddr = eval_redirection (unaddr->sun_path, &statbuf, &redirect);
           if (unaddr)
             {
               res = _assuan_connect (ctx, sockfd, (struct sockaddr *)unaddr,
@@ -1054,7 +1255,7 @@ _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
   if (use_socks (addr))
     {
       return socks5_connect (ctx, sockfd, tor_mode,
-                             NULL, NULL, 0, addr, addrlen);
+                             NULL, NULL, 0, addr, addrlen, socks_optimistic);
     }
   else
     {
@@ -1064,9 +1265,360 @@ _assuan_sock_connect (assuan_context_t ctx, assuan_fd_t sockfd,
 }
 
 
-/* Connect to HOST specified as host name on PORT.  The current
-   implementation requires that either the flags ASSUAN_SOCK_SOCKS or
-   ASSUAN_SOCK_TOR are given in FLAGS.  On success a new socket is
+/* Start connecting SOCKFD to ADDR without blocking.  Returns 0 if
+   the connection has been established, -1 with ERRNO set to
+   EINPROGRESS if it is in progress (see _assuan_sock_connect_result),
+   or -1 with ERRNO set on error.  Connections which need a local
+   handshake (the Windows socket emulation or a SOCKS proxy) are done
+   in a blocking way; the socket is made non-blocking afterwards.  */
+int
+_assuan_sock_connect_nonblock (assuan_context_t ctx, assuan_fd_t sockfd,
+                               struct sockaddr *addr, int addrlen)
+{
+#ifdef HAVE_W32_SYSTEM
+  unsigned long nonblock = 1;
+
+  if (_assuan_sock_connect (ctx, sockfd, addr, addrlen))
+    return -1;
+  if (ioctlsocket (HANDLE2SOCKET (sockfd), FIONBIO, &nonblock))
+    {
+      gpg_err_set_errno (_assuan_sock_wsa2errno (WSAGetLastError ()));
+      return -1;
+    }
+  return 0;
+#else
+  int blocking = use_socks (addr);
+
+  if (!blocking
+      && fcntl (sockfd, F_SETFL, fcntl (sockfd, F_GETFL) | O_NONBLOCK))
+    return -1;
+  if (_assuan_sock_connect (ctx, sockfd, addr, addrlen))
+    return -1;
+  if (blocking
+      && fcntl (sockfd, F_SETFL, fcntl (sockfd, F_GETFL) | O_NONBLOCK))
+    return -1;
+  return 0;
+#endif
+}
+
+
+/* Return the result of a connect started with
+   _assuan_sock_connect_nonblock once SOCKFD is writable: 0 on success
+   or -1 with ERRNO set.  */
+int
+_assuan_sock_connect_result (assuan_context_t ctx, assuan_fd_t sockfd)
+{
+  int err = 0;
+#ifdef HAVE_W32_SYSTEM
+  int len = sizeof err;
+#else
+  socklen_t len = sizeof err;
+#endif
+
+  (void)ctx;
+
+  if (getsockopt (HANDLE2SOCKET (sockfd), SOL_SOCKET, SO_ERROR,
+                  (void *)&err, &len))
+    return -1;
+  if (err)
+    {
+      gpg_err_set_errno (err);
+      return -1;
+    }
+  return 0;
+}
+
+
+#if defined(HAVE_GETADDRINFO) && !defined(HAVE_W32_SYSTEM)
+/* Direct connections to a host name try the addresses of the host in
+   parallel with staggered starts as described in RFC 8305 ("Happy
+   Eyeballs").  The addresses are kept in a small process-wide cache
+   for a few seconds.  */
+#define RESOLVE_MAX_ADDRS     8
+#define RESOLVE_CACHE_SIZE    8
+#define RESOLVE_CACHE_TTL     10   /* Seconds.  */
+#define CONNECT_ATTEMPT_DELAY 250  /* Milliseconds.  */
+#define CONNECT_TIMEOUT       30   /* Seconds, if no I/O timeout is set.  */
+#define CONNECT_POLL_SLICE    25   /* Milliseconds.  */
+
+struct resolved_s
+{
+  int naddrs;
+  struct sockaddr_storage addrs[RESOLVE_MAX_ADDRS];
+  socklen_t addrlens[RESOLVE_MAX_ADDRS];
+};
+
+static struct
+{
+  char *host;                    /* Malloced host name or NULL.  */
+  unsigned long long expires;    /* See _assuan_timestamp.  */
+  struct resolved_s resolved;
+} resolve_cache[RESOLVE_CACHE_SIZE];
+static unsigned int resolve_cache_next;
+GPGRT_LOCK_DEFINE (resolve_cache_lock);
+
+
+/* Resolve HOST into R.  The addresses are ordered with alternating
+   address families, starting with the first family returned by the
+   resolver.  Returns 0 on success or -1 with ERRNO set.  */
+static int
+resolve_host (const char *host, struct resolved_s *r)
+{
+  struct addrinfo hints, *res, *ai, *a, *b;
+  unsigned long long now = _assuan_timestamp ();
+  int i, rc, family;
+  char *hostcopy;
+
+  gpgrt_lock_lock (&resolve_cache_lock);
+  for (i=0; i < RESOLVE_CACHE_SIZE; i++)
+    if (resolve_cache[i].host && resolve_cache[i].expires > now
+        && !strcmp (resolve_cache[i].host, host))
+      {
+        *r = resolve_cache[i].resolved;
+        gpgrt_lock_unlock (&resolve_cache_lock);
+        return 0;
+      }
+  gpgrt_lock_unlock (&resolve_cache_lock);
+
+  memset (&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  rc = getaddrinfo (host, NULL, &hints, &res);
+  if (rc)
+    {
+      gpg_err_set_errno (rc == EAI_SYSTEM? errno : EHOSTUNREACH);
+      return -1;
+    }
+
+  /* Take the addresses of the first family and of the other family
+     in turn as long as both are available.  */
+  r->naddrs = 0;
+  family = res->ai_family;
+  a = b = res;
+  while ((a || b) && r->naddrs < RESOLVE_MAX_ADDRS)
+    {
+      while (a && a->ai_family != family)
+        a = a->ai_next;
+      while (b && (b->ai_family == family
+                   || (b->ai_family != AF_INET && b->ai_family != AF_INET6)))
+        b = b->ai_next;
+      for (i=0; i < 2; i++)
+        {
+          ai = i? b : a;
+          if (ai && r->naddrs < RESOLVE_MAX_ADDRS
+              && ai->ai_addrlen <= sizeof r->addrs[0])
+            {
+              memcpy (&r->addrs[r->naddrs], ai->ai_addr, ai->ai_addrlen);
+              r->addrlens[r->naddrs++] = ai->ai_addrlen;
+            }
+        }
+      if (a)
+        a = a->ai_next;
+      if (b)
+        b = b->ai_next;
+    }
+  freeaddrinfo (res);
+  if (!r->naddrs)
+    {
+      gpg_err_set_errno (EHOSTUNREACH);
+      return -1;
+    }
+
+  hostcopy = strdup (host);
+  if (hostcopy)
+    {
+      gpgrt_lock_lock (&resolve_cache_lock);
+      i = resolve_cache_next;
+      resolve_cache_next = (resolve_cache_next + 1) % RESOLVE_CACHE_SIZE;
+      free (resolve_cache[i].host);
+      resolve_cache[i].host = hostcopy;
+      resolve_cache[i].expires = now + RESOLVE_CACHE_TTL * 1000000ULL;
+      resolve_cache[i].resolved = *r;
+      gpgrt_lock_unlock (&resolve_cache_lock);
+    }
+  return 0;
+}
+
+
+/* Start a non-blocking connect to ADDR of length ADDRLEN.  Returns
+   the socket and stores true at R_DONE if the connection has already
+   been established.  On error ASSUAN_INVALID_FD is returned and ERRNO
+   set.  */
+static assuan_fd_t
+start_connect (assuan_context_t ctx, struct sockaddr *addr,
+               socklen_t addrlen, int *r_done)
+{
+  assuan_fd_t fd;
+  int save_errno;
+
+  *r_done = 0;
+  fd = _assuan_sock_new (ctx, addr->sa_family, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    return fd;
+  if (!fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK))
+    {
+      if (!_assuan_connect (ctx, fd, addr, addrlen))
+        {
+          *r_done = 1;
+          return fd;
+        }
+      if (errno == EINPROGRESS)
+        return fd;
+    }
+  save_errno = errno;
+  _assuan_close (ctx, fd);
+  gpg_err_set_errno (save_errno);
+  return ASSUAN_INVALID_FD;
+}
+
+
+/* Wait up to TIMEOUT milliseconds for the connect on FD to complete.
+   Returns as _assuan_poll.  */
+static int
+wait_connect (assuan_context_t ctx, assuan_fd_t fd, int timeout)
+{
+  int res;
+
+  res = _assuan_poll (ctx, fd, 1, timeout);
+  if (res < 0 && errno == ENOSYS)
+    {
+      /* The system hooks can't wait for FD; sleep instead and only
+         check it.  */
+      if (timeout > 0)
+        _assuan_usleep (ctx, timeout * 1000);
+      res = __assuan_poll (ctx, fd, 1, 0);
+    }
+  return res;
+}
+
+
+/* Connect to PORT at one of the addresses in R.  A new attempt is
+   started whenever the previous one failed or has not succeeded
+   within CONNECT_ATTEMPT_DELAY.  The first established connection is
+   returned as a blocking socket; the others are closed.  On error
+   ASSUAN_INVALID_FD is returned and ERRNO set to the error of the
+   last attempt, or to ETIMEDOUT if no attempt succeeded within the
+   I/O timeout of CTX or, without one, CONNECT_TIMEOUT.  */
+static assuan_fd_t
+happy_eyeballs_connect (assuan_context_t ctx, struct resolved_s *r,
+                        unsigned short port)
+{
+  assuan_fd_t fds[RESOLVE_MAX_ADDRS];
+  assuan_fd_t fd = ASSUAN_INVALID_FD;
+  unsigned int nfds = 0;
+  unsigned int i;
+  int next = 0;
+  int last_errno = ECONNREFUSED;
+  unsigned long long next_start = 0;
+  unsigned long long deadline;
+  int done;
+  int res;
+
+  deadline = _assuan_io_deadline (ctx);
+  if (!deadline)
+    deadline = _assuan_timestamp () + CONNECT_TIMEOUT * 1000000ULL;
+
+  while (fd == ASSUAN_INVALID_FD)
+    {
+      unsigned long long now = _assuan_timestamp ();
+      unsigned long long wait_until;
+      int timeout;
+
+      if (next < r->naddrs && (!nfds || now >= next_start))
+        {
+          struct sockaddr *addr = (struct sockaddr *)&r->addrs[next];
+
+          if (addr->sa_family == AF_INET6)
+            ((struct sockaddr_in6 *)addr)->sin6_port = htons (port);
+          else
+            ((struct sockaddr_in *)addr)->sin_port = htons (port);
+          fds[nfds] = start_connect (ctx, addr, r->addrlens[next], &done);
+          next++;
+          if (fds[nfds] == ASSUAN_INVALID_FD)
+            {
+              last_errno = errno;
+              continue;
+            }
+          if (done)
+            {
+              fd = fds[nfds];
+              break;
+            }
+          nfds++;
+          next_start = now + CONNECT_ATTEMPT_DELAY * 1000;
+        }
+      if (!nfds)
+        break;  /* All attempts failed.  */
+
+      /* Wait for the pending attempts until the next one is due.  The
+         system hooks wait for one descriptor only, thus the older
+         attempts are checked without waiting and only the newest
+         one is waited for; in slices if there are others.  */
+      now = _assuan_timestamp ();
+      if (now >= deadline)
+        {
+          last_errno = ETIMEDOUT;
+          break;
+        }
+      wait_until = deadline;
+      if (next < r->naddrs && next_start < wait_until)
+        wait_until = next_start;
+      timeout = now >= wait_until? 0 : (wait_until - now + 999) / 1000;
+      if (nfds > 1 && timeout > CONNECT_POLL_SLICE)
+        timeout = CONNECT_POLL_SLICE;
+
+      res = 0;
+      for (i=0; i < nfds; i++)
+        {
+          res = wait_connect (ctx, fds[i], i == nfds - 1? timeout : 0);
+          if (res)
+            break;
+        }
+      if (res < 0 && errno != EINTR)
+        {
+          last_errno = errno;
+          break;
+        }
+      if (res <= 0)
+        continue;  /* Timeout - check again or start the next attempt.  */
+
+      if (!_assuan_sock_connect_result (ctx, fds[i]))
+        {
+          fd = fds[i];
+          fds[i] = fds[--nfds];
+          break;
+        }
+      /* This attempt failed; start the next one right away.  */
+      last_errno = errno;
+      _assuan_close (ctx, fds[i]);
+      fds[i] = fds[--nfds];
+      next_start = 0;
+    }
+
+  for (i=0; i < nfds; i++)
+    _assuan_close (ctx, fds[i]);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      gpg_err_set_errno (last_errno);
+      return fd;
+    }
+  if (fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK))
+    {
+      last_errno = errno;
+      _assuan_close (ctx, fd);
+      gpg_err_set_errno (last_errno);
+      return ASSUAN_INVALID_FD;
+    }
+  return fd;
+}
+#endif /*HAVE_GETADDRINFO && !HAVE_W32_SYSTEM*/
+
+
+/* Connect to HOST specified as host name on PORT.  If the flags
+   ASSUAN_SOCK_SOCKS or ASSUAN_SOCK_TOR are given in FLAGS or the Tor
+   mode is enabled, the connection is made through the proxy;
+   otherwise HOST is resolved and its addresses are tried in parallel
+   (this is not supported on Windows).  On success a new socket is
    returned; on error ASSUAN_INVALID_FD is returned and ERRNO set.  If
    CREDENTIALS is not NULL, it is a string used for password based
    authentication.  Username and password are separated by a colon.
@@ -1085,10 +1637,25 @@ _assuan_sock_connect_byname (assuan_context_t ctx, const char *host,
     socksport = TOR_PORT;
   else if ((flags & ASSUAN_SOCK_SOCKS))
     socksport = SOCKS_PORT;
+  else if (tor_mode)
+    socksport = tor_mode;  /* Never bypass the proxy.  */
   else
     {
+#if defined(HAVE_GETADDRINFO) && !defined(HAVE_W32_SYSTEM)
+      struct resolved_s resolved;
+
+      if (!host || !*host || !port)
+        {
+          gpg_err_set_errno (EINVAL);
+          return ASSUAN_INVALID_FD;
+        }
+      if (resolve_host (host, &resolved))
+        return ASSUAN_INVALID_FD;
+      return happy_eyeballs_connect (ctx, &resolved, port);
+#else
       gpg_err_set_errno (ENOTSUP);
       return ASSUAN_INVALID_FD;
+#endif
     }
 
   if (host && !*host)
@@ -1107,7 +1674,8 @@ _assuan_sock_connect_byname (assuan_context_t ctx, const char *host,
      that we can't pass NULL directly as this indicates IP address
      mode to the called function.  */
   if (socks5_connect (ctx, fd, socksport,
-                      credentials, host? host:"", port, NULL, 0))
+                      credentials, host? host:"", port, NULL, 0,
+                      socks_optimistic || (flags & ASSUAN_SOCK_OPTIMISTIC)))
     {
       int save_errno = errno;
       assuan_sock_close (fd);
@@ -1208,14 +1776,18 @@ _assuan_sock_bind (assuan_context_t ctx, assuan_fd_t sockfd,
       return res;
     }
 #else
+# ifdef HAVE_ABSTRACT_SOCKETS
+  addrlen = abstract_addrlen (addr, addrlen);
+# endif
   return bind (sockfd, addr, addrlen);
 #endif
 }
 
 
 /* Setup the ADDR structure for a Unix domain socket with the socket
-   name FNAME.  If this is a redirected socket and R_REDIRECTED is not
-   NULL, it will be setup for the real socket.  Returns 0 on success
+   name FNAME.  On Linux, a name starting with '@' denotes a socket
+   in the abstract namespace.  If this is a redirected socket and
+   R_REDIRECTED is not NULL, it will be setup for the real socket.  Returns 0 on success
    and stores 1 at R_REDIRECTED if it is a redirected socket.  On
    error -1 is returned and ERRNO will be set.  */
 int
@@ -1230,6 +1802,22 @@ _assuan_sock_set_sockaddr_un (const char *fname, struct sockaddr *addr,
   if (r_redirected)
     *r_redirected = 0;
 
+#ifdef HAVE_ABSTRACT_SOCKETS
+  if (*fname == '@' && fname[1])
+    {
+      /* A name in the abstract namespace.  */
+      if (strlen (fname)+1 > sizeof unaddr->sun_path)
+        {
+          gpg_err_set_errno (ENAMETOOLONG);
+          return -1;
+        }
+      memset (unaddr, 0, sizeof *unaddr);
+      unaddr->sun_family = AF_LOCAL;
+      memcpy (unaddr->sun_path + 1, fname + 1, strlen (fname + 1));
+      return 0;
+    }
+#endif /*HAVE_ABSTRACT_SOCKETS*/
+
 #if !defined(HAVE_W32_SYSTEM) && defined(HAVE_STAT)
   if (r_redirected
       && !stat (fname, &statbuf)
@@ -1244,7 +1832,7 @@ _assuan_sock_set_sockaddr_un (const char *fname, struct sockaddr *addr,
       struct sockaddr_un *unaddr_new;
       int redirect;
 
-      unaddr_new = eval_redirection (fname, &redirect);
+      unaddr_new = eval_redirection (fname, &statbuf, &redirect);
       if (unaddr_new)
         {
           memcpy (unaddr, unaddr_new, sizeof *unaddr);
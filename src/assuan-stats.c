@@ -0,0 +1,354 @@
+/* assuan-stats.c - I/O statistics
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_W32_SYSTEM
+# ifdef HAVE_WINSOCK2_H
+#  include <winsock2.h>
+# endif
+# include <windows.h>
+#elif defined(HAVE_CLOCK_GETTIME)
+# include <time.h>
+#else
+# include <sys/time.h>
+#endif
+
+#include "assuan-defs.h"
+#include "debug.h"
+
+
+/* The command latencies are kept in log-linear histograms: Values
+   below HIST_SUB are counted exactly, above that each power of two
+   is split into HIST_SUB buckets of equal width.  This gives a
+   relative error of at most 1/HIST_SUB over the whole range, similar
+   to what HdrHistogram does with one significant digit.  Values are
+   in microseconds; the last bucket collects everything above about
+   three days.  */
+#define HIST_SUBBITS 3
+#define HIST_SUB     (1 << HIST_SUBBITS)
+#define HIST_OCTAVES 35
+#define HIST_BUCKETS (HIST_SUB + HIST_OCTAVES * HIST_SUB)
+
+struct _assuan_histogram
+{
+  unsigned long long count;
+  unsigned long long sum;
+  unsigned long long min;
+  unsigned long long max;
+  unsigned long bucket[HIST_BUCKETS];
+};
+
+
+/* The sum of the counters of all contexts ever used by this process.
+   Updated by _assuan_stats_add.  */
+struct assuan_stats _assuan_global_stats;
+
+
+/* Copy the statistics of CTX to STATS, which has a size of SIZE
+   bytes.  If CTX is NULL the process wide statistics are returned.
+   SIZE is usually sizeof (struct assuan_stats); a smaller value is
+   accepted so that a caller built against an older version of the
+   structure keeps working.  */
+gpg_error_t
+assuan_get_stats (assuan_context_t ctx, assuan_stats_t stats, size_t size)
+{
+  struct assuan_stats tmp;
+  unsigned long long *src, *dst;
+  size_t i;
+
+  if (!stats || !size)
+    return _assuan_error (ctx, GPG_ERR_INV_ARG);
+
+  if (ctx)
+    tmp = ctx->stats;
+  else
+    {
+      /* The single counters are read without a lock; they are
+         consistent each by itself but not as a whole.  All members
+         are counters of the same type.  */
+      src = (unsigned long long *)&_assuan_global_stats;
+      dst = (unsigned long long *)&tmp;
+      for (i = 0; i < sizeof tmp / sizeof *dst; i++)
+        dst[i] = _assuan_counter_load (src + i);
+    }
+
+  if (size > sizeof tmp)
+    {
+      memset ((char *)stats + sizeof tmp, 0, size - sizeof tmp);
+      size = sizeof tmp;
+    }
+  memcpy (stats, &tmp, size);
+  return 0;
+}
+
+
+/* Reset the statistics of CTX to zero.  If CTX is NULL the process
+   wide statistics are reset.  Note that resetting the counters of a
+   context does not change the process wide values.  */
+void
+assuan_reset_stats (assuan_context_t ctx)
+{
+  unsigned long long *p;
+  size_t i;
+
+  if (ctx)
+    memset (&ctx->stats, 0, sizeof ctx->stats);
+  else
+    {
+      p = (unsigned long long *)&_assuan_global_stats;
+      for (i = 0; i < sizeof _assuan_global_stats / sizeof *p; i++)
+        _assuan_counter_clear (p + i);
+    }
+}
+
+
+
+/* Return a monotonic timestamp in microseconds.  The epoch is
+   unspecified but a value of 0 is never returned.  */
+unsigned long long
+_assuan_timestamp (void)
+{
+  unsigned long long t;
+
+#ifdef HAVE_W32_SYSTEM
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER cnt;
+
+  if (!freq.QuadPart)
+    QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&cnt);
+  t = (unsigned long long)cnt.QuadPart / freq.QuadPart * 1000000
+    + ((unsigned long long)cnt.QuadPart % freq.QuadPart) * 1000000
+    / freq.QuadPart;
+#elif defined(HAVE_CLOCK_GETTIME)
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    clock_gettime (CLOCK_REALTIME, &ts);
+  t = (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  t = (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+
+  return t? t : 1;
+}
+
+
+/* Return the bucket for the value V.  */
+static unsigned int
+hist_index (unsigned long long v)
+{
+  unsigned int e, idx;
+
+  if (v < HIST_SUB)
+    return v;
+  /* E is the position of the highest bit set.  */
+  for (e = HIST_SUBBITS; e + 1 < 8 * sizeof v && (v >> (e + 1)); e++)
+    ;
+  idx = HIST_SUB + (e - HIST_SUBBITS) * HIST_SUB
+    + ((v >> (e - HIST_SUBBITS)) & (HIST_SUB - 1));
+  return idx < HIST_BUCKETS? idx : HIST_BUCKETS - 1;
+}
+
+
+/* Return the highest value which is counted in bucket IDX.  */
+static unsigned long long
+hist_highest (unsigned int idx)
+{
+  unsigned int octave;
+
+  if (idx < HIST_SUB)
+    return idx;
+  octave = (idx - HIST_SUB) / HIST_SUB;
+  return (((unsigned long long)(HIST_SUB + (idx - HIST_SUB) % HIST_SUB + 1))
+          << octave) - 1;
+}
+
+
+static void
+hist_record (struct _assuan_histogram *hist, unsigned long long v)
+{
+  if (!hist->count || v < hist->min)
+    hist->min = v;
+  if (v > hist->max)
+    hist->max = v;
+  hist->count++;
+  hist->sum += v;
+  hist->bucket[hist_index (v)]++;
+}
+
+
+/* Return the value below which the fraction PERMILLE/1000 of all
+   values in HIST are.  */
+static unsigned long long
+hist_percentile (struct _assuan_histogram *hist, unsigned int permille)
+{
+  unsigned long long want, have;
+  unsigned long long v;
+  unsigned int idx;
+
+  want = (hist->count * permille + 999) / 1000;
+  if (!want)
+    want = 1;
+  for (have = 0, idx = 0; idx < HIST_BUCKETS; idx++)
+    {
+      have += hist->bucket[idx];
+      if (have >= want)
+        break;
+    }
+  v = idx < HIST_BUCKETS? hist_highest (idx) : hist->max;
+  return v < hist->max? v : hist->max;
+}
+
+
+/* Record the latency of the command which has just been finished by
+   assuan_process_done.  */
+void
+_assuan_timing_done (assuan_context_t ctx)
+{
+  unsigned long long now = _assuan_timestamp ();
+  unsigned long long total;
+  struct cmdtbl_s *cmd;
+
+  total = now - ctx->timing.t_read;
+  cmd = ctx->cmdtbl + ctx->timing.cmdidx;
+  if (!cmd->hist)
+    cmd->hist = _assuan_calloc (ctx, 1, sizeof *cmd->hist);
+  if (cmd->hist)
+    hist_record (cmd->hist, total);
+
+  if (ctx->timing.slow_threshold && total >= ctx->timing.slow_threshold)
+    _assuan_debug (ctx, ASSUAN_LOG_CONTROL,
+                   "slow command %s: %llu us (wait %llu, handler %llu,"
+                   " reply %llu), %lu bytes of arguments\n",
+                   cmd->name, total,
+                   ctx->timing.t_dispatch - ctx->timing.t_read,
+                   ctx->timing.t_done - ctx->timing.t_dispatch,
+                   now - ctx->timing.t_done,
+                   (unsigned long)ctx->timing.arglen);
+
+  ctx->timing.t_read = 0;
+  ctx->timing.t_dispatch = 0;
+}
+
+
+/* Release the histograms of all commands of CTX.  */
+void
+_assuan_timing_release (assuan_context_t ctx)
+{
+  size_t i;
+
+  for (i = 0; i < ctx->cmdtbl_used; i++)
+    {
+      _assuan_free (ctx, ctx->cmdtbl[i].hist);
+      ctx->cmdtbl[i].hist = NULL;
+    }
+  ctx->timing.t_read = 0;
+  ctx->timing.t_dispatch = 0;
+}
+
+
+/* Log a message for each command of CTX which takes more than MSEC
+   milliseconds from reading the command line to writing the OK or
+   ERR line.  The log message is written in the category
+   ASSUAN_LOG_CONTROL and shows the time spent in the handler and the
+   length of the arguments.  */
+void
+assuan_set_slow_command_threshold (assuan_context_t ctx, unsigned int msec)
+{
+  if (ctx)
+    ctx->timing.slow_threshold = (unsigned long long)msec * 1000;
+}
+
+
+/* Store a newly allocated report with the latencies of all commands
+   processed by CTX at R_REPORT.  Each line of the report describes
+   one command which has been timed at least once:
+
+     NAME count=N min=T p50=T p90=T p99=T p999=T max=T avg=T
+
+   where all times are given in microseconds.  Percentiles are upper
+   bounds with an accuracy of 12.5%.  The report is an empty string
+   if no command has been timed.  It must be released with
+   assuan_free.  */
+gpg_error_t
+assuan_get_command_timings (assuan_context_t ctx, char **r_report)
+{
+  char *report, *tmp;
+  size_t len, size, n;
+  size_t i;
+  struct _assuan_histogram *hist;
+  char line[300];
+
+  if (!r_report)
+    return _assuan_error (ctx, GPG_ERR_INV_ARG);
+  *r_report = NULL;
+  if (!ctx)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+
+  size = 256;
+  report = _assuan_malloc (ctx, size);
+  if (!report)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  len = 0;
+  *report = 0;
+
+  for (i = 0; i < ctx->cmdtbl_used; i++)
+    {
+      hist = ctx->cmdtbl[i].hist;
+      if (!hist || !hist->count)
+        continue;
+
+      snprintf (line, sizeof line,
+                "%s count=%llu min=%llu p50=%llu p90=%llu p99=%llu"
+                " p999=%llu max=%llu avg=%llu\n",
+                ctx->cmdtbl[i].name, hist->count, hist->min,
+                hist_percentile (hist, 500),
+                hist_percentile (hist, 900),
+                hist_percentile (hist, 990),
+                hist_percentile (hist, 999),
+                hist->max, hist->sum / hist->count);
+      n = strlen (line);
+      if (len + n + 1 > size)
+        {
+          size = 2 * size + n;
+          tmp = _assuan_realloc (ctx, report, size);
+          if (!tmp)
+            {
+              gpg_error_t err = gpg_err_code_from_syserror ();
+              _assuan_free (ctx, report);
+              return _assuan_error (ctx, err);
+            }
+          report = tmp;
+        }
+      memcpy (report + len, line, n + 1);
+      len += n;
+    }
+
+  *r_report = report;
+  return 0;
+}
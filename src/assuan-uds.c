@@ -72,6 +72,58 @@
 #ifndef CMSG_DATA
 #define CMSG_DATA(cmsg) ((unsigned char*)((struct cmsghdr*)(cmsg)+1))
 #endif
+#ifndef CMSG_NXTHDR
+/* Only the first control message will be looked at.  */
+#define CMSG_NXTHDR(mhdr,cmsg) ((struct cmsghdr*)NULL)
+#endif
+
+/* The maximum number of descriptors sent with one message.  This is
+   SCM_MAX_FD of Linux.  */
+#define MAX_FDS_PER_MSG 253
+
+/* The maximum number of received but not yet used descriptors.  If
+   the peer sends more, they are closed.  */
+#define MAX_PENDING_FDS 1024
+#endif /*USE_DESCRIPTOR_PASSING*/
+
+
+#ifdef USE_DESCRIPTOR_PASSING
+/* Append the N descriptors at DATA to the queue of pending
+   descriptors.  DATA may be unaligned.  */
+static void
+queue_pendingfds (assuan_context_t ctx, const unsigned char *data, int n)
+{
+  int fd;
+
+  for (; n > 0; n--, data += sizeof fd)
+    {
+      memcpy (&fd, data, sizeof fd);
+
+      if (ctx->uds.pendingfdscount >= ctx->uds.pendingfdssize
+          && ctx->uds.pendingfdssize < MAX_PENDING_FDS)
+        {
+          int newsize = ctx->uds.pendingfdssize? 2*ctx->uds.pendingfdssize : 8;
+          assuan_fd_t *p;
+
+          p = _assuan_realloc (ctx, ctx->uds.pendingfds,
+                               newsize * sizeof *p);
+          if (p)
+            {
+              ctx->uds.pendingfds = p;
+              ctx->uds.pendingfdssize = newsize;
+            }
+        }
+      if (ctx->uds.pendingfdscount >= ctx->uds.pendingfdssize)
+        {
+          TRACE1 (ctx, ASSUAN_LOG_SYSIO, "uds_reader", ctx,
+                  "too many descriptors pending - "
+                  "closing received descriptor %d", fd);
+          _assuan_close (ctx, fd);
+        }
+      else
+        ctx->uds.pendingfds[ctx->uds.pendingfdscount++] = fd;
+    }
+}
 #endif /*USE_DESCRIPTOR_PASSING*/
 
 
@@ -91,7 +143,7 @@ uds_reader (assuan_context_t ctx, void *buf, size_t buflen)
 #ifdef USE_DESCRIPTOR_PASSING
       union {
         struct cmsghdr cm;
-        char control[CMSG_SPACE(sizeof (int))];
+        char control[CMSG_SPACE(MAX_FDS_PER_MSG * sizeof (int))];
       } control_u;
       struct cmsghdr *cmptr;
 #endif /*USE_DESCRIPTOR_PASSING*/
@@ -116,29 +168,20 @@ uds_reader (assuan_context_t ctx, void *buf, size_t buflen)
 	return 0;
 
 #ifdef USE_DESCRIPTOR_PASSING
-      cmptr = CMSG_FIRSTHDR (&msg);
-      if (cmptr && cmptr->cmsg_len == CMSG_LEN (sizeof(int)))
+      if ((msg.msg_flags & MSG_CTRUNC))
+        TRACE0 (ctx, ASSUAN_LOG_SYSIO, "uds_reader", ctx,
+                "ancillary data truncated - descriptors lost");
+      for (cmptr = CMSG_FIRSTHDR (&msg); cmptr;
+           cmptr = CMSG_NXTHDR (&msg, cmptr))
         {
           if (cmptr->cmsg_level != SOL_SOCKET
-              || cmptr->cmsg_type != SCM_RIGHTS)
+              || cmptr->cmsg_type != SCM_RIGHTS
+              || cmptr->cmsg_len < CMSG_LEN (sizeof (int)))
             TRACE0 (ctx, ASSUAN_LOG_SYSIO, "uds_reader", ctx,
 		    "unexpected ancillary data received");
           else
-            {
-              int fd;
-
-	      memcpy (&fd, CMSG_DATA (cmptr), sizeof (fd));
-
-              if (ctx->uds.pendingfdscount >= DIM (ctx->uds.pendingfds))
-                {
-		  TRACE1 (ctx, ASSUAN_LOG_SYSIO, "uds_reader", ctx,
-			  "too many descriptors pending - "
-			  "closing received descriptor %d", fd);
-                  _assuan_close (ctx, fd);
-                }
-              else
-                ctx->uds.pendingfds[ctx->uds.pendingfdscount++] = fd;
-            }
+            queue_pendingfds (ctx, CMSG_DATA (cmptr),
+                              (cmptr->cmsg_len - CMSG_LEN (0)) / sizeof (int));
 	}
 #endif /*USE_DESCRIPTOR_PASSING*/
     }
@@ -185,62 +228,81 @@ uds_writer (assuan_context_t ctx, const void *buf, size_t buflen)
 }
 
 
+/* Send the N descriptors FDS with one message per MAX_FDS_PER_MSG
+   descriptors.  */
 static gpg_error_t
-uds_sendfd (assuan_context_t ctx, assuan_fd_t fd)
+uds_sendfds (assuan_context_t ctx, const assuan_fd_t *fds, int n)
 {
 #ifdef USE_DESCRIPTOR_PASSING
   struct msghdr msg;
   struct iovec iovec;
   union {
     struct cmsghdr cm;
-    char control[CMSG_SPACE(sizeof (int))];
+    char control[CMSG_SPACE(MAX_FDS_PER_MSG * sizeof (int))];
   } control_u;
   struct cmsghdr *cmptr;
-  int len;
+  int len, nfds;
   char buffer[80];
 
-  /* We need to send some real data so that a read won't return 0
-     which will be taken as an EOF.  It also helps with debugging. */
-  snprintf (buffer, sizeof(buffer)-1, "# descriptor %d is in flight\n", fd);
-  buffer[sizeof(buffer)-1] = 0;
+  for (; n > 0; n -= nfds, fds += nfds)
+    {
+      nfds = n > MAX_FDS_PER_MSG? MAX_FDS_PER_MSG : n;
+
+      /* We need to send some real data so that a read won't return 0
+         which will be taken as an EOF.  It also helps with
+         debugging. */
+      if (nfds == 1)
+        snprintf (buffer, sizeof(buffer)-1,
+                  "# descriptor %d is in flight\n", fds[0]);
+      else
+        snprintf (buffer, sizeof(buffer)-1,
+                  "# %d descriptors are in flight\n", nfds);
+      buffer[sizeof(buffer)-1] = 0;
 
-  memset (&msg, 0, sizeof (msg));
+      memset (&msg, 0, sizeof (msg));
 
-  memset (&control_u, 0, sizeof (control_u));
+      memset (&control_u, 0, sizeof (control_u));
 
-  msg.msg_name = NULL;
-  msg.msg_namelen = 0;
-  msg.msg_iovlen = 1;
-  msg.msg_iov = &iovec;
-  iovec.iov_base = buffer;
-  iovec.iov_len = strlen (buffer);
+      msg.msg_name = NULL;
+      msg.msg_namelen = 0;
+      msg.msg_iovlen = 1;
+      msg.msg_iov = &iovec;
+      iovec.iov_base = buffer;
+      iovec.iov_len = strlen (buffer);
 
-  msg.msg_control = control_u.control;
-  msg.msg_controllen = sizeof (control_u.control);
-  cmptr = CMSG_FIRSTHDR (&msg);
-  cmptr->cmsg_len = CMSG_LEN(sizeof(int));
-  cmptr->cmsg_level = SOL_SOCKET;
-  cmptr->cmsg_type = SCM_RIGHTS;
+      msg.msg_control = control_u.control;
+      msg.msg_controllen = CMSG_SPACE (nfds * sizeof (int));
+      cmptr = CMSG_FIRSTHDR (&msg);
+      cmptr->cmsg_len = CMSG_LEN(nfds * sizeof (int));
+      cmptr->cmsg_level = SOL_SOCKET;
+      cmptr->cmsg_type = SCM_RIGHTS;
 
-  memcpy (CMSG_DATA (cmptr), &fd, sizeof (fd));
+      memcpy (CMSG_DATA (cmptr), fds, nfds * sizeof (int));
 
-  len = _assuan_sendmsg (ctx, ctx->outbound.fd, &msg, 0);
-  if (len < 0)
-    {
-      int saved_errno = errno;
-      TRACE1 (ctx, ASSUAN_LOG_SYSIO, "uds_sendfd", ctx,
-	      "uds_sendfd: %s", strerror (errno));
-      errno = saved_errno;
-      return _assuan_error (ctx, gpg_err_code_from_syserror ());
+      len = _assuan_sendmsg (ctx, ctx->outbound.fd, &msg, 0);
+      if (len < 0)
+        {
+          int saved_errno = errno;
+          TRACE1 (ctx, ASSUAN_LOG_SYSIO, "uds_sendfds", ctx,
+                  "uds_sendfds: %s", strerror (errno));
+          errno = saved_errno;
+          return _assuan_error (ctx, gpg_err_code_from_syserror ());
+        }
     }
-  else
-    return 0;
+  return 0;
 #else
   return _assuan_error (ctx, GPG_ERR_NOT_IMPLEMENTED);
 #endif
 }
 
 
+static gpg_error_t
+uds_sendfd (assuan_context_t ctx, assuan_fd_t fd)
+{
+  return uds_sendfds (ctx, &fd, 1);
+}
+
+
 static gpg_error_t
 uds_receivefd (assuan_context_t ctx, assuan_fd_t *fd)
 {
@@ -253,7 +315,7 @@ uds_receivefd (assuan_context_t ctx, assuan_fd_t *fd)
 	      "no pending file descriptors");
       return _assuan_error (ctx, GPG_ERR_ASS_GENERAL);
     }
-  assert (ctx->uds.pendingfdscount <= DIM(ctx->uds.pendingfds));
+  assert (ctx->uds.pendingfdscount <= ctx->uds.pendingfdssize);
 
   *fd = ctx->uds.pendingfds[0];
   for (i=1; i < ctx->uds.pendingfdscount; i++)
@@ -283,6 +345,9 @@ void
 _assuan_uds_deinit (assuan_context_t ctx)
 {
   _assuan_uds_close_fds (ctx);
+  _assuan_free (ctx, ctx->uds.pendingfds);
+  ctx->uds.pendingfds = NULL;
+  ctx->uds.pendingfdssize = 0;
 }
 
 
@@ -293,6 +358,7 @@ _assuan_init_uds_io (assuan_context_t ctx)
   ctx->engine.readfnc = uds_reader;
   ctx->engine.writefnc = uds_writer;
   ctx->engine.sendfd = uds_sendfd;
+  ctx->engine.sendfds = uds_sendfds;
   ctx->engine.receivefd = uds_receivefd;
 
   ctx->uds.pendingfdscount = 0;
@@ -0,0 +1,1073 @@
+/* assuan-uring.c - Drive many server contexts with an io_uring
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "assuan-defs.h"
+#include "debug.h"
+
+#if defined(HAVE_IO_URING) && defined(HAVE_SYS_MMAN_H) \
+    && defined(HAVE_STDINT_H) && defined(__ATOMIC_SEQ_CST)
+# define USE_IO_URING 1
+#endif
+
+#ifdef USE_IO_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+/* The driver keeps one connection object for each context and each
+   listening socket.  The engine of a driven context reads from and
+   writes to buffers in its connection object; the actual I/O for all
+   connections is submitted to the ring in one batch by
+   assuan_uring_run, which then reaps all completions and runs
+   assuan_process_next for each context which got input.  At most one
+   read and one write are in flight for each connection.  The ring owns
+   the sockets of its contexts.  Workers finishing a deferred command
+   wake up the ring through an eventfd, which always has a read in
+   flight.  */
+
+#define URING_DEFAULT_ENTRIES 256
+#define URING_INBUF_SIZE      4096
+
+/* No further commands of a connection are run while more output than
+   this is queued; like the socket buffer for a blocking server, this
+   holds back a client which does not read its responses.  */
+#define URING_OUT_HIGHWATER   (256 * 1024)
+
+/* The operation of a request is stored in the low bits of its user
+   data; the rest is the connection object.  User data 0 is used for
+   the timeout and a read without a connection object for the
+   eventfd.  */
+#define URING_OP_READ   1
+#define URING_OP_WRITE  2
+#define URING_OP_ACCEPT 3
+#define URING_OP_MASK   3
+
+struct uring_conn_s
+{
+  struct uring_conn_s *next;
+  assuan_uring_t ring;
+  assuan_context_t ctx;      /* NULL for a listening socket.  */
+  assuan_fd_t fd;
+
+  /* For a listening socket.  */
+  assuan_context_t listen_ctx;
+  assuan_accept_cb_t accept_cb;
+  void *accept_cb_value;
+  unsigned int accept_flags;
+
+  /* The finish handler of the context.  */
+  void (*finish_handler) (assuan_context_t);
+
+  char inbuf[URING_INBUF_SIZE];
+  size_t inpos;             /* Offset of the first unread byte.  */
+  size_t inlen;             /* Number of bytes in INBUF.  */
+
+  char *outbuf;
+  char *oldbuf;             /* The buffer of the write in flight if
+                               OUTBUF has been replaced.  */
+  size_t outsize;           /* Allocated size of OUTBUF.  */
+  size_t outstart;          /* Offset of the first unwritten byte.  */
+  size_t outend;            /* Offset after the last queued byte.  */
+
+  unsigned int read_pending:1;
+  unsigned int write_pending:1;
+  unsigned int accept_pending:1;
+  unsigned int eof:1;
+  unsigned int closing:1;   /* The context is finished.  */
+  unsigned int shut:1;      /* The socket has been shut down.  */
+  int error;                /* The errno of a failed read or write.  */
+};
+typedef struct uring_conn_s *uring_conn_t;
+
+struct assuan_uring_s
+{
+  struct assuan_malloc_hooks malloc_hooks;
+  int fd;
+
+  /* The mapped rings.  */
+  void *sq_map;
+  size_t sq_mapsize;
+  void *cq_map;
+  size_t cq_mapsize;
+  struct io_uring_sqe *sqes;
+  size_t sqes_mapsize;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int sq_entries;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  unsigned int to_submit;   /* Queued but not yet submitted SQEs.  */
+  unsigned int inflight;    /* Submitted requests without a CQE.  */
+  int timeout_pending;
+  struct __kernel_timespec timeout;
+  int releasing;            /* Set by assuan_uring_release.  */
+
+  int wakefd;               /* The eventfd signaled by workers.  */
+  uint64_t wakebuf;
+  int wake_pending;         /* A read of WAKEFD is in flight.  */
+  int woken;                /* WAKEFD has been signaled.  */
+
+  uring_conn_t conns;
+};
+
+
+static int
+sys_io_uring_setup (unsigned int entries, struct io_uring_params *p)
+{
+  return syscall (__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+sys_io_uring_enter (int fd, unsigned int to_submit,
+                    unsigned int min_complete, unsigned int flags)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+                  flags, NULL, 0);
+}
+
+
+static int
+sys_io_uring_register (int fd, unsigned int opcode, void *arg,
+                       unsigned int nr_args)
+{
+  return syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+/* Return true if the kernel supports all operations used on the ring
+   FD.  Kernels too old for IORING_REGISTER_PROBE (before 5.6) lack
+   IORING_OP_READ as well.  */
+static int
+ring_probe (int fd)
+{
+  static const unsigned char needed[] =
+    { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_ACCEPT, IORING_OP_TIMEOUT };
+  union {
+    struct io_uring_probe probe;
+    char buf[sizeof (struct io_uring_probe)
+             + 256 * sizeof (struct io_uring_probe_op)];
+  } u;
+  size_t i;
+  int ok;
+
+  memset (&u, 0, sizeof u);
+  ok = !sys_io_uring_register (fd, IORING_REGISTER_PROBE, &u.probe, 256);
+  for (i = 0; ok && i < DIM (needed); i++)
+    ok = (needed[i] <= u.probe.last_op
+          && (u.probe.ops[needed[i]].flags & IO_URING_OP_SUPPORTED));
+  return ok;
+}
+
+
+/* Submit the queued SQEs of RING and, if MIN_COMPLETE is not 0, wait
+   for that many completions.  Returns 0 or -1 with ERRNO set.  */
+static int
+ring_enter (assuan_uring_t ring, unsigned int min_complete)
+{
+  int n;
+
+  n = sys_io_uring_enter (ring->fd, ring->to_submit, min_complete,
+                          min_complete? IORING_ENTER_GETEVENTS : 0);
+  if (n < 0)
+    return -1;
+  ring->to_submit -= n;
+  ring->inflight += n;
+  return 0;
+}
+
+
+/* Return a cleared SQE of RING or NULL if the submission queue is
+   full even after submitting the queued entries.  */
+static struct io_uring_sqe *
+ring_get_sqe (assuan_uring_t ring)
+{
+  unsigned int head, tail;
+  struct io_uring_sqe *sqe;
+
+  tail = *ring->sq_tail;
+  head = __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head >= ring->sq_entries)
+    {
+      if (ring_enter (ring, 0))
+        return NULL;
+      head = __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+      if (tail - head >= ring->sq_entries)
+        return NULL;
+    }
+  sqe = &ring->sqes[tail & *ring->sq_mask];
+  memset (sqe, 0, sizeof *sqe);
+  ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+  return sqe;
+}
+
+
+/* Make the SQE returned by the last ring_get_sqe visible to the
+   kernel.  */
+static void
+ring_queue_sqe (assuan_uring_t ring)
+{
+  __atomic_store_n (ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+
+
+/* Queue a request with opcode OPCODE for CONN.  Returns 0 or -1 if
+   the submission queue is full.  */
+static int
+ring_prep (assuan_uring_t ring, uring_conn_t conn, int op, int opcode,
+           void *addr, size_t len)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = ring_get_sqe (ring);
+  if (!sqe)
+    return -1;
+  sqe->opcode = opcode;
+  sqe->fd = conn->fd;
+  sqe->addr = (uintptr_t)addr;
+  sqe->len = len;
+  if (opcode == IORING_OP_ACCEPT)
+    sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = (uintptr_t)conn | op;
+  ring_queue_sqe (ring);
+  return 0;
+}
+
+
+static ssize_t
+uring_read (assuan_context_t ctx, void *buffer, size_t size)
+{
+  uring_conn_t conn = ctx->uring;
+
+  if (conn->inpos == conn->inlen)
+    {
+      if (conn->eof)
+        return 0;
+      gpg_err_set_errno (conn->error? conn->error : EAGAIN);
+      return -1;
+    }
+  if (size > conn->inlen - conn->inpos)
+    size = conn->inlen - conn->inpos;
+  memcpy (buffer, conn->inbuf + conn->inpos, size);
+  conn->inpos += size;
+  return size;
+}
+
+
+static ssize_t
+uring_write (assuan_context_t ctx, const void *buffer, size_t size)
+{
+  uring_conn_t conn = ctx->uring;
+  assuan_uring_t ring = conn->ring;
+
+  if (conn->error || conn->shut)
+    {
+      gpg_err_set_errno (conn->error? conn->error : EPIPE);
+      return -1;
+    }
+
+  /* The buffer can't be moved while a write from it is in flight.  */
+  if (!conn->write_pending && conn->outstart == conn->outend)
+    conn->outstart = conn->outend = 0;
+  if (conn->outend + size > conn->outsize)
+    {
+      size_t n = conn->outend - conn->outstart;
+      size_t newsize = conn->outsize? conn->outsize : 4096;
+      char *p;
+
+      if (!conn->write_pending && conn->outstart)
+        {
+          memmove (conn->outbuf, conn->outbuf + conn->outstart, n);
+          conn->outstart = 0;
+          conn->outend = n;
+        }
+      while (conn->outend + size > newsize)
+        newsize *= 2;
+      if (newsize > conn->outsize && conn->write_pending)
+        {
+          /* The old buffer is kept until the write from it has
+             completed.  */
+          p = ring->malloc_hooks.malloc (newsize);
+          if (!p)
+            return -1;
+          memcpy (p, conn->outbuf, conn->outend);
+          if (conn->oldbuf)
+            ring->malloc_hooks.free (conn->outbuf);
+          else
+            conn->oldbuf = conn->outbuf;
+          conn->outbuf = p;
+          conn->outsize = newsize;
+        }
+      else if (newsize > conn->outsize)
+        {
+          p = ring->malloc_hooks.realloc (conn->outbuf, newsize);
+          if (!p)
+            return -1;
+          conn->outbuf = p;
+          conn->outsize = newsize;
+        }
+    }
+  memcpy (conn->outbuf + conn->outend, buffer, size);
+  conn->outend += size;
+  return size;
+}
+
+
+/* Allocate a connection object for FD.  */
+static uring_conn_t
+conn_new (assuan_uring_t ring, assuan_fd_t fd)
+{
+  uring_conn_t conn;
+
+  conn = ring->malloc_hooks.malloc (sizeof *conn);
+  if (!conn)
+    return NULL;
+  memset (conn, 0, offsetof (struct uring_conn_s, inbuf));
+  conn->ring = ring;
+  conn->fd = fd;
+  conn->inpos = conn->inlen = 0;
+  conn->outbuf = conn->oldbuf = NULL;
+  conn->outsize = conn->outstart = conn->outend = 0;
+  conn->read_pending = conn->write_pending = conn->accept_pending = 0;
+  conn->eof = conn->closing = conn->shut = 0;
+  conn->error = 0;
+  return conn;
+}
+
+
+/* The finish handler of a context driven by a ring.  The socket is
+   closed only when the ring is done with it.  */
+static void
+uring_finish (assuan_context_t ctx)
+{
+  uring_conn_t conn = ctx->uring;
+
+  ctx->inbound.fd = ASSUAN_INVALID_FD;
+  ctx->outbound.fd = ASSUAN_INVALID_FD;
+  conn->finish_handler (ctx);
+}
+
+
+/* Called by a worker which has finished a deferred command.  */
+static void
+uring_wakeup (void *opaque, assuan_context_t ctx)
+{
+  assuan_uring_t ring = opaque;
+  uint64_t one = 1;
+
+  (void)ctx;
+
+  while (write (ring->wakefd, &one, sizeof one) < 0 && errno == EINTR)
+    ;
+}
+
+
+/* Let CTX do its I/O through CONN.  */
+static void
+conn_attach (uring_conn_t conn, assuan_context_t ctx)
+{
+  conn->ctx = ctx;
+  conn->finish_handler = ctx->finish_handler;
+  ctx->uring = conn;
+  ctx->engine.readfnc = uring_read;
+  ctx->engine.writefnc = uring_write;
+  ctx->finish_handler = uring_finish;
+  ctx->deferred_notify_fnc = uring_wakeup;
+  ctx->deferred_notify_value = conn->ring;
+  conn->next = conn->ring->conns;
+  conn->ring->conns = conn;
+}
+
+
+/* Release the context of CONN and CONN itself.  CONN must not have
+   requests in flight and must not be linked.  */
+static void
+conn_release (uring_conn_t conn)
+{
+  assuan_uring_t ring = conn->ring;
+
+  if (conn->ctx)
+    {
+      /* The context must not use CONN anymore.  */
+      conn->ctx->uring = NULL;
+      conn->ctx->engine.readfnc = _assuan_simple_read;
+      conn->ctx->engine.writefnc = _assuan_simple_write;
+      conn->ctx->finish_handler = conn->finish_handler;
+      conn->ctx->deferred_notify_fnc = NULL;
+      conn->ctx->inbound.fd = ASSUAN_INVALID_FD;
+      conn->ctx->outbound.fd = ASSUAN_INVALID_FD;
+      _assuan_close (conn->ctx, conn->fd);
+      assuan_release (conn->ctx);
+    }
+  if (conn->outbuf)
+    {
+      wipememory (conn->outbuf, conn->outsize);
+      ring->malloc_hooks.free (conn->outbuf);
+    }
+  ring->malloc_hooks.free (conn->oldbuf);
+  wipememory (conn->inbuf, sizeof conn->inbuf);
+  ring->malloc_hooks.free (conn);
+}
+
+
+/* Handle a connection accepted on the listening socket of CONN.  */
+static void
+conn_accepted (uring_conn_t conn, assuan_fd_t fd)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  uring_conn_t newconn;
+
+  if (_assuan_sock_check_nonce (conn->listen_ctx, fd,
+                                &conn->listen_ctx->listen_nonce))
+    {
+      _assuan_close (conn->listen_ctx, fd);
+      return;
+    }
+  newconn = conn_new (conn->ring, fd);
+  if (!newconn)
+    {
+      _assuan_close (conn->listen_ctx, fd);
+      return;
+    }
+  err = _assuan_new_accepted (conn->listen_ctx, fd, conn->accept_flags, &ctx);
+  if (err)
+    {
+      _assuan_close (conn->listen_ctx, fd);
+      conn->ring->malloc_hooks.free (newconn);
+      return;
+    }
+  conn_attach (newconn, ctx);
+  err = conn->accept_cb (conn->accept_cb_value, ctx);
+  if (err)
+    {
+      TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_uring_run", ctx,
+              "connection refused: %s", gpg_strerror (err));
+      newconn->closing = 1;
+      newconn->error = ECONNABORTED;
+    }
+}
+
+
+/* Return true if too much output of CTX is queued to run another
+   command.  Also used by assuan_process_next for the lines it has
+   already buffered.  */
+int
+_assuan_uring_output_full (assuan_context_t ctx)
+{
+  uring_conn_t conn = ctx->uring;
+
+  return (!conn->error
+          && conn->outend - conn->outstart > URING_OUT_HIGHWATER);
+}
+
+
+/* Return true if CONN may run its server: there is input, a line
+   buffered by the context or the end of input to process, and the
+   output has drained enough.  */
+static int
+conn_runnable (uring_conn_t conn)
+{
+  if (conn->closing || conn->ctx->deferred)
+    return 0;
+  if (conn->error)
+    return 1;
+  if (_assuan_uring_output_full (conn->ctx))
+    return 0;
+  return (conn->inpos < conn->inlen || conn->eof
+          || assuan_pending_line (conn->ctx));
+}
+
+
+/* Run the server of CONN until it has consumed all input or has to
+   wait for its output to drain.  */
+static void
+conn_process (uring_conn_t conn)
+{
+  gpg_error_t err;
+  size_t pos;
+  int pending, done;
+
+  while (conn_runnable (conn))
+    {
+      pos = conn->inpos;
+      pending = assuan_pending_line (conn->ctx);
+      err = assuan_process_next (conn->ctx, &done);
+      if (err || done)
+        {
+          conn->closing = 1;
+          break;
+        }
+      if (conn->inpos == pos && !pending)
+        break;  /* Only a partial line.  */
+    }
+}
+
+
+/* Queue the requests for CONN.  Returns -1 if the submission queue
+   is full.  */
+static int
+conn_prepare (uring_conn_t conn)
+{
+  assuan_uring_t ring = conn->ring;
+
+  if (!conn->ctx)
+    {
+      if (!conn->accept_pending)
+        {
+          if (ring_prep (ring, conn, URING_OP_ACCEPT, IORING_OP_ACCEPT,
+                         NULL, 0))
+            return -1;
+          conn->accept_pending = 1;
+        }
+      return 0;
+    }
+
+  if (!conn->write_pending && !conn->error && conn->outstart < conn->outend)
+    {
+      if (ring_prep (ring, conn, URING_OP_WRITE, IORING_OP_WRITE,
+                     conn->outbuf + conn->outstart,
+                     conn->outend - conn->outstart))
+        return -1;
+      conn->write_pending = 1;
+    }
+
+  if (conn->closing)
+    {
+      /* Once the output has been written, shutting down the socket
+         ends a read in flight.  */
+      if (!conn->shut && !conn->write_pending
+          && (conn->error || conn->outstart == conn->outend))
+        {
+          shutdown (conn->fd, SHUT_RDWR);
+          conn->shut = 1;
+        }
+    }
+  else if (!conn->read_pending && !conn->eof && !conn->error
+           && conn->inpos == conn->inlen)
+    {
+      if (ring_prep (ring, conn, URING_OP_READ, IORING_OP_READ,
+                     conn->inbuf, sizeof conn->inbuf))
+        return -1;
+      conn->read_pending = 1;
+    }
+  return 0;
+}
+
+
+/* Handle the completion CQE.  */
+static void
+ring_complete (assuan_uring_t ring, struct io_uring_cqe *cqe)
+{
+  uring_conn_t conn;
+  int op;
+
+  ring->inflight--;
+  if (!cqe->user_data)
+    {
+      ring->timeout_pending = 0;
+      return;
+    }
+  conn = (uring_conn_t)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+  op = cqe->user_data & URING_OP_MASK;
+  if (!conn)
+    {
+      ring->wake_pending = 0;
+      ring->woken = 1;
+      return;
+    }
+
+  switch (op)
+    {
+    case URING_OP_READ:
+      conn->read_pending = 0;
+      if (cqe->res > 0)
+        {
+          conn->inpos = 0;
+          conn->inlen = cqe->res;
+        }
+      else if (!cqe->res)
+        conn->eof = 1;
+      else if (cqe->res != -EAGAIN && cqe->res != -EINTR)
+        conn->error = -cqe->res;
+      break;
+
+    case URING_OP_WRITE:
+      conn->write_pending = 0;
+      if (conn->oldbuf)
+        {
+          ring->malloc_hooks.free (conn->oldbuf);
+          conn->oldbuf = NULL;
+        }
+      if (cqe->res > 0)
+        conn->outstart += cqe->res;
+      else if (cqe->res != -EAGAIN && cqe->res != -EINTR)
+        conn->error = cqe->res? -cqe->res : EPIPE;
+      break;
+
+    case URING_OP_ACCEPT:
+      conn->accept_pending = 0;
+      if (cqe->res >= 0 && ring->releasing)
+        close (cqe->res);
+      else if (cqe->res >= 0)
+        conn_accepted (conn, cqe->res);
+      else
+        TRACE1 (conn->listen_ctx, ASSUAN_LOG_SYSIO, "assuan_uring_run",
+                conn->listen_ctx, "accept failed: %s",
+                strerror (-cqe->res));
+      break;
+    }
+}
+
+
+/* Create a new ring for driving socket server contexts.  ENTRIES is
+   the size of the submission queue; 0 selects a default.  Returns
+   GPG_ERR_NOT_SUPPORTED if the kernel does not provide io_uring.  */
+gpg_error_t
+assuan_uring_new (assuan_uring_t *r_ring, unsigned int entries)
+{
+  gpg_error_t err;
+  assuan_malloc_hooks_t malloc_hooks = assuan_get_malloc_hooks ();
+  assuan_uring_t ring;
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  if (!r_ring)
+    return _assuan_error (NULL, GPG_ERR_INV_VALUE);
+  *r_ring = NULL;
+
+  ring = malloc_hooks->malloc (sizeof *ring);
+  if (!ring)
+    return _assuan_error (NULL, gpg_err_code_from_syserror ());
+  memset (ring, 0, sizeof *ring);
+  ring->malloc_hooks = *malloc_hooks;
+  ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+  ring->wakefd = -1;
+
+  memset (&p, 0, sizeof p);
+  ring->fd = sys_io_uring_setup (entries? entries : URING_DEFAULT_ENTRIES,
+                                 &p);
+  if (ring->fd < 0)
+    {
+      err = (errno == ENOSYS || errno == EPERM)
+        ? GPG_ERR_NOT_SUPPORTED : gpg_err_code_from_syserror ();
+      goto leave;
+    }
+  if (!(p.features & IORING_FEAT_NODROP) || !ring_probe (ring->fd))
+    {
+      err = GPG_ERR_NOT_SUPPORTED;
+      goto leave;
+    }
+
+  ring->sq_mapsize = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  ring->cq_mapsize = p.cq_off.cqes
+    + p.cq_entries * sizeof (struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+      if (ring->cq_mapsize > ring->sq_mapsize)
+        ring->sq_mapsize = ring->cq_mapsize;
+      ring->cq_mapsize = 0;
+    }
+  ring->sq_map = mmap (NULL, ring->sq_mapsize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED)
+    {
+      err = gpg_err_code_from_syserror ();
+      goto leave;
+    }
+  if (ring->cq_mapsize)
+    {
+      ring->cq_map = mmap (NULL, ring->cq_mapsize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_CQ_RING);
+      if (ring->cq_map == MAP_FAILED)
+        {
+          err = gpg_err_code_from_syserror ();
+          goto leave;
+        }
+    }
+  ring->sqes_mapsize = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_mapsize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      err = gpg_err_code_from_syserror ();
+      goto leave;
+    }
+
+  sq = ring->sq_map;
+  cq = ring->cq_mapsize? ring->cq_map : ring->sq_map;
+  ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  ring->sq_entries = p.sq_entries;
+  ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  ring->wakefd = eventfd (0, EFD_CLOEXEC);
+  if (ring->wakefd < 0)
+    {
+      err = gpg_err_code_from_syserror ();
+      goto leave;
+    }
+
+  *r_ring = ring;
+  return 0;
+
+ leave:
+  assuan_uring_release (ring);
+  return _assuan_error (NULL, err);
+}
+
+
+/* Wait until no request of RING uses a buffer anymore.  */
+static void
+ring_drain (assuan_uring_t ring)
+{
+  uring_conn_t conn;
+  unsigned int head, tail;
+  int busy;
+
+  ring->releasing = 1;
+  for (conn = ring->conns; conn; conn = conn->next)
+    if (conn->ctx && (conn->read_pending || conn->write_pending))
+      shutdown (conn->fd, SHUT_RDWR);
+  if (ring->wake_pending)
+    uring_wakeup (ring, NULL);
+
+  for (;;)
+    {
+      busy = ring->wake_pending;
+      for (conn = ring->conns; conn; conn = conn->next)
+        if (conn->read_pending || conn->write_pending)
+          busy = 1;
+      if (!busy || ring_enter (ring, 1))
+        break;
+      head = *ring->cq_head;
+      tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++)
+        ring_complete (ring, &ring->cqes[head & *ring->cq_mask]);
+      __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+
+/* Release RING and all contexts driven by it.  */
+void
+assuan_uring_release (assuan_uring_t ring)
+{
+  uring_conn_t conn, next;
+
+  if (!ring)
+    return;
+
+  /* The kernel may still write to the input buffers while a read is
+     in flight.  Accepts don't use a buffer and are canceled by closing
+     the ring.  */
+  if (ring->cq_head)
+    ring_drain (ring);
+  if (ring->sqes != MAP_FAILED)
+    munmap (ring->sqes, ring->sqes_mapsize);
+  if (ring->cq_map != MAP_FAILED)
+    munmap (ring->cq_map, ring->cq_mapsize);
+  if (ring->sq_map != MAP_FAILED)
+    munmap (ring->sq_map, ring->sq_mapsize);
+  if (ring->fd >= 0)
+    close (ring->fd);
+  if (ring->wakefd >= 0)
+    close (ring->wakefd);
+
+  for (conn = ring->conns; conn; conn = next)
+    {
+      next = conn->next;
+      conn_release (conn);
+    }
+  ring->malloc_hooks.free (ring);
+}
+
+
+/* Let RING drive the socket server context CTX, which must be
+   connected, i.e. assuan_accept has been called.  RING takes
+   ownership of CTX and releases it when the connection ends.  */
+gpg_error_t
+assuan_uring_add (assuan_uring_t ring, assuan_context_t ctx)
+{
+  uring_conn_t conn;
+
+  TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_uring_add", ctx, "ring=%p", ring);
+
+  if (!ring || !ctx)
+    return _assuan_error (ctx, GPG_ERR_INV_VALUE);
+  if (!ctx->is_server || ctx->inbound.fd == ASSUAN_INVALID_FD
+      || ctx->inbound.fd != ctx->outbound.fd || ctx->uring)
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  if (ctx->engine.receivefd || ctx->loopback || ctx->shm)
+    return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+
+  conn = conn_new (ring, ctx->inbound.fd);
+  if (!conn)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  conn_attach (conn, ctx);
+  return 0;
+}
+
+
+/* Let RING accept connections on the listening socket of the socket
+   server CTX.  For each connection a new context is created as with
+   assuan_accept_all using FLAGS and passed to CB along with CB_VALUE.
+   CB usually registers the commands and calls assuan_accept.  The new
+   context is driven by RING and owned by it; if CB returns an error,
+   it is released right away.  CTX is not owned by RING and must be
+   kept until RING is released.  */
+gpg_error_t
+assuan_uring_add_listener (assuan_uring_t ring, assuan_context_t ctx,
+                           assuan_accept_cb_t cb, void *cb_value,
+                           unsigned int flags)
+{
+  uring_conn_t conn;
+
+  TRACE2 (ctx, ASSUAN_LOG_CTX, "assuan_uring_add_listener", ctx,
+          "ring=%p, flags=0x%x", ring, flags);
+
+  if (!ring || !ctx || !cb)
+    return _assuan_error (ctx, GPG_ERR_INV_VALUE);
+  if (!ctx->is_server || ctx->listen_fd == ASSUAN_INVALID_FD
+      || (flags & ASSUAN_SOCKET_SERVER_ACCEPTED))
+    return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  if ((flags & ASSUAN_SOCKET_SERVER_FDPASSING))
+    return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+
+  conn = conn_new (ring, ctx->listen_fd);
+  if (!conn)
+    return _assuan_error (ctx, gpg_err_code_from_syserror ());
+  conn->listen_ctx = ctx;
+  conn->accept_cb = cb;
+  conn->accept_cb_value = cb_value;
+  conn->accept_flags = flags & ~ASSUAN_SOCKET_SERVER_NONBLOCK;
+  conn->next = ring->conns;
+  ring->conns = conn;
+  return 0;
+}
+
+
+/* Run one round of RING: Submit the pending I/O of all its
+   connections, wait up to TIMEOUT milliseconds (-1 for no limit) for
+   at least one completion, process all completions and run the
+   servers which got input.  The number of connected contexts driven
+   by RING is stored at R_ACTIVE if it is not NULL.  */
+gpg_error_t
+assuan_uring_run (assuan_uring_t ring, int timeout, unsigned int *r_active)
+{
+  uring_conn_t conn, *connp;
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  unsigned int head, tail;
+  unsigned int active;
+  int wait, woken, done;
+  gpg_error_t err;
+
+  if (r_active)
+    *r_active = 0;
+  if (!ring)
+    return _assuan_error (NULL, GPG_ERR_INV_VALUE);
+
+  /* Release the finished connections and queue the requests of the
+     others.  */
+  connp = &ring->conns;
+  while ((conn = *connp))
+    {
+      if (conn->closing && (conn->shut || conn->error)
+          && !conn->read_pending && !conn->write_pending)
+        {
+          *connp = conn->next;
+          conn_release (conn);
+          continue;
+        }
+      if (conn_prepare (conn))
+        break;  /* The others have to wait for the next round.  */
+      /* A connection which has been shut down now is released right
+         away if possible.  */
+      if (conn->shut && !conn->read_pending && !conn->write_pending)
+        continue;
+      connp = &conn->next;
+    }
+
+  if (!ring->wake_pending)
+    {
+      sqe = ring_get_sqe (ring);
+      if (sqe)
+        {
+          sqe->opcode = IORING_OP_READ;
+          sqe->fd = ring->wakefd;
+          sqe->addr = (uintptr_t)&ring->wakebuf;
+          sqe->len = sizeof ring->wakebuf;
+          sqe->user_data = URING_OP_READ;
+          ring_queue_sqe (ring);
+          ring->wake_pending = 1;
+        }
+    }
+
+  wait = timeout && (ring->inflight || ring->to_submit);
+  if (wait && timeout > 0 && !ring->timeout_pending)
+    {
+      sqe = ring_get_sqe (ring);
+      if (sqe)
+        {
+          ring->timeout.tv_sec = timeout / 1000;
+          ring->timeout.tv_nsec = (timeout % 1000) * 1000000L;
+          sqe->opcode = IORING_OP_TIMEOUT;
+          sqe->fd = -1;
+          sqe->addr = (uintptr_t)&ring->timeout;
+          sqe->len = 1;
+          sqe->off = 1;  /* Or after any other completion.  */
+          sqe->user_data = 0;
+          ring_queue_sqe (ring);
+          ring->timeout_pending = 1;
+        }
+    }
+
+  if (ring_enter (ring, wait? 1 : 0) && errno != EINTR)
+    return _assuan_error (NULL, gpg_err_code_from_syserror ());
+
+  /* Reap all completions at once.  */
+  head = *ring->cq_head;
+  tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++)
+    {
+      cqe = &ring->cqes[head & *ring->cq_mask];
+      ring_complete (ring, cqe);
+    }
+  __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+
+  /* Now run the servers.  */
+  active = 0;
+  woken = ring->woken;
+  ring->woken = 0;
+  for (conn = ring->conns; conn; conn = conn->next)
+    {
+      if (!conn->ctx)
+        continue;
+      if (woken && !conn->closing && conn->ctx->deferred)
+        {
+          err = assuan_run_deferred (conn->ctx, &done);
+          if (err || done)
+            conn->closing = 1;
+        }
+      conn_process (conn);
+      if (!conn->closing)
+        active++;
+    }
+
+  if (r_active)
+    *r_active = active;
+  return 0;
+}
+
+
+#else /*!USE_IO_URING*/
+
+gpg_error_t
+assuan_uring_new (assuan_uring_t *r_ring, unsigned int entries)
+{
+  (void)entries;
+
+  if (r_ring)
+    *r_ring = NULL;
+  return _assuan_error (NULL, GPG_ERR_NOT_SUPPORTED);
+}
+
+
+void
+assuan_uring_release (assuan_uring_t ring)
+{
+  (void)ring;
+}
+
+
+gpg_error_t
+assuan_uring_add (assuan_uring_t ring, assuan_context_t ctx)
+{
+  (void)ring;
+
+  return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+}
+
+
+gpg_error_t
+assuan_uring_add_listener (assuan_uring_t ring, assuan_context_t ctx,
+                           assuan_accept_cb_t cb, void *cb_value,
+                           unsigned int flags)
+{
+  (void)ring;
+  (void)cb;
+  (void)cb_value;
+  (void)flags;
+
+  return _assuan_error (ctx, GPG_ERR_NOT_SUPPORTED);
+}
+
+
+gpg_error_t
+assuan_uring_run (assuan_uring_t ring, int timeout, unsigned int *r_active)
+{
+  (void)ring;
+  (void)timeout;
+
+  if (r_active)
+    *r_active = 0;
+  return _assuan_error (NULL, GPG_ERR_NOT_SUPPORTED);
+}
+
+
+int
+_assuan_uring_output_full (assuan_context_t ctx)
+{
+  (void)ctx;
+
+  return 0;
+}
+
+#endif /*!USE_IO_URING*/
@@ -173,6 +173,17 @@ _assuan_reset (assuan_context_t ctx)
       (*ctx->engine.release) (ctx);
       ctx->engine.release = NULL;
     }
+  /* A new connection starts in a known state; drop what is left of
+     a line interrupted by an error or a timeout.  */
+  ctx->io_timed_out = 0;
+  ctx->connect_state = 0;
+  ctx->greeting_pending = 0;
+  ctx->inbound.eof = 0;
+  ctx->inbound.attic.linelen = 0;
+  ctx->inbound.attic.pending = 0;
+  ctx->outbound.data.linelen = 0;
+  ctx->outbound.data.error = 0;
+  ctx->memfd_threshold = 0;
 
   /* FIXME: Clean standard commands */
 }
@@ -187,7 +198,10 @@ assuan_release (assuan_context_t ctx)
 
   TRACE (ctx, ASSUAN_LOG_CTX, "assuan_release", ctx);
 
+  if (ctx->pool_key)
+    _assuan_pool_forget (ctx);
   _assuan_reset (ctx);
+  _assuan_inquire_pool_release (ctx);
   /* None of the members that are our responsibility requires
      deallocation.  To avoid sensitive data in the line buffers we
      wipe them out, though.  Note that we can't wipe the entire
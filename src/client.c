@@ -35,6 +35,8 @@
 void
 _assuan_client_finish (assuan_context_t ctx)
 {
+  _assuan_shm_deinit (ctx);
+  ctx->memfd_threshold = 0;
   if (ctx->inbound.fd != ASSUAN_INVALID_FD)
     {
       _assuan_close (ctx, ctx->inbound.fd);
@@ -61,12 +63,72 @@ _assuan_client_finish (assuan_context_t ctx)
 void
 _assuan_client_release (assuan_context_t ctx)
 {
-  assuan_write_line (ctx, "BYE");
+  /* After a timeout the peer is hung or we are in the middle of a
+     line; don't make it worse.  */
+  if (!ctx->io_timed_out)
+    assuan_write_line (ctx, "BYE");
 
   _assuan_client_finish (ctx);
 }
 
 
+/* Read the greeting of the server and check that it is an OK line.
+   If WAIT is false, GPG_ERR_EAGAIN is returned instead of waiting for
+   a non-blocking descriptor; the partial line is kept for the next
+   call.  */
+gpg_error_t
+_assuan_read_greeting (assuan_context_t ctx, int wait)
+{
+  gpg_error_t rc;
+  assuan_response_t response;
+  int off;
+  char *sname;
+
+  do
+    {
+      /* Empty lines are skipped like comments.  */
+      response = ASSUAN_RESPONSE_COMMENT;
+      do
+        {
+          rc = _assuan_read_line (ctx);
+        }
+      while (wait && _assuan_error_is_eagain (ctx, &rc));
+      if (!rc && ctx->inbound.linelen)
+        {
+          rc = assuan_client_parse_response (ctx, ctx->inbound.line,
+                                             ctx->inbound.linelen,
+                                             &response, &off);
+          /* Only a timeout or an error reading the line leaves the
+             greeting pending; a bad one is not read again.  */
+          if (rc || response != ASSUAN_RESPONSE_COMMENT)
+            ctx->greeting_pending = 0;
+        }
+    }
+  while (!rc && response == ASSUAN_RESPONSE_COMMENT);
+
+  if (rc)
+    {
+      if (gpg_err_code (rc) != GPG_ERR_EAGAIN)
+        TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
+                "can't connect to server: %s\n", gpg_strerror (rc));
+      return rc;
+    }
+  if (response == ASSUAN_RESPONSE_OK)
+    return 0;
+
+  sname = _assuan_encode_c_string (ctx, ctx->inbound.line);
+  if (sname)
+    {
+      TRACE1 (ctx, ASSUAN_LOG_SYSIO, "assuan_socket_connect", ctx,
+              "can't connect to server: %s", sname);
+      _assuan_free (ctx, sname);
+    }
+  /* Anything following is not meant for us.  */
+  ctx->inbound.eof = 1;
+  return _assuan_error (ctx, GPG_ERR_ASS_CONNECT_FAILED);
+}
+
+
 /* This function also does deescaping for data lines.  */
 gpg_error_t
 assuan_client_read_response (assuan_context_t ctx,
@@ -79,13 +141,22 @@ assuan_client_read_response (assuan_context_t ctx,
   *line_r = NULL;
   *linelen_r = 0;
 
+  /* With a deferred greeting, the first response is preceded by the
+     greeting.  */
+  if (ctx->greeting_pending)
+    {
+      rc = _assuan_read_greeting (ctx, 1);
+      if (rc)
+        return rc;
+    }
+
   do
     {
       do
 	{
 	  rc = _assuan_read_line (ctx);
 	}
-      while (_assuan_error_is_eagain (ctx, rc));
+      while (_assuan_error_is_eagain (ctx, &rc));
       if (rc)
         return rc;
       line = ctx->inbound.line;
@@ -98,6 +169,8 @@ assuan_client_read_response (assuan_context_t ctx,
   if (linelen >= 1 && line[0] == 'D' && line[1] == ' ')
     {
       char *s, *d;
+
+      _assuan_stats_add (ctx, data_in_escaped, linelen - 2);
       for (s=d=line; linelen; linelen--)
 	{
 	  if (*s == '%' && linelen > 2)
@@ -114,6 +187,7 @@ assuan_client_read_response (assuan_context_t ctx,
 
       linelen = d - line;
       ctx->inbound.linelen = linelen;
+      _assuan_stats_add (ctx, data_in, linelen - 2);
     }
 
   *line_r = line;
@@ -160,6 +234,7 @@ assuan_client_parse_response (assuan_context_t ctx, char *line, int linelen,
     {
       *response = ASSUAN_RESPONSE_ERROR;
       *off = 3;
+      _assuan_stats_add (ctx, errors, 1);
       while (line[*off] == ' ')
         ++*off;
     }
@@ -171,6 +246,7 @@ assuan_client_parse_response (assuan_context_t ctx, char *line, int linelen,
     {
       *response = ASSUAN_RESPONSE_INQUIRE;
       *off = 7;
+      _assuan_stats_add (ctx, inquiries, 1);
       while (line[*off] == ' ')
         ++*off;
     }
@@ -186,6 +262,11 @@ assuan_client_parse_response (assuan_context_t ctx, char *line, int linelen,
       *response = ASSUAN_RESPONSE_COMMENT;
       *off = 1;
     }
+  else if (ctx->memfd_threshold && _assuan_memfd_line_p (line, linelen))
+    {
+      *response = ASSUAN_RESPONSE_MEMFD;
+      *off = 0;
+    }
   else
     return _assuan_error (ctx, GPG_ERR_ASS_INV_RESPONSE);
 
@@ -278,6 +359,24 @@ assuan_transact (assuan_context_t ctx,
             goto again;
         }
     }
+  else if (response == ASSUAN_RESPONSE_MEMFD)
+    {
+      void *addr;
+      size_t length;
+
+      /* The descriptor needs to be taken in any case.  */
+      rc = _assuan_memfd_map (ctx, line, &addr, &length);
+      if (!rc)
+        {
+          if (!data_cb)
+            rc = _assuan_error (ctx, GPG_ERR_ASS_NO_DATA_CB);
+          else
+            rc = data_cb (data_cb_arg, addr, length);
+          _assuan_memfd_unmap (addr, length);
+          if (!rc)
+            goto again;
+        }
+    }
   else if (response == ASSUAN_RESPONSE_INQUIRE)
     {
       if (!inquire_cb)
@@ -22,6 +22,8 @@
 #include <config.h>
 #endif
 
+#include <time.h>
+
 #include "assuan-defs.h"
 #include "debug.h"
 
@@ -92,6 +94,10 @@ assuan_set_flag (assuan_context_t ctx, assuan_flag_t flag, int value)
     case ASSUAN_FORCE_CLOSE:
       ctx->flags.force_close = 1;
       break;
+
+    case ASSUAN_COMMAND_TIMING:
+      ctx->flags.command_timing = value;
+      break;
     }
 }
 
@@ -132,6 +138,10 @@ assuan_get_flag (assuan_context_t ctx, assuan_flag_t flag)
     case ASSUAN_FORCE_CLOSE:
       res = ctx->flags.force_close;
       break;
+
+    case ASSUAN_COMMAND_TIMING:
+      res = ctx->flags.command_timing;
+      break;
     }
 
   return TRACE_SUC1 ("flag_value=%i", res);
@@ -181,6 +191,47 @@ void assuan_set_io_monitor (assuan_context_t ctx,
   ctx->io_monitor_data = hook_data;
 }
 
+
+/* Set the deadline for waiting for the peer.  */
+void
+assuan_set_io_deadline (assuan_context_t ctx, time_t deadline)
+{
+  time_t now;
+
+  TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_set_io_deadline", ctx,
+	  "deadline=%lu", (unsigned long)deadline);
+
+  if (! ctx)
+    return;
+
+  if (!deadline)
+    {
+      ctx->io_deadline = 0;
+      return;
+    }
+
+  /* Convert to the monotonic clock so that changing the system time
+     does not affect a running wait.  */
+  now = time (NULL);
+  ctx->io_deadline = _assuan_timestamp ();
+  if (deadline > now)
+    ctx->io_deadline += (unsigned long long)(deadline - now) * 1000000;
+}
+
+
+/* Set the timeout for a single wait for the peer.  */
+void
+assuan_set_io_timeout (assuan_context_t ctx, unsigned int msec)
+{
+  TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_set_io_timeout", ctx,
+	  "msec=%u", msec);
+
+  if (! ctx)
+    return;
+
+  ctx->io_timeout = msec;
+}
+
 
 /* Store the error in the context so that the error sending function
    can take out a descriptive text.  Inside the assuan code, use the
@@ -204,6 +255,9 @@ assuan_set_error (assuan_context_t ctx, gpg_error_t err, const char *text)
 pid_t
 assuan_get_pid (assuan_context_t ctx)
 {
+  if (ctx)
+    _assuan_fetch_peercred (ctx);
+
   TRACE1 (ctx, ASSUAN_LOG_CTX, "assuan_get_pid", ctx,
 	  "pid=%i", ctx ? ctx->pid : -1);
 
@@ -220,6 +274,7 @@ assuan_get_peercred (assuan_context_t ctx, assuan_peercred_t *peercred)
 
   if (!ctx)
     return _assuan_error (ctx, GPG_ERR_ASS_INV_VALUE);
+  _assuan_fetch_peercred (ctx);
   if (!ctx->peercred_valid)
     return _assuan_error (ctx, GPG_ERR_ASS_GENERAL);
 
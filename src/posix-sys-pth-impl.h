@@ -83,6 +83,21 @@
       ;									\
     return ret;								\
   }                                                                     \
+  static int _assuan_pth_poll (assuan_context_t ctx, assuan_fd_t fd,	\
+			       int for_write, int timeout)		\
+  {									\
+    fd_set fds;								\
+    struct timeval tv;							\
+    int ret;								\
+									\
+    (void) ctx;								\
+    FD_ZERO (&fds);							\
+    FD_SET (fd, &fds);							\
+    tv.tv_sec = timeout / 1000;						\
+    tv.tv_usec = (timeout % 1000) * 1000;				\
+    ret = pth_select (fd + 1, for_write? NULL : &fds,			\
+		      for_write? &fds : NULL, NULL,			\
+		      timeout < 0? NULL : &tv);				\
+    return ret < 0? -1 : !!ret;						\
+  }                                                                     \
 ##EOF## Force end-of file.
-
-
@@ -31,6 +31,11 @@
 void
 _assuan_server_finish (assuan_context_t ctx)
 {
+  /* The credentials can't be fetched after the socket is closed.  */
+  ctx->peercred_pending = 0;
+  _assuan_shm_deinit (ctx);
+  /* The next client has to ask for memfd data again.  */
+  ctx->memfd_threshold = 0;
   if (ctx->inbound.fd != ASSUAN_INVALID_FD)
     {
       _assuan_close (ctx, ctx->inbound.fd);
@@ -52,6 +57,8 @@ _assuan_server_finish (assuan_context_t ctx)
   _assuan_uds_deinit (ctx);
 
   _assuan_inquire_release (ctx);
+
+  _assuan_deferred_release (ctx);
 }
 
 
@@ -64,6 +71,7 @@ _assuan_server_release (assuan_context_t ctx)
   ctx->hello_line = NULL;
   _assuan_free (ctx, ctx->okay_line);
   ctx->okay_line = NULL;
+  _assuan_timing_release (ctx);
   _assuan_free (ctx, ctx->cmdtbl);
   ctx->cmdtbl = NULL;
 }
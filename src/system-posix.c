@@ -36,6 +36,14 @@
 # include <sys/time.h>
 # include <sys/resource.h>
 #endif /*HAVE_GETRLIMIT*/
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#else
+# ifdef HAVE_SYS_SELECT_H
+#  include <sys/select.h>
+# endif
+# include <sys/time.h>
+#endif
 
 
 #include "assuan-defs.h"
@@ -391,6 +399,33 @@ __assuan_connect (assuan_context_t ctx, int sock, struct sockaddr *addr,
 }
 
 
+int
+__assuan_poll (assuan_context_t ctx, assuan_fd_t fd, int for_write,
+	       int timeout)
+{
+  int res;
+#ifdef HAVE_POLL_H
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = for_write? POLLOUT : POLLIN;
+  pfd.revents = 0;
+  res = poll (&pfd, 1, timeout);
+#else
+  fd_set fds;
+  struct timeval tv;
+
+  FD_ZERO (&fds);
+  FD_SET (fd, &fds);
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+  res = select (fd + 1, for_write? NULL : &fds, for_write? &fds : NULL,
+		NULL, timeout < 0? NULL : &tv);
+#endif
+  return res < 0? -1 : !!res;
+}
+
+
 
 /* The default system hooks for assuan contexts.  */
 struct assuan_system_hooks _assuan_system_hooks =
@@ -407,5 +442,6 @@ struct assuan_system_hooks _assuan_system_hooks =
     __assuan_waitpid,
     __assuan_socketpair,
     __assuan_socket,
-    __assuan_connect
+    __assuan_connect,
+    __assuan_poll
   };
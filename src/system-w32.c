@@ -575,6 +575,33 @@ __assuan_connect (assuan_context_t ctx, int sock, struct sockaddr *addr,
   return res;
 }
 
+
+/* Only sockets can be waited for; the caller falls back to sleeping
+   for pipes.  */
+int
+__assuan_poll (assuan_context_t ctx, assuan_fd_t fd, int for_write,
+	       int timeout)
+{
+  fd_set fds;
+  struct timeval tv;
+  int res;
+
+  if (!is_socket (fd))
+    {
+      gpg_err_set_errno (ENOSYS);
+      return -1;
+    }
+  FD_ZERO (&fds);
+  FD_SET (HANDLE2SOCKET (fd), &fds);
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+  res = select (0, for_write? NULL : &fds, for_write? &fds : NULL, NULL,
+		timeout < 0? NULL : &tv);
+  if (res < 0)
+    gpg_err_set_errno (_assuan_sock_wsa2errno (WSAGetLastError ()));
+  return res < 0? -1 : !!res;
+}
+
 
 /* The default system hooks for assuan contexts.  */
 struct assuan_system_hooks _assuan_system_hooks =
@@ -591,5 +618,6 @@ struct assuan_system_hooks _assuan_system_hooks =
     __assuan_waitpid,
     __assuan_socketpair,
     __assuan_socket,
-    __assuan_connect
+    __assuan_connect,
+    __assuan_poll
   };
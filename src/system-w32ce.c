@@ -685,6 +685,16 @@ __assuan_connect (assuan_context_t ctx, int sock, struct sockaddr *addr,
 }
 
 
+/* Not supported; the caller falls back to sleeping.  */
+int
+__assuan_poll (assuan_context_t ctx, assuan_fd_t fd, int for_write,
+	       int timeout)
+{
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+}
+
+
 
 /* The default system hooks for assuan contexts.  */
 struct assuan_system_hooks _assuan_system_hooks =
@@ -701,5 +711,6 @@ struct assuan_system_hooks _assuan_system_hooks =
     __assuan_waitpid,
     __assuan_socketpair,
     __assuan_socket,
-    __assuan_connect
+    __assuan_connect,
+    __assuan_poll
   };
@@ -125,7 +125,14 @@ _assuan_system_hooks_copy (assuan_system_hooks_t dst,
       dst->socket = src->socket;
       dst->connect = src->connect;
     }
-  if (src->version > 2)
+  if (src->version >= 3)
+    dst->poll = src->poll;
+  else
+    /* Our poll would block all threads of a user space thread
+       library which does not know about it.  Fall back to sleeping
+       through the usleep hook.  */
+    dst->poll = NULL;
+  if (src->version > 3)
     /* FIXME.  Application uses newer version of the library.  What to
        do?  */
     ;
@@ -412,3 +419,20 @@ _assuan_connect (assuan_context_t ctx, int sock, struct sockaddr *addr, socklen_
   return TRACE_SYSRES (res);
 }
 
+
+int
+_assuan_poll (assuan_context_t ctx, assuan_fd_t fd, int for_write,
+	      int timeout)
+{
+  int res;
+  TRACE_BEG3 (ctx, ASSUAN_LOG_SYSIO, "_assuan_poll", ctx,
+	      "fd=0x%x,for_write=%i,timeout=%i", fd, for_write, timeout);
+
+  if (!ctx->system.poll)
+    {
+      gpg_err_set_errno (ENOSYS);
+      return TRACE_SYSRES (-1);
+    }
+  res = (ctx->system.poll) (ctx, fd, for_write, timeout);
+  return TRACE_SYSRES (res);
+}
@@ -35,5 +35,11 @@
     gpg_err_set_errno (ENOSYS);                                         \
     return -1;								\
   }                                                                     \
+  static int _assuan_pth_poll (assuan_context_t ctx, assuan_fd_t fd,	\
+			       int for_write, int timeout)		\
+  {									\
+    (void) ctx;								\
+    gpg_err_set_errno (ENOSYS);                                         \
+    return -1;								\
+  }                                                                     \
 ##EOF## Force end-of file.
-
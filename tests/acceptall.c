@@ -0,0 +1,227 @@
+/* acceptall.c - Check accepting all pending connections.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+#define NCLIENTS 4
+
+struct servers_s
+{
+  assuan_context_t ctx[NCLIENTS];
+  unsigned int n;
+  unsigned int limit;  /* Refuse more than this many.  */
+};
+
+
+/* Take the new server context CTX.  */
+static gpg_error_t
+accept_cb (void *opaque, assuan_context_t ctx)
+{
+  struct servers_s *servers = opaque;
+  gpg_error_t err;
+
+  if (servers->n >= servers->limit)
+    return gpg_error (GPG_ERR_LIMIT_REACHED);
+  err = assuan_accept (ctx);
+  if (err)
+    return err;
+  servers->ctx[servers->n++] = ctx;
+  return 0;
+}
+
+
+/* Run the NOP command from CLIENT through SERVER.  Both live in this
+   process, so the steps are done one after the other.  */
+static void
+check_nop (assuan_context_t client, assuan_context_t server)
+{
+  gpg_error_t err;
+  char *line;
+  int linelen;
+  int done = 0;
+
+  err = assuan_write_line (client, "NOP");
+  if (!err)
+    err = assuan_process_next (server, &done);
+  if (err)
+    {
+      log_error ("NOP failed: %s\n", gpg_strerror (err));
+      return;
+    }
+  /* The deferred greeting comes first.  */
+  err = assuan_client_read_response (client, &line, &linelen);
+  if (err)
+    log_error ("reading the response failed: %s\n", gpg_strerror (err));
+  else if (linelen < 2 || strncmp (line, "OK", 2))
+    log_error ("unexpected response `%.*s'\n", linelen, line);
+}
+
+
+static void
+check_accept_all (const char *name)
+{
+  gpg_error_t err;
+  struct sockaddr_un addr_un;
+  assuan_fd_t fd;
+  assuan_context_t listen_ctx;
+  assuan_context_t clients[NCLIENTS];
+  assuan_peercred_t peercred;
+  struct servers_s servers;
+  unsigned int count;
+  int i;
+
+  remove (name);
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  if (assuan_sock_set_sockaddr_un (name, (struct sockaddr *)&addr_un, NULL)
+      || assuan_sock_bind (fd, (struct sockaddr *)&addr_un, sizeof addr_un)
+      || listen (fd, NCLIENTS))
+    log_fatal ("can't listen on `%s': %s\n", name, strerror (errno));
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  err = assuan_new (&listen_ctx);
+  if (!err)
+    err = assuan_init_socket_server (listen_ctx, fd, 0);
+  if (err)
+    log_fatal ("server setup failed: %s\n", gpg_strerror (err));
+
+  /* Nothing is pending yet.  */
+  memset (&servers, 0, sizeof servers);
+  servers.limit = NCLIENTS;
+  err = assuan_accept_all (listen_ctx, accept_cb, &servers, 0, &count);
+  if (err || count)
+    log_error ("accepting nothing failed: %s, count=%u\n",
+               gpg_strerror (err), count);
+
+  /* The clients don't wait for the greeting so that they can all
+     connect before the server accepts.  */
+  for (i = 0; i < NCLIENTS; i++)
+    {
+      err = assuan_new (&clients[i]);
+      if (!err)
+        err = assuan_socket_connect (clients[i], name, ASSUAN_INVALID_PID,
+                                     ASSUAN_SOCKET_CONNECT_DEFER_GREETING);
+      if (err)
+        log_fatal ("assuan_socket_connect failed: %s\n", gpg_strerror (err));
+    }
+
+  /* A refused connection stops the loop.  */
+  servers.limit = 1;
+  err = assuan_accept_all (listen_ctx, accept_cb, &servers, 0, &count);
+  if (gpg_err_code (err) != GPG_ERR_LIMIT_REACHED || count != 2)
+    log_error ("expected the limit to be reached after 2 but got: %s, %u\n",
+               gpg_strerror (err), count);
+
+  /* The remaining connections are accepted in one go.  */
+  servers.limit = NCLIENTS;
+  err = assuan_accept_all (listen_ctx, accept_cb, &servers, 0, &count);
+  if (err || count != NCLIENTS - 2)
+    log_error ("accepting the rest failed: %s, count=%u\n",
+               gpg_strerror (err), count);
+  if (verbose)
+    log_info ("accepted %u connections\n", servers.n);
+
+  /* The client of the refused connection sees it closed.  */
+  err = assuan_transact (clients[1], "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+  if (!err)
+    log_error ("refused connection still works\n");
+
+  for (i = 0; i < (int)servers.n; i++)
+    {
+      check_nop (clients[i? i+1 : 0], servers.ctx[i]);
+
+      /* The credentials are fetched on demand.  */
+      err = assuan_get_peercred (servers.ctx[i], &peercred);
+#ifdef HAVE_SO_PEERCRED
+      if (err)
+        log_error ("assuan_get_peercred failed: %s\n", gpg_strerror (err));
+      else if (peercred->pid != getpid () || peercred->uid != getuid ())
+        log_error ("wrong peer credentials\n");
+      if (assuan_get_pid (servers.ctx[i]) != getpid ())
+        log_error ("wrong peer pid\n");
+#else
+      (void)err;
+#endif
+    }
+
+  for (i = 0; i < NCLIENTS; i++)
+    assuan_release (clients[i]);
+  for (i = 0; i < (int)servers.n; i++)
+    assuan_release (servers.ctx[i]);
+  assuan_release (listen_ctx);
+  remove (name);
+}
+
+
+/*
+     M A I N
+ */
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  char cwd[256];
+  char name[300];
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  /* A client may send a BYE to a closed connection.  */
+  signal (SIGPIPE, SIG_IGN);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  /* assuan_socket_connect requires an absolute name.  */
+  if (!getcwd (cwd, sizeof cwd))
+    log_fatal ("getcwd failed: %s\n", strerror (errno));
+  snprintf (name, sizeof name, "%s/acceptall-%d.sock", cwd, (int)getpid ());
+  check_accept_all (name);
+
+  return errorcount ? 1 : 0;
+}
@@ -0,0 +1,782 @@
+/* benchmark.c - Throughput and latency benchmarks.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program is not run by "make check" but by "make bench".  It
+   forks a server for each transport and prints the results as one
+   JSON object to stdout so that they can be compared between
+   versions.  Diagnostics go to stderr.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* Size of the chunks used to send data.  */
+#define CHUNKSIZE 65536
+
+enum transport
+  {
+    TRANSPORT_PIPE,
+    TRANSPORT_SOCKETPAIR,
+    TRANSPORT_UNIX,
+    TRANSPORT_SHM,   /* A socketpair switched to shared memory.  */
+    TRANSPORT_MEMFD  /* A socketpair passing data as memfds.  */
+  };
+
+static const char *transport_names[] = { "pipe", "socketpair", "unix",
+                                         "shm", "memfd" };
+
+enum payload
+  {
+    PAYLOAD_RANDOM,
+    PAYLOAD_TEXT,
+    PAYLOAD_ESCAPE
+  };
+
+static const char *payload_names[] = { "random", "text", "escape" };
+
+/* One chunk of each kind of payload.  */
+static unsigned char *payload_buffer[3];
+
+/* Divisor for the default number of iterations (--quick).  */
+static int scale = 1;
+
+/* The name used to exec the pipe server.  */
+static const char *program_name;
+
+/* Whether a result has already been printed.  */
+static int any_result;
+
+
+/* Return a monotonic timestamp in nanoseconds.  */
+static unsigned long long
+timestamp (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Fill the payload buffers.  TEXT looks like a base64 armored
+   message, ESCAPE consists only of characters which need to be
+   escaped in a data line.  */
+static void
+init_payloads (void)
+{
+  static const char escapes[] = "%\r\n";
+  unsigned char *p;
+  unsigned int seed = 4711;
+  int i;
+
+  for (i = 0; i < DIM (payload_buffer); i++)
+    payload_buffer[i] = xmalloc (CHUNKSIZE);
+
+  for (p = payload_buffer[PAYLOAD_RANDOM], i = 0; i < CHUNKSIZE; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      p[i] = seed >> 16;
+    }
+  for (p = payload_buffer[PAYLOAD_TEXT], i = 0; i < CHUNKSIZE; i++)
+    p[i] = (i % 65) == 64? '\n' : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"
+                                  "ghijklmnopqrstuvwxyz0123456789+/"[i % 64];
+  for (p = payload_buffer[PAYLOAD_ESCAPE], i = 0; i < CHUNKSIZE; i++)
+    p[i] = escapes[i % 3];
+}
+
+
+/* Print one JSON result object.  FORMAT describes the members
+   following the bench and transport members.  */
+static void
+print_result (const char *bench, const char *transport,
+              const char *format, ...)
+{
+  va_list arg_ptr;
+
+  printf ("%s\n    { \"bench\": \"%s\"", any_result? ",":"", bench);
+  if (transport)
+    printf (", \"transport\": \"%s\"", transport);
+  if (format)
+    {
+      printf (", ");
+      va_start (arg_ptr, format);
+      vprintf (format, arg_ptr);
+      va_end (arg_ptr);
+    }
+  printf (" }");
+  any_result = 1;
+}
+
+
+
+/*
+
+       S E R V E R
+
+*/
+
+/* DATA <kind> <n>
+
+   Send N bytes of payload KIND as data lines.  */
+static gpg_error_t
+cmd_data (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err = 0;
+  int kind;
+  unsigned long n;
+  size_t nbytes;
+
+  kind = atoi (line);
+  while (*line && *line != ' ')
+    line++;
+  n = strtoul (line, NULL, 10);
+  if (kind < 0 || kind >= DIM (payload_buffer))
+    return gpg_error (GPG_ERR_ASS_PARAMETER);
+
+  while (n && !err)
+    {
+      nbytes = n < CHUNKSIZE? n : CHUNKSIZE;
+      err = assuan_send_data (ctx, payload_buffer[kind], nbytes);
+      n -= nbytes;
+    }
+  return err;
+}
+
+
+/* INQ <n>
+
+   Inquire N bytes from the client.  */
+static gpg_error_t
+cmd_inq (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  unsigned long n;
+  unsigned char *buffer;
+  size_t length;
+
+  n = strtoul (line, NULL, 10);
+  err = assuan_inquire (ctx, "BLOB", &buffer, &length, n);
+  if (err)
+    return err;
+  if (length != n)
+    err = gpg_error (GPG_ERR_ASS_PARAMETER);
+  assuan_free (ctx, buffer);
+  return err;
+}
+
+
+/* FDS <n>
+
+   Receive N descriptors and close them.  */
+static gpg_error_t
+cmd_fds (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err = 0;
+  unsigned long n;
+  assuan_fd_t fd;
+
+  for (n = strtoul (line, NULL, 10); n && !err; n--)
+    {
+      err = assuan_receivefd (ctx, &fd);
+      if (!err)
+        close (fd);
+    }
+  return err;
+}
+
+
+/* Close a descriptor received by the INPUT command right away.  */
+static gpg_error_t
+input_notify (assuan_context_t ctx, char *line)
+{
+  (void)line;
+
+  close (assuan_get_input_fd (ctx));
+  return 0;
+}
+
+
+static void
+server (assuan_context_t ctx)
+{
+  gpg_error_t err;
+
+  err = assuan_register_command (ctx, "DATA", cmd_data, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "INQ", cmd_inq, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "FDS", cmd_fds, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "INPUT", NULL, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "TRANSPORT", NULL, NULL);
+  if (!err)
+    err = assuan_register_input_notify (ctx, input_notify);
+  if (err)
+    log_fatal ("register_commands failed: %s\n", gpg_strerror (err));
+
+  for (;;)
+    {
+      err = assuan_accept (ctx);
+      if (err)
+        {
+          if (err != -1)
+            log_error ("assuan_accept failed: %s\n", gpg_strerror (err));
+          break;
+        }
+      err = assuan_process (ctx);
+      if (err)
+        log_error ("assuan_process failed: %s\n", gpg_strerror (err));
+    }
+
+  assuan_release (ctx);
+}
+
+
+/* Run a server for the pipe and socketpair transports in the process
+   created by assuan_pipe_connect.  */
+static void
+pipe_server (void)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  assuan_fd_t filedes[2];
+
+  /* Note that the socketpair passed by the environment takes
+     precedence over stdin and stdout.  */
+  filedes[0] = assuan_fdopen (0);
+  filedes[1] = assuan_fdopen (1);
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_init_pipe_server (ctx, filedes);
+  if (err)
+    log_fatal ("assuan_init_pipe_server failed: %s\n", gpg_strerror (err));
+  server (ctx);
+}
+
+
+/* Run a server for the Unix domain socket transport on the listening
+   socket FD.  */
+static void
+socket_server (int fd)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  int conn;
+
+  conn = accept (fd, NULL, NULL);
+  if (conn == -1)
+    log_fatal ("accept failed: %s\n", strerror (errno));
+  close (fd);
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_init_socket_server (ctx, conn, ASSUAN_SOCKET_SERVER_FDPASSING
+                                   | ASSUAN_SOCKET_SERVER_ACCEPTED);
+  if (err)
+    log_fatal ("assuan_init_socket_server failed: %s\n", gpg_strerror (err));
+  server (ctx);
+}
+
+
+
+/*
+
+       C L I E N T
+
+*/
+
+/* Connect to a new server process using transport TRANSPORT and
+   return the context.  The server process is terminated when the
+   context is released.  */
+static assuan_context_t
+connect_server (enum transport transport)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  int no_close_fds[2];
+  const char *loc;
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+
+  fflush (stdout);
+  if (transport == TRANSPORT_UNIX)
+    {
+      static char sockname[100];
+      struct sockaddr_un addr;
+      int fd;
+      pid_t pid;
+
+      snprintf (sockname, sizeof sockname, "/tmp/assuan-bench-%u.S",
+                (unsigned int)getpid ());
+      remove (sockname);
+      memset (&addr, 0, sizeof addr);
+      addr.sun_family = AF_UNIX;
+      strcpy (addr.sun_path, sockname);
+      fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (fd == -1
+          || bind (fd, (struct sockaddr *)&addr, sizeof addr)
+          || listen (fd, 1))
+        log_fatal ("creating socket `%s' failed: %s\n",
+                   sockname, strerror (errno));
+
+      pid = fork ();
+      if (pid == (pid_t)-1)
+        log_fatal ("fork failed: %s\n", strerror (errno));
+      if (!pid)
+        {
+          socket_server (fd);
+          exit (0);
+        }
+      close (fd);
+
+      err = assuan_socket_connect (ctx, sockname, pid,
+                                   ASSUAN_SOCKET_CONNECT_FDPASSING);
+      remove (sockname);
+      if (err)
+        log_fatal ("assuan_socket_connect failed: %s\n", gpg_strerror (err));
+    }
+  else if (transport == TRANSPORT_PIPE)
+    {
+      const char *arglist[3];
+
+      /* Pipe servers are only supported with a real exec.  */
+      arglist[0] = program_name;
+      arglist[1] = "--server";
+      arglist[2] = NULL;
+      no_close_fds[0] = 2;
+      no_close_fds[1] = -1;
+      err = assuan_pipe_connect (ctx, program_name, arglist, no_close_fds,
+                                 NULL, NULL, 0);
+      if (err)
+        log_fatal ("assuan_pipe_connect failed: %s\n", gpg_strerror (err));
+    }
+  else
+    {
+      no_close_fds[0] = 2;
+      no_close_fds[1] = -1;
+      err = assuan_pipe_connect (ctx, NULL, &loc, no_close_fds, NULL, NULL,
+                                 ASSUAN_PIPE_CONNECT_FDPASSING);
+      if (err)
+        log_fatal ("assuan_pipe_connect failed: %s\n", gpg_strerror (err));
+      if (loc[0] == 's')
+        {
+          assuan_release (ctx);
+          pipe_server ();
+          exit (0);
+        }
+      if (transport == TRANSPORT_SHM)
+        {
+          err = assuan_use_shm_transport (ctx, 0);
+          if (err)
+            log_fatal ("assuan_use_shm_transport failed: %s\n",
+                       gpg_strerror (err));
+        }
+      else if (transport == TRANSPORT_MEMFD)
+        {
+          err = assuan_use_memfd_data (ctx, 0);
+          if (err)
+            log_fatal ("assuan_use_memfd_data failed: %s\n",
+                       gpg_strerror (err));
+        }
+    }
+
+  return ctx;
+}
+
+
+static void
+transact (assuan_context_t ctx, const char *command,
+          gpg_error_t (*data_cb)(void *, const void *, size_t),
+          void *data_cb_arg,
+          gpg_error_t (*inquire_cb)(void*, const char *),
+          void *inquire_cb_arg)
+{
+  gpg_error_t err;
+
+  err = assuan_transact (ctx, command, data_cb, data_cb_arg,
+                         inquire_cb, inquire_cb_arg, NULL, NULL);
+  if (err)
+    log_fatal ("command `%s' failed: %s\n", command, gpg_strerror (err));
+}
+
+
+/* Measure the rate of NOP commands.  */
+static void
+bench_nop (enum transport transport)
+{
+  assuan_context_t ctx;
+  unsigned long count = 20000 / scale;
+  unsigned long i;
+  unsigned long long start, elapsed;
+
+  ctx = connect_server (transport);
+  start = timestamp ();
+  for (i = 0; i < count; i++)
+    transact (ctx, "NOP", NULL, NULL, NULL, NULL);
+  elapsed = timestamp () - start;
+  assuan_release (ctx);
+
+  print_result ("nop", transport_names[transport],
+                "\"count\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f",
+                count, elapsed / 1e9, count / (elapsed / 1e9));
+}
+
+
+static int
+cmp_ull (const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Measure the distribution of the round trip time of a transaction.  */
+static void
+bench_latency (enum transport transport)
+{
+  assuan_context_t ctx;
+  unsigned long count = 10000 / scale;
+  unsigned long i;
+  unsigned long long *samples, sum, t;
+
+  samples = xcalloc (count, sizeof *samples);
+  ctx = connect_server (transport);
+  for (i = 0, sum = 0; i < count; i++)
+    {
+      t = timestamp ();
+      transact (ctx, "NOP", NULL, NULL, NULL, NULL);
+      samples[i] = timestamp () - t;
+      sum += samples[i];
+    }
+  assuan_release (ctx);
+
+  qsort (samples, count, sizeof *samples, cmp_ull);
+  print_result ("transact_latency", transport_names[transport],
+                "\"count\": %lu, \"unit\": \"ns\", \"min\": %llu,"
+                " \"p50\": %llu, \"p90\": %llu, \"p99\": %llu,"
+                " \"p999\": %llu, \"max\": %llu, \"mean\": %llu",
+                count, samples[0], samples[count / 2],
+                samples[count * 9 / 10], samples[count * 99 / 100],
+                samples[count * 999 / 1000], samples[count - 1],
+                sum / count);
+  xfree (samples);
+}
+
+
+static gpg_error_t
+count_data_cb (void *opaque, const void *buffer, size_t length)
+{
+  (void)buffer;
+
+  *(unsigned long *)opaque += length;
+  return 0;
+}
+
+
+/* Measure the throughput of data lines sent by the server.  */
+static void
+bench_data (enum transport transport, enum payload kind)
+{
+  assuan_context_t ctx;
+  unsigned long total = (64UL << 20) / scale;
+  unsigned long received = 0;
+  unsigned long long start, elapsed;
+  struct assuan_stats stats;
+  char command[50];
+
+  snprintf (command, sizeof command, "DATA %d %lu", kind, total);
+  ctx = connect_server (transport);
+  start = timestamp ();
+  transact (ctx, command, count_data_cb, &received, NULL, NULL);
+  elapsed = timestamp () - start;
+  assuan_get_stats (ctx, &stats, sizeof stats);
+  assuan_release (ctx);
+  if (received != total)
+    log_error ("DATA: received %lu of %lu bytes\n", received, total);
+
+  print_result ("data", transport_names[transport],
+                "\"payload\": \"%s\", \"bytes\": %lu, \"wire_bytes\": %llu,"
+                " \"read_calls\": %llu, \"seconds\": %.6f,"
+                " \"mib_per_sec\": %.1f",
+                payload_names[kind], total, stats.bytes_in,
+                stats.read_calls, elapsed / 1e9,
+                total / (elapsed / 1e9) / (1 << 20));
+}
+
+
+struct blob_parm_s
+{
+  assuan_context_t ctx;
+  unsigned long total;
+};
+
+
+static gpg_error_t
+send_blob_cb (void *opaque, const char *line)
+{
+  struct blob_parm_s *parm = opaque;
+  unsigned long n = parm->total;
+  gpg_error_t err = 0;
+  size_t nbytes;
+
+  (void)line;
+
+  while (n && !err)
+    {
+      nbytes = n < CHUNKSIZE? n : CHUNKSIZE;
+      err = assuan_send_data (parm->ctx, payload_buffer[PAYLOAD_RANDOM],
+                              nbytes);
+      n -= nbytes;
+    }
+  return err;
+}
+
+
+/* Measure the throughput of an inquiry.  */
+static void
+bench_inquire (enum transport transport)
+{
+  struct blob_parm_s parm;
+  unsigned long long start, elapsed;
+  char command[50];
+
+  parm.total = (64UL << 20) / scale;
+  snprintf (command, sizeof command, "INQ %lu", parm.total);
+  parm.ctx = connect_server (transport);
+  start = timestamp ();
+  transact (parm.ctx, command, NULL, NULL, send_blob_cb, &parm);
+  elapsed = timestamp () - start;
+  assuan_release (parm.ctx);
+
+  print_result ("inquire", transport_names[transport],
+                "\"payload\": \"random\", \"bytes\": %lu, \"seconds\": %.6f,"
+                " \"mib_per_sec\": %.1f",
+                parm.total, elapsed / 1e9,
+                parm.total / (elapsed / 1e9) / (1 << 20));
+}
+
+
+/* Measure the rate at which file descriptors can be passed.  */
+static void
+bench_fdpass (enum transport transport)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  unsigned long count = 5000 / scale;
+  unsigned long i;
+  unsigned long long start, elapsed;
+  int fd;
+
+  fd = open ("/dev/null", O_RDONLY);
+  if (fd == -1)
+    log_fatal ("can't open /dev/null: %s\n", strerror (errno));
+
+  ctx = connect_server (transport);
+  start = timestamp ();
+  for (i = 0; i < count; i++)
+    {
+      err = assuan_sendfd (ctx, fd);
+      if (err)
+        log_fatal ("assuan_sendfd failed: %s\n", gpg_strerror (err));
+      transact (ctx, "INPUT FD", NULL, NULL, NULL, NULL);
+    }
+  elapsed = timestamp () - start;
+  assuan_release (ctx);
+  close (fd);
+
+  print_result ("fdpass", transport_names[transport],
+                "\"count\": %lu, \"seconds\": %.6f, \"fds_per_sec\": %.1f",
+                count, elapsed / 1e9, count / (elapsed / 1e9));
+}
+
+
+/* Same as bench_fdpass but send BATCH descriptors at once.  */
+static void
+bench_fdpass_batch (enum transport transport)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  unsigned long count = 5000 / scale;
+  unsigned long i;
+  unsigned long long start, elapsed;
+  assuan_fd_t fds[16];
+  char cmdline[20];
+  int fd;
+
+  fd = open ("/dev/null", O_RDONLY);
+  if (fd == -1)
+    log_fatal ("can't open /dev/null: %s\n", strerror (errno));
+  for (i = 0; i < DIM (fds); i++)
+    fds[i] = fd;
+  snprintf (cmdline, sizeof cmdline, "FDS %d", (int)DIM (fds));
+
+  ctx = connect_server (transport);
+  start = timestamp ();
+  for (i = 0; i < count; i += DIM (fds))
+    {
+      err = assuan_sendfds (ctx, fds, DIM (fds));
+      if (err)
+        log_fatal ("assuan_sendfds failed: %s\n", gpg_strerror (err));
+      transact (ctx, cmdline, NULL, NULL, NULL, NULL);
+    }
+  elapsed = timestamp () - start;
+  assuan_release (ctx);
+  close (fd);
+
+  print_result ("fdpass_batch", transport_names[transport],
+                "\"count\": %lu, \"batch\": %d, \"seconds\": %.6f, "
+                "\"fds_per_sec\": %.1f",
+                i, (int)DIM (fds), elapsed / 1e9, i / (elapsed / 1e9));
+}
+
+
+/* Return true if the benchmark NAME has been selected on the command
+   line.  */
+static int
+selected (const char *name, int argc, char **argv)
+{
+  if (!argc)
+    return 1;
+  for (; argc; argc--, argv++)
+    if (!strcmp (*argv, name))
+      return 1;
+  return 0;
+}
+
+
+
+/*
+
+     M A I N
+
+*/
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int is_server = 0;
+  int t, k;
+
+  if (argc)
+    {
+      program_name = *argv;
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--help"))
+        {
+          puts (
+"usage: ./benchmark [options] [nop|latency|data|inquire|fdpass|\n"
+"                                       fdpass_batch]\n"
+"\n"
+"Options:\n"
+"  --verbose      Show what is going on\n"
+"  --quick        Run only a tenth of the default iterations\n"
+);
+          exit (0);
+        }
+      if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = debug = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--quick"))
+        {
+          scale = 10;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--server"))
+        {
+          is_server = 1;
+          argc--; argv++;
+        }
+    }
+
+  assuan_set_assuan_log_prefix (log_prefix);
+  init_payloads ();
+
+  if (is_server)
+    {
+      pipe_server ();
+      return errorcount ? 1 : 0;
+    }
+
+  printf ("{ \"benchmark\": \"libassuan\", \"version\": \"%s\",\n"
+          "  \"results\": [", assuan_check_version (NULL));
+
+  for (t = 0; t < DIM (transport_names); t++)
+    {
+      if (t == TRANSPORT_SHM && assuan_use_shm_transport (NULL, 0))
+        continue;
+      if (t == TRANSPORT_MEMFD && assuan_use_memfd_data (NULL, 0))
+        continue;
+      if (selected ("nop", argc, argv))
+        bench_nop (t);
+      if (selected ("latency", argc, argv))
+        bench_latency (t);
+      if (selected ("data", argc, argv))
+        for (k = 0; k < DIM (payload_names); k++)
+          bench_data (t, k);
+      if (selected ("inquire", argc, argv))
+        bench_inquire (t);
+      if (selected ("fdpass", argc, argv) && t != TRANSPORT_PIPE
+          && !assuan_sendfd (NULL, ASSUAN_INVALID_FD))
+        bench_fdpass (t);
+      if (selected ("fdpass_batch", argc, argv) && t != TRANSPORT_PIPE
+          && !assuan_sendfd (NULL, ASSUAN_INVALID_FD))
+        bench_fdpass_batch (t);
+    }
+
+  printf ("\n  ]\n}\n");
+
+  return errorcount ? 1 : 0;
+}
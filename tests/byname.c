@@ -0,0 +1,187 @@
+/* byname.c - Check connecting to a host name.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* Return the milliseconds since START.  */
+static long
+elapsed (struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000
+    + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+
+/* Create a socket listening on the loopback address of FAMILY at
+   *PORT.  If *PORT is 0 a free port is taken and stored there.
+   Returns -1 if FAMILY is not available.  */
+static int
+listen_loopback (int family, unsigned short *port)
+{
+  struct sockaddr_in6 addr6;
+  struct sockaddr_in addr4;
+  struct sockaddr *addr;
+  socklen_t len;
+  int fd, one = 1;
+
+  fd = socket (family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (family == AF_INET6)
+    {
+      setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof one);
+      memset (&addr6, 0, sizeof addr6);
+      addr6.sin6_family = AF_INET6;
+      addr6.sin6_addr = in6addr_loopback;
+      addr6.sin6_port = htons (*port);
+      addr = (struct sockaddr *)&addr6;
+      len = sizeof addr6;
+    }
+  else
+    {
+      memset (&addr4, 0, sizeof addr4);
+      addr4.sin_family = AF_INET;
+      addr4.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      addr4.sin_port = htons (*port);
+      addr = (struct sockaddr *)&addr4;
+      len = sizeof addr4;
+    }
+  if (bind (fd, addr, len) || listen (fd, 5) || getsockname (fd, addr, &len))
+    {
+      close (fd);
+      return -1;
+    }
+  *port = ntohs (family == AF_INET6? addr6.sin6_port : addr4.sin_port);
+  return fd;
+}
+
+
+/* Connect to HOST at PORT and check that the connection has been
+   accepted by LFD.  */
+static void
+check_connect (const char *host, unsigned short port, int lfd)
+{
+  struct timeval start;
+  assuan_fd_t fd;
+  int afd;
+  long ms;
+
+  gettimeofday (&start, NULL);
+  fd = assuan_sock_connect_byname (host, port, 0, NULL, 0);
+  ms = elapsed (&start);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      log_error ("connecting to %s:%u failed: %s\n",
+                 host, port, strerror (errno));
+      return;
+    }
+  if (verbose)
+    log_info ("connecting to %s:%u took %ldms\n", host, port, ms);
+  /* A refused address is skipped without any delay.  */
+  if (ms > 200)
+    log_error ("connecting to %s:%u took %ldms\n", host, port, ms);
+  afd = accept (lfd, NULL, NULL);
+  if (afd < 0)
+    log_error ("connection to %s:%u not accepted\n", host, port);
+  else
+    close (afd);
+  assuan_sock_close (fd);
+}
+
+
+/*
+     M A I N
+ */
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  unsigned short port = 0;
+  unsigned short port6 = 0;
+  assuan_fd_t fd;
+  int lfd, lfd6;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  /* Only one family listens at each port; "localhost" may resolve to
+     both.  */
+  lfd = listen_loopback (AF_INET, &port);
+  if (lfd < 0)
+    log_fatal ("can't listen on 127.0.0.1: %s\n", strerror (errno));
+  check_connect ("127.0.0.1", port, lfd);
+  check_connect ("localhost", port, lfd);
+  /* Again, now from the cache.  */
+  check_connect ("localhost", port, lfd);
+
+  lfd6 = listen_loopback (AF_INET6, &port6);
+  if (lfd6 >= 0)
+    check_connect ("::1", port6, lfd6);
+  else if (verbose)
+    log_info ("skipping IPv6: %s\n", strerror (errno));
+
+  /* Nothing listens here anymore.  */
+  close (lfd);
+  fd = assuan_sock_connect_byname ("127.0.0.1", port, 0, NULL, 0);
+  if (fd != ASSUAN_INVALID_FD)
+    {
+      log_error ("connecting to a closed port succeeded\n");
+      assuan_sock_close (fd);
+    }
+  else if (errno != ECONNREFUSED)
+    log_error ("expected ECONNREFUSED but got: %s\n", strerror (errno));
+
+  if (lfd6 >= 0)
+    close (lfd6);
+  return errorcount ? 1 : 0;
+}
@@ -0,0 +1,422 @@
+/* deferred.c - Check finishing commands from worker threads.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* The number of status lines and data chunks sent by SIGN.  */
+#define NCHUNKS 50
+
+/* The size of each data chunk.  */
+#define CHUNK_SIZE 100
+
+/* The number of SIGN commands sent by the client.  */
+#define NSIGN 4
+
+
+/*
+
+       S E R V E R
+
+*/
+
+static int wakeup_fd[2];
+
+static pthread_t worker_thread;
+static int have_worker;
+
+/* The rounds of the event loop while a command was deferred.  */
+static unsigned int deferred_rounds;
+static unsigned int notifications;
+
+
+/* Called by the worker with the lock of the deferred command held.  */
+static void
+wakeup (void *opaque, assuan_context_t ctx)
+{
+  (void)opaque;
+  (void)ctx;
+
+  notifications++;
+  /* The pipe may be full if the event loop is slow; one byte is
+     enough to wake it up.  */
+  if (write (wakeup_fd[1], "", 1) < 0 && errno != EAGAIN)
+    log_error ("writing to the wakeup pipe failed: %s\n", strerror (errno));
+}
+
+
+/* The worker thread.  It sends its output in small pieces so that
+   the event loop writes it out while the worker is still queueing.  */
+static void *
+worker (void *arg)
+{
+  assuan_deferred_t def = arg;
+  char buf[CHUNK_SIZE];
+  gpg_error_t err = 0;
+  int i;
+
+  memset (buf, 'x', sizeof buf);
+  for (i = 0; i < NCHUNKS && !err; i++)
+    {
+      err = assuan_deferred_status (def, "PROGRESS", "sign");
+      if (!err)
+        err = assuan_deferred_data (def, buf, sizeof buf);
+      if (!(i % 10))
+        usleep (1000);
+    }
+  assuan_deferred_done (def, err);
+  return NULL;
+}
+
+
+static gpg_error_t
+cmd_sign (assuan_context_t ctx, char *line)
+{
+  assuan_deferred_t def;
+  gpg_error_t err;
+
+  (void)line;
+
+  /* The previous worker has finished because only one command of a
+     connection is deferred at a time.  */
+  if (have_worker)
+    {
+      pthread_join (worker_thread, NULL);
+      have_worker = 0;
+    }
+
+  err = assuan_defer (ctx, &def);
+  if (err)
+    return assuan_process_done (ctx, err);
+  if (!assuan_is_deferred (ctx))
+    log_error ("command not marked as deferred\n");
+  if (pthread_create (&worker_thread, NULL, worker, def))
+    {
+      log_error ("pthread_create failed: %s\n", strerror (errno));
+      assuan_deferred_done (def, gpg_error_from_syserror ());
+      return 0;
+    }
+  have_worker = 1;
+  return 0;
+}
+
+
+/* Run a poll loop for one connection.  While a command is deferred,
+   only the wakeup pipe is watched.  */
+static void
+server (assuan_fd_t fd)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  assuan_fd_t fds[2];
+  struct pollfd pfd[2];
+  char buf[256];
+  int nfds, done = 0;
+
+  if (pipe (wakeup_fd))
+    log_fatal ("pipe failed: %s\n", strerror (errno));
+  if (fcntl (wakeup_fd[0], F_SETFL, O_NONBLOCK)
+      || fcntl (wakeup_fd[1], F_SETFL, O_NONBLOCK))
+    log_fatal ("fcntl failed: %s\n", strerror (errno));
+
+  err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_init_socket_server (ctx, fd, 0);
+  if (!err)
+    err = assuan_register_command (ctx, "SIGN", cmd_sign, NULL);
+  if (!err)
+    err = assuan_register_deferred_notify (ctx, wakeup, NULL);
+  if (!err)
+    err = assuan_accept (ctx);
+  if (err)
+    log_fatal ("server setup failed: %s\n", gpg_strerror (err));
+  if (assuan_get_active_fds (ctx, 0, fds, DIM (fds)) != 1)
+    log_fatal ("no inbound fd\n");
+
+  while (!done)
+    {
+      pfd[0].fd = wakeup_fd[0];
+      pfd[0].events = POLLIN;
+      pfd[1].fd = fds[0];
+      pfd[1].events = POLLIN;
+      nfds = assuan_is_deferred (ctx)? 1 : 2;
+      if (nfds == 1)
+        deferred_rounds++;
+
+      if (poll (pfd, nfds, -1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          log_fatal ("poll failed: %s\n", strerror (errno));
+        }
+
+      if ((pfd[0].revents & POLLIN))
+        {
+          while (read (wakeup_fd[0], buf, sizeof buf) > 0)
+            ;
+          err = assuan_run_deferred (ctx, &done);
+          if (err)
+            {
+              log_error ("assuan_run_deferred failed: %s\n",
+                         gpg_strerror (err));
+              break;
+            }
+        }
+      if (nfds == 2 && pfd[1].revents && !done)
+        {
+          err = assuan_process_next (ctx, &done);
+          if (err)
+            {
+              log_error ("assuan_process_next failed: %s\n",
+                         gpg_strerror (err));
+              break;
+            }
+        }
+    }
+
+  if (have_worker)
+    pthread_join (worker_thread, NULL);
+
+  /* Each round while a command was deferred has been started by a
+     notification.  A loop which still waits for input would spin.  */
+  if (verbose)
+    log_info ("%u rounds while deferred, %u notifications\n",
+              deferred_rounds, notifications);
+  if (deferred_rounds > notifications + NSIGN)
+    log_error ("event loop ran %u rounds for %u notifications\n",
+               deferred_rounds, notifications);
+
+  assuan_release (ctx);
+  close (wakeup_fd[0]);
+  close (wakeup_fd[1]);
+}
+
+
+
+/*
+
+       C L I E N T
+
+*/
+
+struct sign_result_s
+{
+  size_t size;
+  int count;
+};
+
+
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct sign_result_s *res = opaque;
+  const char *p = buffer;
+  size_t n;
+
+  for (n = 0; n < length; n++)
+    if (p[n] != 'x')
+      return gpg_error (GPG_ERR_INV_DATA);
+  res->size += length;
+  return 0;
+}
+
+
+static gpg_error_t
+status_cb (void *opaque, const char *line)
+{
+  struct sign_result_s *res = opaque;
+
+  if (!strcmp (line, "PROGRESS sign"))
+    res->count++;
+  return 0;
+}
+
+
+/* Read the response to a SIGN sent with write.  */
+static gpg_error_t
+read_sign (assuan_context_t ctx, struct sign_result_s *res)
+{
+  gpg_error_t err;
+  assuan_response_t response;
+  char *line;
+  int linelen, off;
+
+  for (;;)
+    {
+      err = assuan_client_read_response (ctx, &line, &linelen);
+      if (!err)
+        err = assuan_client_parse_response (ctx, line, linelen,
+                                            &response, &off);
+      if (err)
+        return err;
+      if (response == ASSUAN_RESPONSE_DATA)
+        {
+          err = data_cb (res, line + off, linelen - off);
+          if (err)
+            return err;
+        }
+      else if (response == ASSUAN_RESPONSE_STATUS)
+        status_cb (res, line + off);
+      else if (response == ASSUAN_RESPONSE_OK)
+        return 0;
+      else
+        return gpg_error (GPG_ERR_ASS_UNEXPECTED_CMD);
+    }
+}
+
+
+static void
+check_result (const char *what, gpg_error_t err, struct sign_result_s *res)
+{
+  if (err)
+    log_error ("%s failed: %s\n", what, gpg_strerror (err));
+  else if (res->size != NCHUNKS * CHUNK_SIZE || res->count != NCHUNKS)
+    log_error ("%s returned %lu bytes and %d status lines\n",
+               what, (unsigned long)res->size, res->count);
+}
+
+
+static void
+client (const char *name)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  struct sign_result_s res;
+  assuan_fd_t fds[2];
+  int i;
+
+  err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_socket_connect (ctx, name, ASSUAN_INVALID_PID, 0);
+  if (err)
+    log_fatal ("assuan_socket_connect failed: %s\n", gpg_strerror (err));
+
+  for (i = 0; i < NSIGN / 2; i++)
+    {
+      memset (&res, 0, sizeof res);
+      err = assuan_transact (ctx, "SIGN", data_cb, &res,
+                             NULL, NULL, status_cb, &res);
+      check_result ("SIGN", err, &res);
+    }
+
+  /* The second command arrives while the first one is deferred.  It
+     is run by assuan_run_deferred once the first has finished.  */
+  if (assuan_get_active_fds (ctx, 1, fds, DIM (fds)) != 1
+      || write (fds[0], "SIGN\nSIGN\n", 10) != 10)
+    log_fatal ("writing SIGNs failed: %s\n", strerror (errno));
+  for (i = 0; i < NSIGN / 2; i++)
+    {
+      memset (&res, 0, sizeof res);
+      err = read_sign (ctx, &res);
+      check_result ("pipelined SIGN", err, &res);
+    }
+
+  assuan_release (ctx);
+}
+
+
+
+/*
+
+       M A I N
+
+*/
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  char cwd[256];
+  char name[300];
+  struct sockaddr_un addr_un;
+  assuan_fd_t fd;
+  pid_t pid;
+  int status;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  /* The server may answer a BYE after the client has gone.  */
+  signal (SIGPIPE, SIG_IGN);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  /* assuan_socket_connect requires an absolute name.  */
+  if (!getcwd (cwd, sizeof cwd))
+    log_fatal ("getcwd failed: %s\n", strerror (errno));
+  snprintf (name, sizeof name, "%s/deferred-%d.sock", cwd, (int)getpid ());
+  remove (name);
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  if (assuan_sock_set_sockaddr_un (name, (struct sockaddr *)&addr_un, NULL)
+      || assuan_sock_bind (fd, (struct sockaddr *)&addr_un, sizeof addr_un)
+      || listen (fd, 1))
+    log_fatal ("can't listen on `%s': %s\n", name, strerror (errno));
+
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    log_fatal ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      /* Don't hang around if the client dies.  */
+      alarm (30);
+      server (fd);
+      _exit (errorcount? 1 : 0);
+    }
+  assuan_sock_close (fd);
+
+  client (name);
+  if (waitpid (pid, &status, 0) != pid
+      || !WIFEXITED (status) || WEXITSTATUS (status))
+    log_error ("server failed\n");
+  remove (name);
+
+  return errorcount ? 1 : 0;
+}
@@ -69,6 +69,124 @@ cmd_echo (assuan_context_t ctx, char *line)
   return 0;
 }
 
+/* Inquire a blob and send it back.  */
+static gpg_error_t
+cmd_blob (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  unsigned char *buffer;
+  size_t length;
+
+  /* The buffer grows from a small start and is reused by the next
+     BLOB.  */
+  assuan_set_inquire_size_hint (ctx, 100);
+  err = assuan_inquire (ctx, "BLOB", &buffer, &length, 0);
+  if (err)
+    return err;
+  log_info ("got BLOB of %lu bytes\n", (unsigned long)length);
+  err = assuan_data_write (assuan_get_data_writer (ctx), buffer, length);
+  assuan_inquire_free (ctx, buffer);
+  return err;
+}
+
+
+/* Send the contents of the input fd back as data.  */
+static gpg_error_t
+cmd_cat (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  assuan_fd_t fd;
+
+  (void)line;
+
+  fd = assuan_get_input_fd (ctx);
+  if (fd == ASSUAN_INVALID_FD)
+    return gpg_error (GPG_ERR_ASS_NO_INPUT);
+  err = assuan_send_data_from_fd (ctx, fd, 0);
+  assuan_close_input_fd (ctx);
+  return err;
+}
+
+
+struct stream_parm_s
+{
+  size_t length;
+  unsigned int sum;
+  int abort;
+};
+
+static gpg_error_t
+stream_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct stream_parm_s *parm = opaque;
+  const unsigned char *p = buffer;
+  size_t n;
+
+  if (parm->abort)
+    return gpg_error (GPG_ERR_BAD_DATA);
+  for (n = 0; n < length; n++)
+    parm->sum += p[n];
+  parm->length += length;
+  return 0;
+}
+
+
+/* Inquire a blob chunk by chunk and return its length and the sum of
+   its bytes.  With "abort" the first chunk is rejected.  */
+static gpg_error_t
+cmd_stream (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  struct stream_parm_s parm;
+
+  memset (&parm, 0, sizeof parm);
+  parm.abort = !strcmp (line, "abort");
+  err = assuan_inquire_stream (ctx, "BLOB", 0, stream_cb, &parm);
+  if (err)
+    return err;
+  return assuan_data_printf (assuan_get_data_writer (ctx), "%lu %u",
+                             (unsigned long)parm.length, parm.sum);
+}
+
+
+/* Inquire a blob into a temporary file and return its length and the
+   sum of its bytes like STREAM.  */
+static gpg_error_t
+cmd_tofd (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  struct stream_parm_s parm;
+  FILE *fp;
+  int c;
+
+  (void)line;
+
+  fp = tmpfile ();
+  if (!fp)
+    return gpg_error_from_syserror ();
+  err = assuan_inquire_to_fd (ctx, "BLOB", fileno (fp), 0);
+  if (err)
+    {
+      fclose (fp);
+      return err;
+    }
+  memset (&parm, 0, sizeof parm);
+  rewind (fp);
+  while ((c = getc (fp)) != EOF)
+    {
+      parm.sum += c;
+      parm.length++;
+    }
+  fclose (fp);
+  /* Use the stdio wrapper here.  */
+  fp = assuan_get_data_fp (ctx);
+  if (!fp)
+    return gpg_error_from_syserror ();
+  fprintf (fp, "%lu %u", (unsigned long)parm.length, parm.sum);
+  return 0;
+}
+
+
 static gpg_error_t
 register_commands (assuan_context_t ctx)
 {
@@ -79,8 +197,13 @@ register_commands (assuan_context_t ctx)
   } table[] =
       {
 	{ "ECHO", cmd_echo },
+	{ "BLOB", cmd_blob },
+	{ "CAT", cmd_cat },
+	{ "STREAM", cmd_stream },
+	{ "TOFD", cmd_tofd },
 	{ "INPUT", NULL },
 	{ "OUTPUT", NULL },
+	{ "TRANSPORT", NULL },
 	{ NULL, NULL }
       };
   int i;
@@ -149,6 +272,225 @@ server (void)
 */
 
 
+#define BLOBSIZE 300000
+
+struct blob_parm_s
+{
+  assuan_context_t ctx;
+  unsigned char *blob;
+  int fd;               /* If not -1, send the blob from this file.  */
+  size_t received;
+  int mismatch;
+};
+
+
+static gpg_error_t
+blob_inquire_cb (void *opaque, const char *line)
+{
+  struct blob_parm_s *parm = opaque;
+  struct assuan_iovec iov[3];
+
+  if (parm->fd != -1)
+    return assuan_send_data_from_fd (parm->ctx, parm->fd, BLOBSIZE);
+
+  /* Split the blob so that data lines span the pieces.  */
+  iov[0].data = parm->blob;
+  iov[0].length = 1;
+  iov[1].data = parm->blob + 1;
+  iov[1].length = 1000;
+  iov[2].data = parm->blob + 1001;
+  iov[2].length = BLOBSIZE - 1001;
+  return assuan_send_data_iov (parm->ctx, iov, DIM (iov));
+}
+
+
+static gpg_error_t
+blob_data_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct blob_parm_s *parm = opaque;
+
+  if (parm->received + length > BLOBSIZE
+      || memcmp (parm->blob + parm->received, buffer, length))
+    parm->mismatch = 1;
+  parm->received += length;
+  return 0;
+}
+
+
+/* Send a blob with characters which need escaping back and forth,
+   first from memory and then from a file.  Finally have the server
+   send it back from the file.  */
+static int
+check_blob (assuan_context_t ctx)
+{
+  gpg_error_t rc;
+  struct blob_parm_s parm;
+  FILE *fp;
+  size_t i;
+  int pass;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctx = ctx;
+  parm.fd = -1;
+  parm.blob = xmalloc (BLOBSIZE);
+  for (i=0; i < BLOBSIZE; i++)
+    parm.blob[i] = i * 7;
+  fp = tmpfile ();
+  if (!fp || fwrite (parm.blob, BLOBSIZE, 1, fp) != 1 || fflush (fp))
+    log_fatal ("writing the blob failed: %s\n", strerror (errno));
+
+  for (pass=0; pass < 3; pass++)
+    {
+      rewind (fp);
+      parm.received = 0;
+      if (pass == 1)
+        parm.fd = fileno (fp);
+      if (pass < 2)
+        rc = assuan_transact (ctx, "BLOB", blob_data_cb, &parm,
+                              blob_inquire_cb, &parm, NULL, NULL);
+      else
+        {
+          rc = assuan_sendfd (ctx, fileno (fp));
+          if (!rc)
+            rc = assuan_transact (ctx, "INPUT FD", NULL, NULL, NULL, NULL,
+                                  NULL, NULL);
+          if (!rc)
+            rc = assuan_transact (ctx, "CAT", blob_data_cb, &parm,
+                                  NULL, NULL, NULL, NULL);
+        }
+      if (rc)
+        {
+          log_error ("sending BLOB failed in pass %d: %s\n",
+                     pass, gpg_strerror (rc));
+          break;
+        }
+      if (parm.mismatch || parm.received != BLOBSIZE)
+        {
+          log_error ("BLOB returned wrong data in pass %d\n", pass);
+          rc = -1;
+          break;
+        }
+    }
+  fclose (fp);
+  xfree (parm.blob);
+  return rc? -1 : 0;
+}
+
+
+static gpg_error_t
+stream_data_cb (void *opaque, const void *buffer, size_t length)
+{
+  char *result = opaque;
+  size_t n = strlen (result);
+
+  if (n + length >= 50)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  memcpy (result + n, buffer, length);
+  result[n + length] = 0;
+  return 0;
+}
+
+
+/* Send a blob which the server processes as it arrives.  Check that
+   the server can reject it early and still stays in sync.  */
+static int
+check_stream (assuan_context_t ctx)
+{
+  gpg_error_t rc;
+  struct blob_parm_s parm;
+  char result[50], expected[50];
+  unsigned int sum = 0;
+  size_t i;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctx = ctx;
+  parm.fd = -1;
+  parm.blob = xmalloc (BLOBSIZE);
+  for (i=0; i < BLOBSIZE; i++)
+    {
+      parm.blob[i] = i * 7;
+      sum += parm.blob[i];
+    }
+  snprintf (expected, sizeof expected, "%lu %u", (unsigned long)BLOBSIZE, sum);
+
+  rc = assuan_transact (ctx, "STREAM abort", NULL, NULL,
+                        blob_inquire_cb, &parm, NULL, NULL);
+  if (gpg_err_code (rc) != GPG_ERR_BAD_DATA)
+    {
+      log_error ("rejecting STREAM returned: %s\n", gpg_strerror (rc));
+      xfree (parm.blob);
+      return -1;
+    }
+
+  for (i=0; i < 2; i++)
+    {
+      const char *cmd = i? "TOFD" : "STREAM";
+
+      *result = 0;
+      rc = assuan_transact (ctx, cmd, stream_data_cb, result,
+                            blob_inquire_cb, &parm, NULL, NULL);
+      if (rc)
+        {
+          log_error ("sending %s failed: %s\n", cmd, gpg_strerror (rc));
+          break;
+        }
+      if (strcmp (result, expected))
+        {
+          log_error ("%s returned `%s' instead of `%s'\n",
+                     cmd, result, expected);
+          rc = -1;
+          break;
+        }
+    }
+  xfree (parm.blob);
+  return rc? -1 : 0;
+}
+
+
+/* Send several descriptors at once and use them one after the
+   other.  */
+static int
+check_batch (assuan_context_t ctx, const char *fname)
+{
+  gpg_error_t rc;
+  FILE *fp[3];
+  assuan_fd_t fds[3];
+  int i;
+
+  for (i=0; i < DIM (fp); i++)
+    {
+      fp[i] = fopen (fname, "r");
+      if (!fp[i])
+        log_fatal ("failed to open `%s': %s\n", fname, strerror (errno));
+      fds[i] = fileno (fp[i]);
+    }
+  rc = assuan_sendfds (ctx, fds, DIM (fds));
+  for (i=0; i < DIM (fp); i++)
+    fclose (fp[i]);
+  if (rc)
+    {
+      log_error ("assuan_sendfds failed: %s\n", gpg_strerror (rc));
+      return -1;
+    }
+
+  for (i=0; i < DIM (fds); i++)
+    {
+      rc = assuan_transact (ctx, "INPUT FD", NULL, NULL, NULL, NULL,
+                            NULL, NULL);
+      if (!rc)
+        rc = assuan_transact (ctx, "ECHO", NULL, NULL, NULL, NULL,
+                              NULL, NULL);
+      if (rc)
+        {
+          log_error ("using batched descriptor %d failed: %s\n",
+                     i, gpg_strerror (rc));
+          return -1;
+        }
+    }
+  return 0;
+}
+
+
 /* Client main.  If true is returned, a disconnect has not been done. */
 static int
 client (assuan_context_t ctx, const char *fname)
@@ -162,6 +504,20 @@ client (assuan_context_t ctx, const char *fname)
 
   for (i=0; i < 6; i++)
     {
+      if (i == 3)
+        {
+          /* Do the remaining rounds over the shared memory rings.  */
+          rc = assuan_use_shm_transport (ctx, 0);
+          if (gpg_err_code (rc) == GPG_ERR_NOT_SUPPORTED)
+            log_info ("shared memory transport not supported\n");
+          else if (rc)
+            {
+              log_error ("assuan_use_shm_transport failed: %s\n",
+                         gpg_strerror (rc));
+              return -1;
+            }
+        }
+
       fp = fopen (fname, "r");
       if (!fp)
         {
@@ -194,6 +550,35 @@ client (assuan_context_t ctx, const char *fname)
         }
     }
 
+  if (check_batch (ctx, fname))
+    return -1;
+
+  if (check_blob (ctx) || check_stream (ctx))
+    return -1;
+
+  /* Do it again but pass the blob with a memfd.  */
+  rc = assuan_use_memfd_data (ctx, 0);
+  if (gpg_err_code (rc) == GPG_ERR_NOT_SUPPORTED)
+    log_info ("memfd data not supported\n");
+  else if (rc)
+    {
+      log_error ("assuan_use_memfd_data failed: %s\n", gpg_strerror (rc));
+      return -1;
+    }
+  else
+    {
+      struct assuan_stats before, after;
+
+      assuan_get_stats (ctx, &before, sizeof before);
+      if (check_blob (ctx))
+        return -1;
+      assuan_get_stats (ctx, &after, sizeof after);
+      if (after.fds_received < before.fds_received + 2)
+        log_error ("BLOB was not returned as a memfd\n");
+      if (check_stream (ctx))
+        return -1;
+    }
+
   /* Give us some time to check with lsof that all descriptors are closed. */
 /*   sleep (10); */
 
@@ -0,0 +1,431 @@
+/* iowait.c - Check waiting for a non-blocking peer.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* Return the milliseconds since START.  */
+static long
+elapsed (struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000
+    + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+
+static void
+check_iowait (void)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  assuan_fd_t fds[2];
+  int p[2];
+  struct timeval start;
+  char *line;
+  size_t linelen;
+  long ms;
+  pid_t pid;
+
+  if (pipe (p))
+    log_fatal ("pipe failed: %s\n", strerror (errno));
+  if (fcntl (p[0], F_SETFL, fcntl (p[0], F_GETFL) | O_NONBLOCK))
+    log_fatal ("fcntl failed: %s\n", strerror (errno));
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  fds[0] = p[0];
+  fds[1] = p[1];
+  err = assuan_init_pipe_server (ctx, fds);
+  if (err)
+    log_fatal ("assuan_init_pipe_server failed: %s\n", gpg_strerror (err));
+
+  /* The line arrives while we are waiting.  With the old fixed sleep
+     this took at least 100ms.  */
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    log_fatal ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      usleep (20000);
+      if (write (p[1], "HELLO\n", 6) != 6)
+        _exit (1);
+      _exit (0);
+    }
+  gettimeofday (&start, NULL);
+  err = assuan_read_line (ctx, &line, &linelen);
+  ms = elapsed (&start);
+  waitpid (pid, NULL, 0);
+  if (err)
+    log_error ("reading HELLO failed: %s\n", gpg_strerror (err));
+  else if (linelen != 5 || memcmp (line, "HELLO", 5))
+    log_error ("read wrong line\n");
+  else if (ms >= 95)
+    log_error ("waiting for HELLO took %ldms\n", ms);
+  else if (verbose)
+    log_info ("waiting for HELLO took %ldms\n", ms);
+
+  /* Nothing arrives before the deadline.  */
+  assuan_set_io_deadline (ctx, time (NULL) + 1);
+  gettimeofday (&start, NULL);
+  err = assuan_read_line (ctx, &line, &linelen);
+  ms = elapsed (&start);
+  if (gpg_err_code (err) != GPG_ERR_TIMEOUT)
+    log_error ("expected a timeout but got: %s\n", gpg_strerror (err));
+  else if (ms > 2500)
+    log_error ("timeout took %ldms\n", ms);
+
+  /* The context is still usable after the timeout.  */
+  assuan_set_io_deadline (ctx, 0);
+  if (write (p[1], "WORLD\n", 6) != 6)
+    log_fatal ("write failed: %s\n", strerror (errno));
+  err = assuan_read_line (ctx, &line, &linelen);
+  if (err)
+    log_error ("reading WORLD failed: %s\n", gpg_strerror (err));
+  else if (linelen != 5 || memcmp (line, "WORLD", 5))
+    log_error ("read wrong line after the timeout\n");
+
+  assuan_release (ctx);
+}
+
+
+/* Check the timeout with a blocking descriptor and a peer which never
+   answers.  */
+static void
+check_timeout (void)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  int sv[2], sv2[2];
+  struct timeval start;
+  long ms;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv)
+      || socketpair (AF_UNIX, SOCK_STREAM, 0, sv2))
+    log_fatal ("socketpair failed: %s\n", strerror (errno));
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  assuan_set_io_timeout (ctx, 200);
+
+  /* No greeting.  */
+  gettimeofday (&start, NULL);
+  err = assuan_socket_connect_fd (ctx, sv[0], 0);
+  ms = elapsed (&start);
+  if (gpg_err_code (err) != GPG_ERR_TIMEOUT)
+    log_error ("expected a timeout for the greeting but got: %s\n",
+               gpg_strerror (err));
+  else if (ms < 150 || ms > 1500)
+    log_error ("timeout for the greeting took %ldms\n", ms);
+  close (sv[1]);
+
+  /* The context can be used again.  This time the command is not
+     answered.  */
+  if (write (sv2[1], "OK hello\n", 9) != 9)
+    log_fatal ("write failed: %s\n", strerror (errno));
+  err = assuan_socket_connect_fd (ctx, sv2[0], 0);
+  if (err)
+    log_error ("connect after the timeout failed: %s\n", gpg_strerror (err));
+  else
+    {
+      err = assuan_transact (ctx, "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+      if (gpg_err_code (err) != GPG_ERR_TIMEOUT)
+        log_error ("expected a timeout for NOP but got: %s\n",
+                   gpg_strerror (err));
+    }
+
+  /* This must not block.  */
+  assuan_release (ctx);
+  close (sv2[1]);
+}
+
+
+/* Wait until FD is ready for EVENTS.  */
+static void
+wait_events (assuan_fd_t fd, unsigned int events)
+{
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = 0;
+  if ((events & ASSUAN_IO_WANT_READ))
+    pfd.events |= POLLIN;
+  if ((events & ASSUAN_IO_WANT_WRITE))
+    pfd.events |= POLLOUT;
+  if (poll (&pfd, 1, 5000) != 1)
+    log_fatal ("poll failed or timed out\n");
+}
+
+
+/* Check the asynchronous connect to NAME with a server listening on
+   SOCKNAME which is driven by us.  */
+static void
+check_async_connect (const char *name, const char *sockname)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  struct sockaddr_un addr_un;
+  assuan_fd_t fd, lfd;
+  unsigned int events;
+  int sfd;
+
+  remove (sockname);
+  lfd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (lfd == ASSUAN_INVALID_FD)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  if (assuan_sock_set_sockaddr_un (sockname, (struct sockaddr *)&addr_un,
+                                   NULL)
+      || assuan_sock_bind (lfd, (struct sockaddr *)&addr_un, sizeof addr_un)
+      || listen (lfd, 5))
+    log_fatal ("can't listen on `%s': %s\n", sockname, strerror (errno));
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+
+  /* The greeting has not been sent yet.  */
+  err = assuan_socket_connect_start (ctx, name, 0, &fd, &events);
+  if (gpg_err_code (err) != GPG_ERR_EAGAIN)
+    log_fatal ("assuan_socket_connect_start returned: %s\n",
+               gpg_strerror (err));
+  if (events == ASSUAN_IO_WANT_WRITE)
+    {
+      wait_events (fd, events);
+      err = assuan_socket_connect_step (ctx, &fd, &events);
+      if (gpg_err_code (err) != GPG_ERR_EAGAIN)
+        log_fatal ("assuan_socket_connect_step returned: %s\n",
+                   gpg_strerror (err));
+    }
+  if (events != ASSUAN_IO_WANT_READ)
+    log_error ("not waiting for the greeting\n");
+
+  sfd = accept (lfd, NULL, NULL);
+  if (sfd < 0)
+    log_fatal ("accept failed: %s\n", strerror (errno));
+
+  /* A partial greeting is kept.  */
+  if (write (sfd, "# hello\nOK Pl", 13) != 13)
+    log_fatal ("write failed: %s\n", strerror (errno));
+  wait_events (fd, events);
+  err = assuan_socket_connect_step (ctx, &fd, &events);
+  if (gpg_err_code (err) != GPG_ERR_EAGAIN || events != ASSUAN_IO_WANT_READ)
+    log_error ("partial greeting: %s\n", gpg_strerror (err));
+
+  if (write (sfd, "eased to meet you\nOK\n", 21) != 21)
+    log_fatal ("write failed: %s\n", strerror (errno));
+  wait_events (fd, events);
+  err = assuan_socket_connect_step (ctx, &fd, &events);
+  if (err)
+    log_error ("completing the connect failed: %s\n", gpg_strerror (err));
+  else
+    {
+      /* The context is usable; the "OK" answers the NOP.  */
+      err = assuan_transact (ctx, "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        log_error ("NOP failed: %s\n", gpg_strerror (err));
+    }
+
+  assuan_release (ctx);
+  close (sfd);
+
+  /* A greeting other than OK fails the connect.  */
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_socket_connect_start (ctx, name, 0, &fd, &events);
+  sfd = accept (lfd, NULL, NULL);
+  if (sfd < 0)
+    log_fatal ("accept failed: %s\n", strerror (errno));
+  if (write (sfd, "ERR 1 go away\n", 14) != 14)
+    log_fatal ("write failed: %s\n", strerror (errno));
+  while (gpg_err_code (err) == GPG_ERR_EAGAIN)
+    {
+      wait_events (fd, events);
+      err = assuan_socket_connect_step (ctx, &fd, &events);
+    }
+  if (gpg_err_code (err) != GPG_ERR_ASS_CONNECT_FAILED)
+    log_error ("expected the connect to fail but got: %s\n",
+               gpg_strerror (err));
+  close (sfd);
+  assuan_release (ctx);
+
+  assuan_sock_close (lfd);
+  remove (sockname);
+}
+
+
+/* Write a redirection file FNAME pointing to SOCKNAME.  */
+static void
+write_redirection (const char *fname, const char *sockname)
+{
+  FILE *fp;
+
+  fp = fopen (fname, "wb");
+  if (!fp)
+    log_fatal ("can't create `%s': %s\n", fname, strerror (errno));
+  fprintf (fp, "%%Assuan%%\nsocket=%s\n", sockname);
+  if (fclose (fp))
+    log_fatal ("can't write `%s': %s\n", fname, strerror (errno));
+}
+
+
+/* Check that a changed redirection file is noticed.  */
+static void
+check_redirection (const char *fname, const char *sockname)
+{
+  struct sockaddr_un addr_un;
+  char other[300];
+  int redirected;
+
+  if (snprintf (other, sizeof other, "%s.other", sockname) >= sizeof other)
+    log_fatal ("socket name too long\n");
+
+  write_redirection (fname, sockname);
+  check_async_connect (fname, sockname);
+
+  write_redirection (fname, other);
+  if (assuan_sock_set_sockaddr_un (fname, (struct sockaddr *)&addr_un,
+                                   &redirected))
+    log_error ("resolving `%s' failed: %s\n", fname, strerror (errno));
+  else if (!redirected || strcmp (addr_un.sun_path, other))
+    log_error ("changed redirection not noticed: %s\n", addr_un.sun_path);
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  /* The same size within the same second.  The file times are only
+     updated with each clock tick.  */
+  other[strlen (other) - 1] = 'X';
+  usleep (20000);
+  write_redirection (fname, other);
+  if (assuan_sock_set_sockaddr_un (fname, (struct sockaddr *)&addr_un,
+                                   &redirected))
+    log_error ("resolving `%s' failed: %s\n", fname, strerror (errno));
+  else if (!redirected || strcmp (addr_un.sun_path, other))
+    log_error ("rewritten redirection not noticed: %s\n", addr_un.sun_path);
+#endif
+
+  remove (fname);
+}
+
+
+/* Check that a refused connection is noticed with a deferred
+   greeting.  */
+static void
+check_deferred_greeting (void)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  int sv[2];
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+    log_fatal ("socketpair failed: %s\n", strerror (errno));
+  if (write (sv[1], "ERR 1 go away\nOK\n", 17) != 17)
+    log_fatal ("write failed: %s\n", strerror (errno));
+
+  err = assuan_new (&ctx);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_socket_connect_fd (ctx, sv[0],
+                                  ASSUAN_SOCKET_CONNECT_DEFER_GREETING);
+  if (err)
+    log_error ("connect failed: %s\n", gpg_strerror (err));
+  else
+    {
+      err = assuan_transact (ctx, "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+      if (gpg_err_code (err) != GPG_ERR_ASS_CONNECT_FAILED)
+        log_error ("expected the connect to fail but got: %s\n",
+                   gpg_strerror (err));
+      /* The line after the refusal is not taken as a response.  */
+      err = assuan_transact (ctx, "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+      if (!err)
+        log_error ("NOP succeeded after a refused connect\n");
+    }
+
+  assuan_release (ctx);
+  close (sv[1]);
+}
+
+
+/*
+     M A I N
+ */
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  char cwd[256];
+  char sockname[300];
+  char fname[300];
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  check_iowait ();
+  check_timeout ();
+  if (!getcwd (cwd, sizeof cwd))
+    log_fatal ("getcwd failed: %s\n", strerror (errno));
+  snprintf (sockname, sizeof sockname, "%s/iowait-%d.sock",
+            cwd, (int)getpid ());
+  check_async_connect (sockname, sockname);
+  snprintf (fname, sizeof fname, "%s/iowait-%d.redir", cwd, (int)getpid ());
+  check_redirection (fname, sockname);
+#ifdef HAVE_ABSTRACT_SOCKETS
+  snprintf (sockname, sizeof sockname, "@assuan-iowait-%d", (int)getpid ());
+  check_async_connect (sockname, sockname);
+#endif
+  check_deferred_greeting ();
+
+  return errorcount ? 1 : 0;
+}
@@ -0,0 +1,404 @@
+/* loopback.c - Check the assuan_loopback_connect call.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+typedef struct
+{
+  size_t len;
+  char buf[4096];
+} membuf_t;
+
+/* Whether the inquired data is given back with assuan_inquire_free.  */
+static int ask_free;
+
+/* The answer of the client to the inquiry.  */
+static char answer[3001];
+
+
+/* The server is driven by assuan_process_next, thus all command
+   handlers need to finish with assuan_process_done.  */
+static gpg_error_t
+cmd_echo (assuan_context_t ctx, char *line)
+{
+  return assuan_process_done (ctx, assuan_send_data (ctx, line,
+                                                     strlen (line)));
+}
+
+
+/* Sleep for the number of milliseconds given as argument.  */
+static gpg_error_t
+cmd_sleep (assuan_context_t ctx, char *line)
+{
+  usleep (atoi (line) * 1000);
+  return assuan_process_done (ctx, 0);
+}
+
+
+static gpg_error_t
+ask_done (void *opaque, gpg_error_t rc, unsigned char *buffer, size_t length)
+{
+  assuan_context_t ctx = opaque;
+
+  if (!rc)
+    rc = assuan_send_data (ctx, buffer, length);
+  if (ask_free)
+    assuan_inquire_free (ctx, buffer);
+  else
+    assuan_free (ctx, buffer);
+  return assuan_process_done (ctx, rc);
+}
+
+
+/* A blocking assuan_inquire can't work with a loopback connection
+   because the client may only answer after we returned.  With "free"
+   the buffer is given back with assuan_inquire_free.  */
+static gpg_error_t
+cmd_ask (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+
+  ask_free = !strcmp (line, "free");
+  err = assuan_inquire_ext (ctx, "WHAT", 0, ask_done, ctx);
+  if (err)
+    return assuan_process_done (ctx, err);
+  return 0;
+}
+
+
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  membuf_t *mb = opaque;
+
+  if (mb->len + length >= sizeof mb->buf)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  memcpy (mb->buf + mb->len, buffer, length);
+  mb->len += length;
+  mb->buf[mb->len] = 0;
+  return 0;
+}
+
+
+static gpg_error_t
+inquire_cb (void *opaque, const char *line)
+{
+  assuan_context_t ctx = opaque;
+
+  if (strcmp (line, "WHAT"))
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+  return assuan_send_data (ctx, answer, strlen (answer));
+}
+
+
+static int cb_calls;
+
+static gpg_error_t
+server_cb (void *opaque, assuan_context_t server)
+{
+  (void)opaque;
+
+  cb_calls++;
+  return assuan_process_next (server, NULL);
+}
+
+
+/* A callback which never runs the server.  */
+static gpg_error_t
+idle_cb (void *opaque, assuan_context_t server)
+{
+  (void)opaque;
+  (void)server;
+
+  return 0;
+}
+
+
+static void
+check_loopback (assuan_loopback_cb_t cb)
+{
+  gpg_error_t err;
+  assuan_context_t client, server;
+  membuf_t mb;
+  static const struct
+  {
+    const char *cmd;
+    size_t length;
+  } asks[] =
+    {
+      { "ASK", 3000 },
+      { "ASK", 3000 },
+      { "ASK", 3000 },
+      { "ASK", 3000 },
+      { "ASK free", 10 },
+      { "ASK free", 3000 },
+      { "ASK free", 10 }
+    };
+  int i;
+
+  err = assuan_new (&client);
+  if (!err)
+    err = assuan_new (&server);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_register_command (server, "ECHO", cmd_echo, NULL);
+  if (!err)
+    err = assuan_register_command (server, "ASK", cmd_ask, NULL);
+  if (err)
+    log_fatal ("assuan_register_command failed: %s\n", gpg_strerror (err));
+
+  err = assuan_loopback_connect (client, server, cb, NULL);
+  if (err)
+    log_fatal ("assuan_loopback_connect failed: %s\n", gpg_strerror (err));
+
+  mb.len = 0;
+  err = assuan_transact (client, "ECHO hello world", data_cb, &mb,
+                         NULL, NULL, NULL, NULL);
+  if (err)
+    log_error ("ECHO failed: %s\n", gpg_strerror (err));
+  else if (strcmp (mb.buf, "hello world"))
+    log_error ("ECHO returned wrong data `%s'\n", mb.buf);
+
+  mb.len = 0;
+  strcpy (answer, "forty-two");
+  err = assuan_transact (client, "ASK", data_cb, &mb,
+                         inquire_cb, client, NULL, NULL);
+  if (err)
+    log_error ("ASK failed: %s\n", gpg_strerror (err));
+  else if (strcmp (mb.buf, "forty-two"))
+    log_error ("ASK returned wrong data `%s'\n", mb.buf);
+
+  /* Mix both ways of giving back inquired data.  A buffer freed with
+     assuan_free may come back from malloc for a smaller inquiry.  */
+  for (i = 0; i < DIM (asks); i++)
+    {
+      memset (answer, 'a' + i, asks[i].length);
+      answer[asks[i].length] = 0;
+      mb.len = 0;
+      err = assuan_transact (client, asks[i].cmd, data_cb, &mb,
+                             inquire_cb, client, NULL, NULL);
+      if (err)
+        log_error ("%s failed: %s\n", asks[i].cmd, gpg_strerror (err));
+      else if (strcmp (mb.buf, answer))
+        log_error ("%s returned wrong data\n", asks[i].cmd);
+    }
+
+  err = assuan_transact (client, "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    log_error ("NOP failed: %s\n", gpg_strerror (err));
+
+  err = assuan_transact (client, "BYE", NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    log_error ("BYE failed: %s\n", gpg_strerror (err));
+
+  /* Release in the reverse order to check the shared state.  */
+  assuan_release (server);
+  assuan_release (client);
+}
+
+
+/* Check that a callback which does not run the server makes the
+   client fail instead of waiting forever.  */
+static void
+check_stuck (void)
+{
+  gpg_error_t err;
+  assuan_context_t client, server;
+
+  err = assuan_new (&client);
+  if (!err)
+    err = assuan_new (&server);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_loopback_connect (client, server, idle_cb, NULL);
+  if (err)
+    log_fatal ("assuan_loopback_connect failed: %s\n", gpg_strerror (err));
+
+  err = assuan_transact (client, "NOP", NULL, NULL, NULL, NULL, NULL, NULL);
+  if (gpg_err_code (err) != GPG_ERR_EDEADLK)
+    log_error ("NOP without a server returned: %s\n", gpg_strerror (err));
+
+  assuan_release (client);
+  assuan_release (server);
+}
+
+
+/* The number of slow command messages and the last one.  */
+static int slow_count;
+static char slow_msg[200];
+
+static int
+timing_log_cb (assuan_context_t ctx, void *hook, unsigned int cat,
+               const char *msg)
+{
+  (void)ctx;
+  (void)hook;
+
+  if (cat != ASSUAN_LOG_CONTROL)
+    return 0;
+  if (msg && !strncmp (msg, "slow command ", 13))
+    {
+      slow_count++;
+      snprintf (slow_msg, sizeof slow_msg, "%s", msg);
+    }
+  if (msg && debug)
+    fputs (msg, stderr);
+  return 1;
+}
+
+
+/* Parse the line for command NAME in the timing REPORT.  */
+static int
+parse_timing (const char *report, const char *name,
+              unsigned long long *r_count, unsigned long long *r_min,
+              unsigned long long *r_p50, unsigned long long *r_p999,
+              unsigned long long *r_max)
+{
+  const char *p = report;
+  size_t n = strlen (name);
+
+  while (p && *p)
+    {
+      if (!strncmp (p, name, n) && p[n] == ' ')
+        return sscanf (p + n, " count=%llu min=%llu p50=%llu p90=%*u"
+                       " p99=%*u p999=%llu max=%llu",
+                       r_count, r_min, r_p50, r_p999, r_max) == 5;
+      p = strchr (p, '\n');
+      if (p)
+        p++;
+    }
+  return 0;
+}
+
+
+static void
+check_timing (void)
+{
+  gpg_error_t err;
+  assuan_context_t client, server;
+  membuf_t mb;
+  char *report;
+  unsigned long long count, min, p50, p999, max;
+  int i;
+
+  err = assuan_new (&client);
+  if (!err)
+    err = assuan_new_ext (&server, GPG_ERR_SOURCE_DEFAULT,
+                          assuan_get_malloc_hooks (), timing_log_cb, NULL);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  err = assuan_register_command (server, "ECHO", cmd_echo, NULL);
+  if (!err)
+    err = assuan_register_command (server, "SLEEP", cmd_sleep, NULL);
+  if (err)
+    log_fatal ("assuan_register_command failed: %s\n", gpg_strerror (err));
+  assuan_set_flag (server, ASSUAN_COMMAND_TIMING, 1);
+  assuan_set_slow_command_threshold (server, 20);
+
+  err = assuan_loopback_connect (client, server, NULL, NULL);
+  if (err)
+    log_fatal ("assuan_loopback_connect failed: %s\n", gpg_strerror (err));
+
+  for (i = 0; i < 10; i++)
+    {
+      mb.len = 0;
+      err = assuan_transact (client, "ECHO x", data_cb, &mb,
+                             NULL, NULL, NULL, NULL);
+      if (err)
+        log_error ("ECHO failed: %s\n", gpg_strerror (err));
+    }
+  err = assuan_transact (client, "SLEEP 30", NULL, NULL,
+                         NULL, NULL, NULL, NULL);
+  if (!err)
+    err = assuan_transact (client, "SLEEP 60", NULL, NULL,
+                           NULL, NULL, NULL, NULL);
+  if (err)
+    log_error ("SLEEP failed: %s\n", gpg_strerror (err));
+
+  /* Only the SLEEPs are logged.  */
+  if (slow_count != 2)
+    log_error ("%d slow commands logged\n", slow_count);
+  else if (strncmp (slow_msg, "slow command SLEEP: ", 20))
+    log_error ("unexpected slow command message: %s", slow_msg);
+
+  err = assuan_get_command_timings (server, &report);
+  if (err)
+    log_fatal ("assuan_get_command_timings failed: %s\n", gpg_strerror (err));
+  if (verbose)
+    log_info ("command timings:\n%s", report);
+
+  if (!parse_timing (report, "ECHO", &count, &min, &p50, &p999, &max))
+    log_error ("no timing for ECHO\n");
+  else if (count != 10 || min > p50 || p50 > max || max >= 20000)
+    log_error ("wrong timing for ECHO\n");
+
+  /* With two values, the median lies in the bucket of the smaller one,
+     which spans at most 1/8 of its value, and the highest percentile
+     is capped at the maximum.  */
+  if (!parse_timing (report, "SLEEP", &count, &min, &p50, &p999, &max))
+    log_error ("no timing for SLEEP\n");
+  else if (count != 2 || min < 30000 || max < 60000
+           || p50 < min || p50 > min + min / 8 || p999 != max)
+    log_error ("wrong timing for SLEEP\n");
+
+  assuan_free (server, report);
+  assuan_release (client);
+  assuan_release (server);
+}
+
+
+/*
+     M A I N
+ */
+int
+main (int argc, char **argv)
+{
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  check_loopback (NULL);
+  check_loopback (server_cb);
+  if (!cb_calls)
+    log_error ("loopback callback was never called\n");
+  check_stuck ();
+  check_timing ();
+
+  return errorcount ? 1 : 0;
+}
@@ -0,0 +1,519 @@
+/* microbench.c - Benchmarks for the line and data line code.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program is run by "make bench".  Unlike benchmark.c it does
+   not use a real transport but replaces the read and write system
+   hooks by an in-memory stream.  This way only the cost of the data
+   line encoder, the data line decoder and the line splitter is
+   measured.  The results are printed as JSON to stdout.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* The descriptor passed to the system hooks.  It is never used for
+   real I/O.  */
+#define MEMIO_FD 4711
+
+/* An in-memory replacement for the connection.  Reads are served
+   from INBUF; writes are only counted.  */
+struct memio_s
+{
+  const char *inbuf;
+  size_t inlen;
+  size_t inpos;
+  unsigned long long written;
+};
+
+/* The number of allocations done through the malloc hooks.  */
+static unsigned long nallocs;
+
+/* Divisor for the default amount of work (--quick).  */
+static int scale = 1;
+
+/* Whether a result has already been printed.  */
+static int any_result;
+
+static size_t sizes[] = { 64, 1024, 65536 };
+static unsigned int escape_permille[] = { 0, 10, 100, 500, 1000 };
+static size_t line_lengths[] = { 16, 128, 998 };
+
+
+/* Return a monotonic timestamp in nanoseconds.  */
+static unsigned long long
+timestamp (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void *
+count_malloc (size_t n)
+{
+  nallocs++;
+  return malloc (n);
+}
+
+static void *
+count_realloc (void *p, size_t n)
+{
+  nallocs++;
+  return realloc (p, n);
+}
+
+static struct assuan_malloc_hooks malloc_hooks =
+  {
+    count_malloc, count_realloc, free
+  };
+
+
+static ssize_t
+memio_read (assuan_context_t ctx, assuan_fd_t fd, void *buffer, size_t size)
+{
+  struct memio_s *mio = assuan_get_pointer (ctx);
+
+  (void)fd;
+
+  if (size > mio->inlen - mio->inpos)
+    size = mio->inlen - mio->inpos;
+  memcpy (buffer, mio->inbuf + mio->inpos, size);
+  mio->inpos += size;
+  return size;
+}
+
+
+static ssize_t
+memio_write (assuan_context_t ctx, assuan_fd_t fd,
+             const void *buffer, size_t size)
+{
+  struct memio_s *mio = assuan_get_pointer (ctx);
+
+  (void)fd;
+  (void)buffer;
+
+  mio->written += size;
+  return size;
+}
+
+
+static int
+memio_close (assuan_context_t ctx, assuan_fd_t fd)
+{
+  (void)ctx;
+  (void)fd;
+  return 0;
+}
+
+
+static pid_t
+memio_waitpid (assuan_context_t ctx, pid_t pid, int nowait,
+               int *status, int options)
+{
+  (void)ctx;
+  (void)pid;
+  (void)nowait;
+  (void)status;
+  (void)options;
+  return 0;
+}
+
+
+static struct assuan_system_hooks memio_hooks =
+  {
+    ASSUAN_SYSTEM_HOOKS_VERSION,
+    __assuan_usleep,
+    __assuan_pipe,
+    memio_close,
+    memio_read,
+    memio_write,
+    __assuan_recvmsg,
+    __assuan_sendmsg,
+    __assuan_spawn,
+    memio_waitpid,
+    __assuan_socketpair,
+    __assuan_socket,
+    __assuan_connect
+  };
+
+
+/* Return a client context connected to the in-memory stream MIO.  */
+static assuan_context_t
+memio_connect (struct memio_s *mio)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  static const char greeting[] = "OK ready\n";
+
+  err = assuan_new_ext (&ctx, GPG_ERR_SOURCE_DEFAULT, &malloc_hooks,
+                        NULL, NULL);
+  if (err)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+  assuan_ctx_set_system_hooks (ctx, &memio_hooks);
+  assuan_set_pointer (ctx, mio);
+
+  memset (mio, 0, sizeof *mio);
+  mio->inbuf = greeting;
+  mio->inlen = strlen (greeting);
+  err = assuan_socket_connect_fd (ctx, MEMIO_FD, 0);
+  if (err)
+    log_fatal ("assuan_socket_connect_fd failed: %s\n", gpg_strerror (err));
+  return ctx;
+}
+
+
+/* Return a buffer of LENGTH bytes of which about PERMILLE/1000 need
+   to be escaped in a data line.  */
+static unsigned char *
+make_payload (size_t length, unsigned int permille)
+{
+  static const char escapes[] = "%\r\n";
+  static unsigned int seed = 4711;
+  unsigned char *buffer;
+  size_t i;
+
+  buffer = xmalloc (length);
+  for (i = 0; i < length; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      if ((seed >> 8) % 1000 < permille)
+        buffer[i] = escapes[(seed >> 20) % 3];
+      else
+        {
+          buffer[i] = seed >> 16;
+          if (buffer[i] == '%' || buffer[i] == '\r' || buffer[i] == '\n')
+            buffer[i] = 'x';
+        }
+    }
+  return buffer;
+}
+
+
+/* Return the number of iterations required to process about TOTAL
+   bytes in chunks of LENGTH.  */
+static unsigned long
+iterations (size_t length, unsigned long total)
+{
+  unsigned long n = total / scale / length;
+
+  return n? n : 1;
+}
+
+
+static void
+print_result (const char *bench, size_t length, unsigned int permille,
+              unsigned long count, unsigned long long bytes,
+              unsigned long long elapsed, unsigned long allocs)
+{
+  printf ("%s\n    { \"bench\": \"%s\", \"size\": %lu, \"escape_permille\": %u,"
+          " \"calls\": %lu, \"bytes\": %llu, \"ns_per_byte\": %.3f,"
+          " \"ns_per_call\": %.1f, \"allocs_per_call\": %.3f }",
+          any_result? ",":"", bench, (unsigned long)length, permille,
+          count, bytes, (double)elapsed / bytes, (double)elapsed / count,
+          (double)allocs / count);
+  any_result = 1;
+}
+
+
+/* Measure assuan_send_data which drives the data line encoder.  */
+static void
+bench_encode (size_t length, unsigned int permille)
+{
+  struct memio_s mio;
+  assuan_context_t ctx;
+  unsigned char *payload;
+  unsigned long count, i;
+  unsigned long long start, elapsed;
+  unsigned long allocs;
+  gpg_error_t err;
+
+  payload = make_payload (length, permille);
+  ctx = memio_connect (&mio);
+  count = iterations (length, 64UL << 20);
+
+  allocs = nallocs;
+  start = timestamp ();
+  for (i = 0; i < count; i++)
+    {
+      err = assuan_send_data (ctx, payload, length);
+      if (err)
+        log_fatal ("assuan_send_data failed: %s\n", gpg_strerror (err));
+    }
+  err = assuan_send_data (ctx, NULL, 0);
+  if (err)
+    log_fatal ("assuan_send_data failed: %s\n", gpg_strerror (err));
+  elapsed = timestamp () - start;
+  allocs = nallocs - allocs;
+
+  print_result ("encode", length, permille, count,
+                (unsigned long long)count * length, elapsed, allocs);
+  assuan_release (ctx);
+  xfree (payload);
+}
+
+
+/* Return a buffer with the PAYLOAD of LENGTH bytes encoded as data
+   lines.  The length of the result is stored at R_LENGTH.  */
+static char *
+encode_payload (const unsigned char *payload, size_t length, size_t *r_length)
+{
+  char *buffer, *p;
+  size_t i;
+  int linelen = 0;
+
+  p = buffer = xmalloc (3 * length + (length / 300 + 1) * 4);
+  for (i = 0; i < length; i++)
+    {
+      if (!linelen)
+        {
+          *p++ = 'D';
+          *p++ = ' ';
+          linelen = 2;
+        }
+      if (payload[i] == '%' || payload[i] == '\r' || payload[i] == '\n')
+        {
+          sprintf (p, "%%%02X", payload[i]);
+          p += 3;
+          linelen += 3;
+        }
+      else
+        {
+          *p++ = payload[i];
+          linelen++;
+        }
+      if (linelen >= ASSUAN_LINELENGTH - 2 - 2 || i + 1 == length)
+        {
+          *p++ = '\n';
+          linelen = 0;
+        }
+    }
+  *r_length = p - buffer;
+  return buffer;
+}
+
+
+/* Measure assuan_client_read_response which drives the data line
+   decoder.  */
+static void
+bench_decode (size_t length, unsigned int permille)
+{
+  struct memio_s mio;
+  assuan_context_t ctx;
+  unsigned char *payload;
+  char *input;
+  size_t inlen;
+  unsigned long count, i;
+  unsigned long long start, elapsed, decoded;
+  unsigned long allocs;
+  gpg_error_t err;
+  char *line;
+  int linelen;
+
+  payload = make_payload (length, permille);
+  input = encode_payload (payload, length, &inlen);
+  ctx = memio_connect (&mio);
+  count = iterations (length, 64UL << 20);
+
+  allocs = nallocs;
+  decoded = 0;
+  start = timestamp ();
+  for (i = 0; i < count; i++)
+    {
+      mio.inbuf = input;
+      mio.inlen = inlen;
+      mio.inpos = 0;
+      while (mio.inpos < mio.inlen || assuan_pending_line (ctx))
+        {
+          err = assuan_client_read_response (ctx, &line, &linelen);
+          if (err)
+            log_fatal ("assuan_client_read_response failed: %s\n",
+                       gpg_strerror (err));
+          decoded += linelen - 2;
+        }
+    }
+  elapsed = timestamp () - start;
+  allocs = nallocs - allocs;
+
+  if (decoded != (unsigned long long)count * length)
+    log_error ("decode: got %llu bytes instead of %llu\n",
+               decoded, (unsigned long long)count * length);
+
+  print_result ("decode", length, permille, count, decoded, elapsed, allocs);
+  assuan_release (ctx);
+  xfree (input);
+  xfree (payload);
+}
+
+
+/* Measure assuan_read_line which drives the line splitter with lines
+   of LENGTH bytes.  */
+static void
+bench_readline (size_t length)
+{
+  struct memio_s mio;
+  assuan_context_t ctx;
+  char *input;
+  size_t inlen, nlines, i;
+  unsigned long count, n;
+  unsigned long long start, elapsed, bytes;
+  unsigned long allocs;
+  gpg_error_t err;
+  char *line;
+  size_t linelen;
+
+  /* About 64k of status lines.  */
+  nlines = 65536 / (length + 1) + 1;
+  inlen = nlines * (length + 1);
+  input = xmalloc (inlen);
+  for (i = 0; i < nlines; i++)
+    {
+      memset (input + i * (length + 1), 'x', length);
+      memcpy (input + i * (length + 1), "S ", 2);
+      input[i * (length + 1) + length] = '\n';
+    }
+
+  ctx = memio_connect (&mio);
+  count = iterations (inlen, 64UL << 20);
+
+  allocs = nallocs;
+  bytes = 0;
+  start = timestamp ();
+  for (n = 0; n < count; n++)
+    {
+      mio.inbuf = input;
+      mio.inlen = inlen;
+      mio.inpos = 0;
+      for (i = 0; i < nlines; i++)
+        {
+          err = assuan_read_line (ctx, &line, &linelen);
+          if (err)
+            log_fatal ("assuan_read_line failed: %s\n", gpg_strerror (err));
+          bytes += linelen + 1;
+        }
+    }
+  elapsed = timestamp () - start;
+  allocs = nallocs - allocs;
+
+  if (bytes != (unsigned long long)count * inlen)
+    log_error ("readline: got %llu bytes instead of %llu\n",
+               bytes, (unsigned long long)count * inlen);
+
+  print_result ("readline", length, 0, count * nlines, bytes,
+                elapsed, allocs);
+  assuan_release (ctx);
+  xfree (input);
+}
+
+
+/* Return true if the benchmark NAME has been selected on the command
+   line.  */
+static int
+selected (const char *name, int argc, char **argv)
+{
+  if (!argc)
+    return 1;
+  for (; argc; argc--, argv++)
+    if (!strcmp (*argv, name))
+      return 1;
+  return 0;
+}
+
+
+
+/*
+
+     M A I N
+
+*/
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int i, j;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--help"))
+        {
+          puts (
+"usage: ./microbench [options] [encode|decode|readline]\n"
+"\n"
+"Options:\n"
+"  --verbose      Show what is going on\n"
+"  --quick        Do only a tenth of the default work\n"
+);
+          exit (0);
+        }
+      if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = debug = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--quick"))
+        {
+          scale = 10;
+          argc--; argv++;
+        }
+    }
+
+  assuan_set_assuan_log_prefix (log_prefix);
+
+  printf ("{ \"benchmark\": \"libassuan-micro\", \"version\": \"%s\",\n"
+          "  \"results\": [", assuan_check_version (NULL));
+
+  for (i = 0; i < DIM (sizes); i++)
+    for (j = 0; j < DIM (escape_permille); j++)
+      {
+        if (selected ("encode", argc, argv))
+          bench_encode (sizes[i], escape_permille[j]);
+        if (selected ("decode", argc, argv))
+          bench_decode (sizes[i], escape_permille[j]);
+      }
+  if (selected ("readline", argc, argv))
+    for (i = 0; i < DIM (line_lengths); i++)
+      bench_readline (line_lengths[i]);
+
+  printf ("\n  ]\n}\n");
+
+  return errorcount ? 1 : 0;
+}
@@ -193,8 +193,12 @@ data_cb (void *opaque, const void *buffer, size_t length)
 static void
 run_client (const char *servername)
 {
+  static const char echocmd[] = ("ECHO Your lucky number is 3552664958674928.  "
+                                 "Watch for it everywhere.");
+  const char *echotext = echocmd + 5;
   gpg_error_t err;
   assuan_context_t ctx;
+  struct assuan_stats stats;
   assuan_fd_t no_close_fds[2];
   const char *arglist[5];
 
@@ -223,15 +227,23 @@ run_client (const char *servername)
   log_info ("server started; pid is %ld\n",
             (long)assuan_get_pid (ctx));
   
-  err = assuan_transact (ctx, "ECHO Your lucky number is 3552664958674928.  "
-                         "Watch for it everywhere.",
-                         data_cb, NULL, NULL, NULL, NULL, NULL);
+  err = assuan_transact (ctx, echocmd, data_cb, NULL, NULL, NULL, NULL, NULL);
   if (err)
     {
       log_error ("sending ECHO failed: %s\n", gpg_strerror (err));
       return;
     }
 
+  err = assuan_get_stats (ctx, &stats, sizeof stats);
+  if (err)
+    log_error ("assuan_get_stats failed: %s\n", gpg_strerror (err));
+  else if (stats.lines_out != 1 || stats.lines_in < 3
+           || stats.data_in != strlen (echotext)
+           || stats.data_in_escaped != stats.data_in
+           || stats.errors || stats.read_calls < 1
+           || stats.bytes_out != strlen ("ECHO ") + strlen (echotext) + 1)
+    log_error ("unexpected statistics after ECHO\n");
+
   err = assuan_transact (ctx, "BYE", NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     {
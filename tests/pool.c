@@ -0,0 +1,371 @@
+/* pool.c - Check the client connection pool.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/*
+
+       S E R V E R
+
+*/
+
+static int connections;
+
+/* Return the number of the current connection.  */
+static gpg_error_t
+cmd_conn (assuan_context_t ctx, char *line)
+{
+  char buf[20];
+
+  (void)line;
+
+  snprintf (buf, sizeof buf, "%d", connections);
+  return assuan_send_data (ctx, buf, strlen (buf));
+}
+
+
+#define BULKSIZE 100000
+
+/* Send BULKSIZE bytes at once, which is enough to use a memfd.  */
+static gpg_error_t
+cmd_bulk (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  char *buf;
+
+  (void)line;
+
+  buf = xmalloc (BULKSIZE);
+  memset (buf, 'x', BULKSIZE);
+  err = assuan_send_data (ctx, buf, BULKSIZE);
+  xfree (buf);
+  return err;
+}
+
+
+static void
+server (assuan_fd_t fd)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+
+  err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_init_socket_server (ctx, fd, ASSUAN_SOCKET_SERVER_FDPASSING);
+  if (!err)
+    err = assuan_register_command (ctx, "CONN", cmd_conn, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "BULK", cmd_bulk, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "TRANSPORT", NULL, NULL);
+  if (err)
+    log_fatal ("server setup failed: %s\n", gpg_strerror (err));
+
+  for (;;)
+    {
+      err = assuan_accept (ctx);
+      if (err)
+        {
+          log_error ("assuan_accept failed: %s\n", gpg_strerror (err));
+          break;
+        }
+      connections++;
+      err = assuan_process (ctx);
+      if (err)
+        log_error ("assuan_process failed: %s\n", gpg_strerror (err));
+    }
+  assuan_release (ctx);
+}
+
+
+
+/*
+
+       C L I E N T
+
+*/
+
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  int *r_conn = opaque;
+  char buf[20];
+
+  if (length >= sizeof buf)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  memcpy (buf, buffer, length);
+  buf[length] = 0;
+  *r_conn = atoi (buf);
+  return 0;
+}
+
+
+/* Return the connection number the server has for CTX.  */
+static int
+get_conn (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  int conn = 0;
+
+  err = assuan_transact (ctx, "CONN", data_cb, &conn,
+                         NULL, NULL, NULL, NULL);
+  if (err)
+    log_error ("CONN failed: %s\n", gpg_strerror (err));
+  return conn;
+}
+
+
+static gpg_error_t
+bulk_cb (void *opaque, const void *buffer, size_t length)
+{
+  size_t *r_len = opaque;
+
+  (void)buffer;
+  *r_len += length;
+  return 0;
+}
+
+
+/* Check that the bulk data arrives.  */
+static void
+check_bulk (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  size_t len = 0;
+
+  err = assuan_transact (ctx, "BULK", bulk_cb, &len,
+                         NULL, NULL, NULL, NULL);
+  if (err)
+    log_error ("BULK failed: %s\n", gpg_strerror (err));
+  else if (len != BULKSIZE)
+    log_error ("BULK returned %lu bytes\n", (unsigned long)len);
+}
+
+
+static void
+client (const char *name, pid_t server_pid)
+{
+  gpg_error_t err;
+  assuan_pool_t pool;
+  assuan_context_t ctx, ctx2;
+
+  /* The first connection switches to the shared memory transport
+     and memfd data.  The listening server must serve the next
+     connections as usual.  */
+  err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_socket_connect (ctx, name, ASSUAN_INVALID_PID,
+                                 ASSUAN_SOCKET_CONNECT_FDPASSING);
+  if (err)
+    log_fatal ("assuan_socket_connect failed: %s\n", gpg_strerror (err));
+  err = assuan_use_shm_transport (ctx, 0);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    log_info ("shared memory transport not supported\n");
+  else if (err)
+    log_error ("assuan_use_shm_transport failed: %s\n", gpg_strerror (err));
+  if (get_conn (ctx) != 1)
+    log_error ("wrong connection over shared memory\n");
+  err = assuan_use_memfd_data (ctx, 0);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    log_info ("memfd data not supported\n");
+  else if (err)
+    log_error ("assuan_use_memfd_data failed: %s\n", gpg_strerror (err));
+  check_bulk (ctx);
+  assuan_release (ctx);
+
+  /* The next command is sent before the server has greeted us.  */
+  err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_socket_connect (ctx, name, ASSUAN_INVALID_PID,
+                                 ASSUAN_SOCKET_CONNECT_DEFER_GREETING);
+  if (err)
+    log_fatal ("assuan_socket_connect failed: %s\n", gpg_strerror (err));
+  if (get_conn (ctx) != 2)
+    log_error ("wrong connection with a deferred greeting\n");
+  check_bulk (ctx);
+  assuan_release (ctx);
+
+  err = assuan_pool_new (&pool, 0);
+  if (err)
+    log_fatal ("assuan_pool_new failed: %s\n", gpg_strerror (err));
+  assuan_pool_set_limits (pool, 0, 1, 0);
+
+  err = assuan_pool_get (pool, name, &ctx);
+  if (err)
+    log_fatal ("assuan_pool_get failed: %s\n", gpg_strerror (err));
+  if (get_conn (ctx) != 3)
+    log_error ("wrong connection\n");
+
+  err = assuan_pool_get (pool, name, &ctx2);
+  if (gpg_err_code (err) != GPG_ERR_LIMIT_REACHED)
+    log_error ("expected the limit to be reached but got: %s\n",
+               gpg_strerror (err));
+
+  /* The connection is reused, but not the settings of its last
+     user.  */
+  assuan_set_pointer (ctx, pool);
+  assuan_set_io_timeout (ctx, 1000);
+  assuan_pool_put (ctx, 0);
+  err = assuan_pool_get (pool, name, &ctx2);
+  if (err)
+    log_fatal ("assuan_pool_get failed: %s\n", gpg_strerror (err));
+  if (ctx2 != ctx || get_conn (ctx2) != 3)
+    log_error ("idle connection was not reused\n");
+  if (assuan_get_pointer (ctx2))
+    log_error ("pointer of the last user was kept\n");
+
+  /* A discarded connection is closed.  */
+  assuan_pool_put (ctx2, 1);
+  err = assuan_pool_get (pool, name, &ctx);
+  if (err)
+    log_fatal ("assuan_pool_get failed: %s\n", gpg_strerror (err));
+  if (get_conn (ctx) != 4)
+    log_error ("discarded connection was reused\n");
+
+  /* Releasing a pooled context gives its slot back.  */
+  assuan_release (ctx);
+  err = assuan_pool_get (pool, name, &ctx);
+  if (err)
+    log_fatal ("assuan_pool_get after release failed: %s\n",
+               gpg_strerror (err));
+  if (get_conn (ctx) != 5)
+    log_error ("released connection was reused\n");
+
+  /* An expired connection is closed instead of being handed out.  The
+     server only accepts the next connection after that.  */
+  assuan_pool_set_limits (pool, 0, 1, 1);
+  assuan_pool_put (ctx, 0);
+  sleep (2);
+  err = assuan_pool_get (pool, name, &ctx);
+  if (err)
+    log_fatal ("assuan_pool_get failed: %s\n", gpg_strerror (err));
+  if (get_conn (ctx) != 6)
+    log_error ("expired connection was reused\n");
+
+  /* The pool may be released while a context is handed out.  */
+  assuan_pool_release (pool);
+  if (get_conn (ctx) != 6)
+    log_error ("detached connection does not work\n");
+  assuan_pool_put (ctx, 0);
+
+  err = assuan_pool_new (&pool, 0);
+  if (err)
+    log_fatal ("assuan_pool_new failed: %s\n", gpg_strerror (err));
+  err = assuan_pool_get (pool, name, &ctx);
+  if (err)
+    log_fatal ("assuan_pool_get failed: %s\n", gpg_strerror (err));
+  assuan_pool_put (ctx, 0);
+
+  /* A connection closed by the server is not handed out.  */
+  kill (server_pid, SIGTERM);
+  waitpid (server_pid, NULL, 0);
+  err = assuan_pool_get (pool, name, &ctx);
+  if (!err)
+    {
+      log_error ("got a connection to a dead server\n");
+      assuan_pool_put (ctx, 1);
+    }
+
+  assuan_pool_release (pool);
+}
+
+
+
+/*
+
+       M A I N
+
+*/
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  char cwd[256];
+  char name[300];
+  struct sockaddr_un addr_un;
+  assuan_fd_t fd;
+  pid_t pid;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  /* The server may answer a BYE after the client has gone.  */
+  signal (SIGPIPE, SIG_IGN);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  /* assuan_socket_connect requires an absolute name.  */
+  if (!getcwd (cwd, sizeof cwd))
+    log_fatal ("getcwd failed: %s\n", strerror (errno));
+  snprintf (name, sizeof name, "%s/pool-%d.sock", cwd, (int)getpid ());
+  remove (name);
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  if (assuan_sock_set_sockaddr_un (name, (struct sockaddr *)&addr_un, NULL)
+      || assuan_sock_bind (fd, (struct sockaddr *)&addr_un, sizeof addr_un)
+      || listen (fd, 5))
+    log_fatal ("can't listen on `%s': %s\n", name, strerror (errno));
+
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    log_fatal ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      /* Don't hang around if the client dies.  */
+      alarm (30);
+      server (fd);
+      _exit (errorcount? 1 : 0);
+    }
+  assuan_sock_close (fd);
+
+  client (name, pid);
+  remove (name);
+
+  return errorcount ? 1 : 0;
+}
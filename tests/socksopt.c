@@ -0,0 +1,266 @@
+/* socksopt.c - Check the optimistic SOCKS5 handshake.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* The port Libassuan uses for ASSUAN_SOCK_SOCKS.  */
+#define SOCKS_PORT 1080
+
+/* The time in milliseconds the stand-in proxy waits before it answers
+   what it has received.  This simulates the round trip to a remote
+   proxy.  */
+#define DELAY 100
+
+
+/* Return the milliseconds since START.  */
+static long
+elapsed (struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000
+    + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+
+
+/*
+
+       S E R V E R
+
+*/
+
+/* Return the length of the SOCKS5 message at BUFFER of LENGTH bytes.
+   The first message is the method negotiation, the others are
+   requests.  Returns 0 if the message is not yet complete.  */
+static size_t
+message_length (const unsigned char *buffer, size_t length, int first)
+{
+  size_t n;
+
+  if (first)
+    n = length < 2? 0 : 2 + buffer[1];
+  else if (length < 5)
+    n = 0;
+  else if (buffer[3] == 1)
+    n = 4 + 4 + 2;
+  else if (buffer[3] == 4)
+    n = 4 + 16 + 2;
+  else
+    n = 4 + 1 + buffer[4] + 2;
+  return n <= length? n : 0;
+}
+
+
+/* Serve one client on FD like a SOCKS5 proxy which accepts any
+   request but doesn't forward anything.  */
+static void
+serve (int fd)
+{
+  static const unsigned char method_reply[2] = { 5, 0 };
+  static const unsigned char request_reply[10] = { 5, 0, 0, 1 };
+  unsigned char buffer[1024];
+  size_t length = 0;
+  size_t n;
+  ssize_t nread;
+  int first = 1;
+
+  for (;;)
+    {
+      nread = read (fd, buffer + length, sizeof buffer - length);
+      if (nread <= 0)
+        break;
+      length += nread;
+
+      /* Everything sent in one go is answered in one go.  */
+      usleep (DELAY * 1000);
+      while ((nread = recv (fd, buffer + length, sizeof buffer - length,
+                            MSG_DONTWAIT)) > 0)
+        length += nread;
+
+      while ((n = message_length (buffer, length, first)))
+        {
+          if (first)
+            {
+              if (buffer[0] != 5)
+                log_error ("bad method negotiation\n");
+              write (fd, method_reply, sizeof method_reply);
+            }
+          else
+            {
+              if (buffer[0] != 5 || buffer[1] != 1)
+                log_error ("bad connect request\n");
+              write (fd, request_reply, sizeof request_reply);
+            }
+          first = 0;
+          length -= n;
+          memmove (buffer, buffer + n, length);
+        }
+    }
+  close (fd);
+}
+
+
+static void
+server (int lfd)
+{
+  int fd;
+
+  while ((fd = accept (lfd, NULL, NULL)) >= 0)
+    serve (fd);
+}
+
+
+
+/*
+
+       C L I E N T
+
+*/
+
+/* Connect through the stand-in proxy using FLAGS and return the time
+   it took in milliseconds.  */
+static long
+timed_connect (unsigned int flags)
+{
+  struct timeval start;
+  assuan_fd_t fd;
+  long ms;
+
+  gettimeofday (&start, NULL);
+  fd = assuan_sock_connect_byname ("example.org", 80, 0, NULL,
+                                   ASSUAN_SOCK_SOCKS | flags);
+  ms = elapsed (&start);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      log_error ("connecting through the proxy failed: %s\n",
+                 strerror (errno));
+      return -1;
+    }
+  assuan_sock_close (fd);
+  return ms;
+}
+
+
+static void
+client (void)
+{
+  long normal, optimistic;
+
+  normal = timed_connect (0);
+  optimistic = timed_connect (ASSUAN_SOCK_OPTIMISTIC);
+  if (normal < 0 || optimistic < 0)
+    return;
+
+  if (verbose)
+    log_info ("handshake took %ldms, optimistic %ldms, saved %ldms\n",
+              normal, optimistic, normal - optimistic);
+  if (normal < 2 * DELAY)
+    log_error ("handshake took only %ldms\n", normal);
+  if (optimistic >= 2 * DELAY)
+    log_error ("optimistic handshake took %ldms\n", optimistic);
+}
+
+
+
+/*
+
+       M A I N
+
+*/
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  struct sockaddr_in addr;
+  int lfd, one = 1;
+  pid_t pid;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  /* The proxy port is fixed; skip the test if it is taken.  */
+  lfd = socket (AF_INET, SOCK_STREAM, 0);
+  if (lfd < 0)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  setsockopt (lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  memset (&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (SOCKS_PORT);
+  if (bind (lfd, (struct sockaddr *)&addr, sizeof addr) || listen (lfd, 5))
+    {
+      if (verbose)
+        log_info ("skipping test: can't listen on port %d: %s\n",
+                  SOCKS_PORT, strerror (errno));
+      return 77;
+    }
+
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    log_fatal ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      /* Don't hang around if the client dies.  */
+      alarm (30);
+      server (lfd);
+      _exit (errorcount? 1 : 0);
+    }
+  close (lfd);
+
+  client ();
+
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+  return errorcount ? 1 : 0;
+}
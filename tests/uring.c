@@ -0,0 +1,384 @@
+/* uring.c - Check the io_uring driver.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+#define NCLIENTS 16
+
+/* The size of the data sent by PING.  This is more than fits into
+   the socket buffer so that the writes are partial.  */
+#define PING_SIZE 300000
+
+/* The size of the data sent by SIGN.  */
+#define SIGN_SIZE 64
+
+/* The number of PINGs sent at once without reading the responses.  */
+#define NPIPELINED 20
+
+
+/*
+
+       S E R V E R
+
+*/
+
+static int commands;
+
+/* The deferred SIGN commands not yet finished.  */
+static assuan_deferred_t pending[NCLIENTS];
+static int npending;
+
+/* Send PING_SIZE bytes of data.  Like all handlers run by
+   assuan_process_next, it needs to finish with assuan_process_done.  */
+static gpg_error_t
+cmd_ping (assuan_context_t ctx, char *line)
+{
+  static char buf[PING_SIZE];
+
+  (void)line;
+
+  commands++;
+  memset (buf, 'x', sizeof buf);
+  return assuan_process_done (ctx, assuan_send_data (ctx, buf, sizeof buf));
+}
+
+
+/* Defer the command.  It is finished by finish_pending, which plays
+   the role of a worker thread.  */
+static gpg_error_t
+cmd_sign (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+
+  (void)line;
+
+  commands++;
+  if (npending == NCLIENTS)
+    return assuan_process_done (ctx, gpg_error (GPG_ERR_TOO_MANY));
+  err = assuan_defer (ctx, &pending[npending]);
+  if (err)
+    return assuan_process_done (ctx, err);
+  npending++;
+  return 0;
+}
+
+
+/* Finish the deferred commands.  The output is written by the ring
+   in the next round.  */
+static void
+finish_pending (void)
+{
+  char buf[SIGN_SIZE];
+  gpg_error_t err;
+  int i;
+
+  memset (buf, 'x', sizeof buf);
+  for (i = 0; i < npending; i++)
+    {
+      err = assuan_deferred_status (pending[i], "PROGRESS", "sign");
+      if (!err)
+        err = assuan_deferred_data (pending[i], buf, sizeof buf);
+      assuan_deferred_done (pending[i], err);
+    }
+  npending = 0;
+}
+
+
+static gpg_error_t
+accept_cb (void *opaque, assuan_context_t ctx)
+{
+  gpg_error_t err;
+
+  (void)opaque;
+
+  err = assuan_register_command (ctx, "PING", cmd_ping, NULL);
+  if (!err)
+    err = assuan_register_command (ctx, "SIGN", cmd_sign, NULL);
+  if (!err)
+    err = assuan_accept (ctx);
+  return err;
+}
+
+
+/* Drive the connections until all clients have been served.  */
+static void
+server (assuan_fd_t fd)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  assuan_uring_t ring;
+  unsigned int active = 0;
+  unsigned int rounds = 0;
+
+  err = assuan_uring_new (&ring, 0);
+  if (!err)
+    err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_init_socket_server (ctx, fd, 0);
+  if (!err)
+    err = assuan_uring_add_listener (ring, ctx, accept_cb, NULL, 0);
+  if (err)
+    log_fatal ("server setup failed: %s\n", gpg_strerror (err));
+
+  while (commands < 2 * NCLIENTS + NPIPELINED || active)
+    {
+      err = assuan_uring_run (ring, 100, &active);
+      if (err)
+        {
+          log_error ("assuan_uring_run failed: %s\n", gpg_strerror (err));
+          break;
+        }
+      rounds++;
+      finish_pending ();
+    }
+
+  if (verbose)
+    log_info ("%d commands from %d clients in %u rounds\n",
+              commands, NCLIENTS, rounds);
+
+  assuan_uring_release (ring);
+  assuan_release (ctx);
+}
+
+
+
+/*
+
+       C L I E N T
+
+*/
+
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  size_t *r_size = opaque;
+  const char *p = buffer;
+  size_t n;
+
+  for (n = 0; n < length; n++)
+    if (p[n] != 'x')
+      return gpg_error (GPG_ERR_INV_DATA);
+  *r_size += length;
+  return 0;
+}
+
+
+static gpg_error_t
+status_cb (void *opaque, const char *line)
+{
+  int *r_count = opaque;
+
+  if (!strcmp (line, "PROGRESS sign"))
+    ++*r_count;
+  return 0;
+}
+
+
+/* Read the response to a PING sent with assuan_write_line.  */
+static gpg_error_t
+read_ping (assuan_context_t ctx, size_t *r_size)
+{
+  gpg_error_t err;
+  assuan_response_t response;
+  char *line;
+  int linelen, off;
+
+  for (;;)
+    {
+      err = assuan_client_read_response (ctx, &line, &linelen);
+      if (!err)
+        err = assuan_client_parse_response (ctx, line, linelen,
+                                            &response, &off);
+      if (err)
+        return err;
+      if (response == ASSUAN_RESPONSE_DATA)
+        {
+          err = data_cb (r_size, line + off, linelen - off);
+          if (err)
+            return err;
+        }
+      else if (response == ASSUAN_RESPONSE_OK)
+        return 0;
+      else
+        return gpg_error (GPG_ERR_ASS_UNEXPECTED_CMD);
+    }
+}
+
+
+static void
+client (const char *name)
+{
+  gpg_error_t err;
+  assuan_context_t ctx[NCLIENTS];
+  size_t size;
+  int i, count;
+  char pipelined[5 * NPIPELINED];
+  assuan_fd_t fds[2];
+
+  /* All connections are open at the same time.  */
+  for (i = 0; i < NCLIENTS; i++)
+    {
+      err = assuan_new (&ctx[i]);
+      if (!err)
+        err = assuan_socket_connect (ctx[i], name, ASSUAN_INVALID_PID, 0);
+      if (err)
+        log_fatal ("assuan_socket_connect failed: %s\n", gpg_strerror (err));
+    }
+
+  for (i = 0; i < NCLIENTS; i++)
+    {
+      size = 0;
+      err = assuan_transact (ctx[i], "PING", data_cb, &size,
+                             NULL, NULL, NULL, NULL);
+      if (err)
+        log_error ("PING failed: %s\n", gpg_strerror (err));
+      else if (size != PING_SIZE)
+        log_error ("PING returned %lu bytes\n", (unsigned long)size);
+
+      /* Let the server finish a command from its event loop.  */
+      size = count = 0;
+      err = assuan_transact (ctx[i], "SIGN", data_cb, &size,
+                             NULL, NULL, status_cb, &count);
+      if (err)
+        log_error ("SIGN failed: %s\n", gpg_strerror (err));
+      else if (size != SIGN_SIZE || count != 1)
+        log_error ("SIGN returned %lu bytes and %d status lines\n",
+                   (unsigned long)size, count);
+    }
+
+  /* Send several commands in one write before reading any response.
+     The server holds back the next command until the output has
+     drained.  */
+  for (i = 0; i < NPIPELINED; i++)
+    memcpy (pipelined + 5 * i, "PING\n", 5);
+  if (assuan_get_active_fds (ctx[0], 1, fds, DIM (fds)) != 1
+      || write (fds[0], pipelined, sizeof pipelined) != sizeof pipelined)
+    log_fatal ("writing PINGs failed: %s\n", strerror (errno));
+  for (i = 0; i < NPIPELINED; i++)
+    {
+      size = 0;
+      err = read_ping (ctx[0], &size);
+      if (err)
+        log_error ("pipelined PING failed: %s\n", gpg_strerror (err));
+      else if (size != PING_SIZE)
+        log_error ("pipelined PING returned %lu bytes\n",
+                   (unsigned long)size);
+    }
+
+  for (i = 0; i < NCLIENTS; i++)
+    assuan_release (ctx[i]);
+}
+
+
+
+/*
+
+       M A I N
+
+*/
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  char cwd[256];
+  char name[300];
+  struct sockaddr_un addr_un;
+  assuan_fd_t fd;
+  assuan_uring_t ring;
+  pid_t pid;
+  int status;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  if (argc && !strcmp (*argv, "--verbose"))
+    verbose = 1;
+  else if (argc && !strcmp (*argv, "--debug"))
+    verbose = debug = 1;
+
+  assuan_set_assuan_log_prefix (log_get_prefix ());
+  if (debug)
+    assuan_set_assuan_log_stream (stderr);
+
+  err = assuan_sock_init ();
+  if (err)
+    log_fatal ("socket init failed: %s\n", gpg_strerror (err));
+
+  err = assuan_uring_new (&ring, 0);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      if (verbose)
+        log_info ("skipping test: %s\n", gpg_strerror (err));
+      return 77;
+    }
+  if (err)
+    log_fatal ("assuan_uring_new failed: %s\n", gpg_strerror (err));
+  assuan_uring_release (ring);
+
+  /* assuan_socket_connect requires an absolute name.  */
+  if (!getcwd (cwd, sizeof cwd))
+    log_fatal ("getcwd failed: %s\n", strerror (errno));
+  snprintf (name, sizeof name, "%s/uring-%d.sock", cwd, (int)getpid ());
+  remove (name);
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  if (assuan_sock_set_sockaddr_un (name, (struct sockaddr *)&addr_un, NULL)
+      || assuan_sock_bind (fd, (struct sockaddr *)&addr_un, sizeof addr_un)
+      || listen (fd, NCLIENTS))
+    log_fatal ("can't listen on `%s': %s\n", name, strerror (errno));
+
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    log_fatal ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      /* Don't hang around if the client dies.  */
+      alarm (30);
+      server (fd);
+      _exit (errorcount? 1 : 0);
+    }
+  assuan_sock_close (fd);
+
+  client (name);
+  if (waitpid (pid, &status, 0) != pid
+      || !WIFEXITED (status) || WEXITSTATUS (status))
+    log_error ("server failed\n");
+  remove (name);
+
+  return errorcount ? 1 : 0;
+}